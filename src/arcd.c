@@ -159,63 +159,85 @@ int encode_sel(const int sels[64], uint64_t *code) {
   return 0;
 }
 
+/**
+ * Decodes the next selector in `code`, narrowing [low, high) to its interval.
+ */
+static inline int decode_next_sel(uint64_t code, uint64_t *low, uint64_t *high) {
+  uint64_t range = *high - *low;
+  uint64_t gap = (range >> 1) + (range >> 2) + (range >> 5);
+
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 0;
+  }
+  *low += gap;
+  gap = (range >> 3) + (range >> 4) + (range >> 7) + (range >> 9);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 1;
+  }
+  *low += gap;
+  gap = (range >> 6) + (range >> 8);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 2;
+  }
+  *low += gap;
+  gap = (range >> 10) + (range >> 11);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 3;
+  }
+  *low += gap;
+  gap = (range >> 14) + (range >> 16);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 4;
+  }
+  *low += gap;
+  gap = (range >> 19) + (range >> 20) + (range >> 23);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 5;
+  }
+  *low += gap;
+  gap = (range >> 24) + (range >> 25) + (range >> 26);
+  if(*low + gap > code) {
+    *high = *low + gap;
+    return 6;
+  }
+  return 7;
+}
+
 void decode_sel(uint64_t code, int out[64]) {
+  decode_sel_upto(code, 63, out);
+}
+
+void decode_sel_upto(uint64_t code, int k, int out[64]) {
+  // Every nonzero selector raises the bottom of the interval, so only
+  // all-zero selectors encode to 0
+  if (code == 0) {
+    memset(out, 0, (k + 1) * sizeof(int));
+    return;
+  }
   uint64_t low = 0;
   uint64_t high = HIGH;
+  for (int i=0; i <= k; i++) {
+    out[i] = decode_next_sel(code, &low, &high);
+  }
+}
 
-  for (int i=0; i < 64; i++){
-    uint64_t range = high - low;
-    uint64_t gap = (range >> 1) + (range >> 2) + (range >> 5);
-
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 0;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 3) + (range >> 4) + (range >> 7) + (range >> 9);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 1;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 6) + (range >> 8);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 2;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 10) + (range >> 11);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 3;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 14) + (range >> 16);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 4;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 19) + (range >> 20) + (range >> 23);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 5;
-      continue;
-    }
-    low += gap;
-    gap = (range >> 24) + (range >> 25) + (range >> 26);
-    if(low + gap > code) {
-      high = low + gap;
-      out[i] = 6;
-      continue;
-    }
-    out[i] = 7;
+int decode_sel_at(uint64_t code, int k) {
+  if (code == 0) {
+    return 0;
   }
+  uint64_t low = 0;
+  uint64_t high = HIGH;
+  int sel = 0;
+  for (int i=0; i <= k; i++) {
+    sel = decode_next_sel(code, &low, &high);
+  }
+  return sel;
 }
 
 /* Tests */
@@ -520,7 +542,47 @@ void test_encode_decode_too_many() {
   printf("passed.\n");
 }
 
+void test_decode_sel_prefix() {
+  printf("Testing %s...", __FUNCTION__);
+  int sels[64];
+  int decoded[64];
+  int prefix[64];
+  uint64_t code;
+  // All-zero selectors encode to 0
+  memset(sels, 0, sizeof(sels));
+  assert_eq(encode_sel(sels, &code), 0);
+  assert_eq(code, 0);
+  decode_sel_upto(code, 63, prefix);
+  for (int i=0; i<64; i++) {
+    assert_eq(prefix[i], 0);
+    assert_eq(decode_sel_at(code, i), 0);
+  }
+  // Prefixes of random selectors match full decodes
+  srandom(1);
+  for (int trial=0; trial < 1000; trial++) {
+    int nonzero = 0;
+    for (int i=0; i<64; i++) {
+      sels[i] = random() % 8 == 0 ? random() % 3 + 1 : 0;
+      nonzero |= sels[i];
+    }
+    if (encode_sel(sels, &code) == -1) {
+      continue;
+    }
+    assert_eq(code != 0, nonzero != 0);
+    decode_sel(code, decoded);
+    int k = (int)(random() % 64);
+    memset(prefix, -1, sizeof(prefix));
+    decode_sel_upto(code, k, prefix);
+    for (int i=0; i<64; i++) {
+      assert_eq(prefix[i], i <= k ? sels[i] : -1);
+      assert_eq(decode_sel_at(code, i), sels[i]);
+    }
+  }
+  printf("passed.\n");
+}
+
 int main() {
+  test_decode_sel_prefix();
   test_strs_to_exts();
   test_encode_decode_empty();
   test_encode_decode_one();
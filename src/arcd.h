@@ -34,6 +34,18 @@ int encode_sel(const int sels[64], uint64_t *code);
  */
 void decode_sel(uint64_t code, int out[64]);
 
+/**
+ * Decodes only selectors 0 through k of the input into out[0..k], which is
+ * all a lookup in slot k needs.
+ */
+void decode_sel_upto(uint64_t code, int k, int out[64]);
+
+/**
+ * Decodes the input up to selector k.
+ * @return selector k
+ */
+int decode_sel_at(uint64_t code, int k);
+
 #ifdef __cplusplus
 }
 #endif
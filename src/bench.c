@@ -0,0 +1,286 @@
+/*
+ * Throughput benchmarks for the RSQF, TAF, uTAF, exAF, and sharded TAF.
+ * `taf_log` is the TAF with a log remote (see remote.h) instead of an array.
+ *
+ * Every filter is driven through the same workloads at each load factor:
+ * - insert:     insert n = load * nslots keys into an empty filter
+ * - lookup_pos: query the n inserted keys
+ * - lookup_neg: query n keys that were never inserted
+ * - lookup_batch_pos, lookup_batch_neg: as above, using the batched lookup API
+ * - build_bulk: build a filter from the n keys at once (RSQF and TAF, and the
+ *               sharded TAF's batch insert)
+ * - mixed:      fill to load/2, then interleave the remaining inserts with
+ *               positive and negative lookups (1 insert : 4 lookups)
+ *
+ * Results are written to stdout as CSV, one row per (filter, workload, load).
+ *
+ * Usage: ./bench [log2(nslots)] [seed]
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "taf.h"
+#include "utaf.h"
+#include "exaf.h"
+#include "rsqf.h"
+#include "sharded_taf.h"
+
+#define BENCH_DEFAULT_LOG_NSLOTS 20
+#define BENCH_DEFAULT_SEED 32776517
+#define BENCH_LOG_SHARDS 4
+
+/* Filter interface */
+
+typedef struct bench_filter_t {
+  const char *name;
+  void *(*create)(size_t nslots, int seed);
+  void (*destroy)(void *filter);
+  void (*insert)(void *filter, elt_t elt);
+  int (*lookup)(void *filter, elt_t elt);
+  void (*lookup_batch)(void *filter, const elt_t *elts, size_t n, uint8_t *out);
+  void (*build_bulk)(void *filter, const elt_t *elts, size_t n); /* may be NULL */
+} BenchFilter;
+
+static void *rsqf_create(size_t nslots, int seed) {
+  RSQF *filter = malloc(sizeof(RSQF));
+  rsqf_init(filter, nslots, seed);
+  return filter;
+}
+static void rsqf_destroy_v(void *filter) { rsqf_destroy(filter); }
+static void rsqf_insert_v(void *filter, elt_t elt) { rsqf_insert(filter, elt); }
+static int rsqf_lookup_v(void *filter, elt_t elt) { return rsqf_lookup(filter, elt); }
+static void rsqf_lookup_batch_v(void *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  rsqf_lookup_batch(filter, elts, n, out);
+}
+static void rsqf_build_bulk_v(void *filter, const elt_t *elts, size_t n) {
+  rsqf_build_bulk(filter, elts, n);
+}
+
+static void *taf_create(size_t nslots, int seed) {
+  TAF *filter = malloc(sizeof(TAF));
+  taf_init(filter, nslots, seed);
+  return filter;
+}
+static void taf_destroy_v(void *filter) { taf_destroy(filter); }
+static void taf_insert_v(void *filter, elt_t elt) { taf_insert(filter, elt); }
+static int taf_lookup_v(void *filter, elt_t elt) { return taf_lookup(filter, elt); }
+static void taf_lookup_batch_v(void *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  taf_lookup_batch(filter, elts, n, out);
+}
+static void taf_build_bulk_v(void *filter, const elt_t *elts, size_t n) {
+  taf_build_bulk(filter, elts, n);
+}
+
+static void *taf_log_create(size_t nslots, int seed) {
+  TAF *filter = malloc(sizeof(TAF));
+  taf_init_remote(filter, nslots, seed, new_log_remote(0));
+  return filter;
+}
+
+static void *utaf_create(size_t nslots, int seed) {
+  FullTAF *filter = malloc(sizeof(FullTAF));
+  utaf_init(filter, nslots, seed);
+  return filter;
+}
+static void utaf_destroy_v(void *filter) { utaf_destroy(filter); }
+static void utaf_insert_v(void *filter, elt_t elt) { utaf_insert(filter, elt); }
+static int utaf_lookup_v(void *filter, elt_t elt) { return utaf_lookup(filter, elt); }
+static void utaf_lookup_batch_v(void *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  utaf_lookup_batch(filter, elts, n, out);
+}
+
+static void *exaf_create(size_t nslots, int seed) {
+  ExAF *filter = malloc(sizeof(ExAF));
+  exaf_init(filter, nslots, seed);
+  return filter;
+}
+static void exaf_destroy_v(void *filter) { exaf_destroy(filter); }
+static void exaf_insert_v(void *filter, elt_t elt) { exaf_insert(filter, elt); }
+static int exaf_lookup_v(void *filter, elt_t elt) { return exaf_lookup(filter, elt); }
+static void exaf_lookup_batch_v(void *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  exaf_lookup_batch(filter, elts, n, out);
+}
+
+static void *sharded_taf_create(size_t nslots, int seed) {
+  ShardedTAF *filter = malloc(sizeof(ShardedTAF));
+  sharded_taf_init(filter, nslots, BENCH_LOG_SHARDS, (int)sysconf(_SC_NPROCESSORS_ONLN), seed);
+  return filter;
+}
+static void sharded_taf_destroy_v(void *filter) { sharded_taf_destroy(filter); }
+static void sharded_taf_insert_v(void *filter, elt_t elt) { sharded_taf_insert(filter, elt); }
+static int sharded_taf_lookup_v(void *filter, elt_t elt) { return sharded_taf_lookup(filter, elt); }
+static void sharded_taf_lookup_batch_v(void *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  sharded_taf_lookup_batch(filter, elts, n, out);
+}
+static void sharded_taf_insert_batch_v(void *filter, const elt_t *elts, size_t n) {
+  // Filters are empty when built, so this matches build_bulk
+  sharded_taf_insert_batch(filter, elts, n);
+}
+
+static const BenchFilter filters[] = {
+  {"rsqf", rsqf_create, rsqf_destroy_v, rsqf_insert_v, rsqf_lookup_v, rsqf_lookup_batch_v,
+   rsqf_build_bulk_v},
+  {"taf", taf_create, taf_destroy_v, taf_insert_v, taf_lookup_v, taf_lookup_batch_v,
+   taf_build_bulk_v},
+  {"taf_log", taf_log_create, taf_destroy_v, taf_insert_v, taf_lookup_v, taf_lookup_batch_v,
+   taf_build_bulk_v},
+  {"utaf", utaf_create, utaf_destroy_v, utaf_insert_v, utaf_lookup_v, utaf_lookup_batch_v,
+   NULL},
+  {"exaf", exaf_create, exaf_destroy_v, exaf_insert_v, exaf_lookup_v, exaf_lookup_batch_v,
+   NULL},
+  {"sharded_taf", sharded_taf_create, sharded_taf_destroy_v, sharded_taf_insert_v,
+   sharded_taf_lookup_v, sharded_taf_lookup_batch_v, sharded_taf_insert_batch_v},
+};
+#define N_FILTERS (sizeof(filters)/sizeof(filters[0]))
+
+static const double loads[] = {0.5, 0.8, 0.9, 0.95};
+#define N_LOADS (sizeof(loads)/sizeof(loads[0]))
+
+/* Helpers */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/**
+ * splitmix64: a fast, deterministic source of 64-bit keys.
+ */
+static uint64_t next_key(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void print_header(void) {
+  printf("filter,workload,load,nslots,ops,seconds,mops_per_sec,ns_per_op\n");
+}
+
+static void print_row(const char *filter, const char *workload, double load,
+                      size_t nslots, size_t ops, double secs) {
+  printf("%s,%s,%.2f,%zu,%zu,%.6f,%.3f,%.2f\n",
+         filter, workload, load, nslots, ops, secs,
+         (double)ops / secs / 1e6, secs * 1e9 / (double)ops);
+  fflush(stdout);
+}
+
+/* Workloads */
+
+static void bench_insert_and_lookups(const BenchFilter *bf, size_t nslots, int seed, double load,
+                                     const elt_t *members, const elt_t *nonmembers, size_t n) {
+  void *filter = bf->create(nslots, seed);
+  volatile int sink = 0;
+
+  double start = now();
+  for (size_t i=0; i<n; i++) {
+    bf->insert(filter, members[i]);
+  }
+  print_row(bf->name, "insert", load, nslots, n, now() - start);
+
+  start = now();
+  for (size_t i=0; i<n; i++) {
+    sink += bf->lookup(filter, members[i]);
+  }
+  print_row(bf->name, "lookup_pos", load, nslots, n, now() - start);
+
+  start = now();
+  for (size_t i=0; i<n; i++) {
+    sink += bf->lookup(filter, nonmembers[i]);
+  }
+  print_row(bf->name, "lookup_neg", load, nslots, n, now() - start);
+
+  uint8_t *out = malloc(n);
+  start = now();
+  bf->lookup_batch(filter, members, n, out);
+  print_row(bf->name, "lookup_batch_pos", load, nslots, n, now() - start);
+  sink += out[n/2];
+
+  start = now();
+  bf->lookup_batch(filter, nonmembers, n, out);
+  print_row(bf->name, "lookup_batch_neg", load, nslots, n, now() - start);
+  sink += out[n/2];
+  free(out);
+
+  (void)sink;
+  bf->destroy(filter);
+}
+
+static void bench_build_bulk(const BenchFilter *bf, size_t nslots, int seed, double load,
+                             const elt_t *members, size_t n) {
+  if (bf->build_bulk == NULL) {
+    return;
+  }
+  void *filter = bf->create(nslots, seed);
+  double start = now();
+  bf->build_bulk(filter, members, n);
+  print_row(bf->name, "build_bulk", load, nslots, n, now() - start);
+  bf->destroy(filter);
+}
+
+static void bench_mixed(const BenchFilter *bf, size_t nslots, int seed, double load,
+                        const elt_t *members, const elt_t *nonmembers, size_t n) {
+  void *filter = bf->create(nslots, seed);
+  volatile int sink = 0;
+  size_t n_inserted = n/2;
+  for (size_t i=0; i<n_inserted; i++) {
+    bf->insert(filter, members[i]);
+  }
+  size_t ops = 0;
+  uint64_t rng = (uint64_t)seed;
+  double start = now();
+  while (n_inserted < n) {
+    bf->insert(filter, members[n_inserted++]);
+    for (int j=0; j<4; j++) {
+      uint64_t x = next_key(&rng);
+      if (x & 1) {
+        sink += bf->lookup(filter, members[(x >> 1) % n_inserted]);
+      } else {
+        sink += bf->lookup(filter, nonmembers[(x >> 1) % n]);
+      }
+    }
+    ops += 5;
+  }
+  print_row(bf->name, "mixed", load, nslots, ops, now() - start);
+  (void)sink;
+  bf->destroy(filter);
+}
+
+int main(int argc, char **argv) {
+  int log_nslots = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_LOG_NSLOTS;
+  int seed = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_SEED;
+  if (log_nslots < 6 || log_nslots > 40) {
+    fprintf(stderr, "usage: %s [log2(nslots) in [6, 40]] [seed]\n", argv[0]);
+    return 1;
+  }
+  size_t nslots = 1ULL << log_nslots;
+
+  // Members and nonmembers are drawn from independent key streams
+  size_t max_n = (size_t)(nslots * loads[N_LOADS - 1]);
+  elt_t *members = malloc(max_n * sizeof(elt_t));
+  elt_t *nonmembers = malloc(max_n * sizeof(elt_t));
+  uint64_t member_rng = (uint64_t)seed;
+  uint64_t nonmember_rng = ~(uint64_t)seed;
+  for (size_t i=0; i<max_n; i++) {
+    members[i] = next_key(&member_rng);
+    nonmembers[i] = next_key(&nonmember_rng);
+  }
+
+  print_header();
+  for (size_t f=0; f<N_FILTERS; f++) {
+    for (size_t l=0; l<N_LOADS; l++) {
+      size_t n = (size_t)(nslots * loads[l]);
+      bench_insert_and_lookups(&filters[f], nslots, seed, loads[l], members, nonmembers, n);
+      bench_build_bulk(&filters[f], nslots, seed, loads[l], members, n);
+      bench_mixed(&filters[f], nslots, seed, loads[l], members, nonmembers, n);
+    }
+  }
+  free(members);
+  free(nonmembers);
+  return 0;
+}
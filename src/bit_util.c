@@ -2,55 +2,52 @@
  *  Bit rank and select, taken from CQF (Pandey et al.)
  */
 #include <stdint.h>
-#include <assert.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "bit_util.h"
 
-// Returns the trailing zero count of val
-int tzcnt(uint64_t val) {
-  asm("tzcnt %[val], %[val]"
-  : [val] "+r" (val)
-  :
-  : "cc");
-  return val;
-}
+int bit_util_features = 0;
 
-// Returns the number of 1s in val
-int popcnt(uint64_t val) {
-  asm("popcnt %[val], %[val]"
-      : [val] "+r" (val)
-      :
-      : "cc");
-  return val;
+/**
+ * Detect which instructions this CPU has, once, before main runs.
+ *
+ * BMI2 is only used on CPUs where pdep is fast: Zen 1 and Zen 2 implement
+ * it in microcode, where it takes tens to hundreds of cycles, so they keep
+ * the broadword select.
+ */
+__attribute__((constructor))
+void bit_util_init(void) {
+  int features = 0;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt")) {
+    features |= BIT_UTIL_POPCNT;
+  }
+  if (__builtin_cpu_supports("bmi")) {
+    features |= BIT_UTIL_BMI1;
+  }
+  // __builtin_cpu_supports doesn't report lzcnt (ABM), so ask cpuid
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & bit_LZCNT)) {
+    features |= BIT_UTIL_LZCNT;
+  }
+  // pdep's result is found with tzcnt, so BMI2 also needs BMI1
+  if ((features & BIT_UTIL_BMI1) && __builtin_cpu_supports("bmi2") &&
+      !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2")) {
+    features |= BIT_UTIL_BMI2;
+  }
+#endif
+  bit_util_features = features;
 }
 
-// Returns the number of 1s up to (including) the pos'th bit, indexing from 0
-uint64_t bitrank(uint64_t val, uint64_t pos) {
-  assert(pos >= 0 && pos < 64 && "pos should be in [0, 63]");
-  val &= ((2ull << pos) - 1); // 2^(pos+1) - 1
-  asm("popcnt %[val], %[val]"
-      : [val] "+r" (val)
-      :
-      : "cc");
-  return val;
+int bit_util_set_features(int features) {
+  int prev = bit_util_features;
+  bit_util_features = features;
+  return prev;
 }
 
-/**
- * Returns the position of the k-th 1 in the 64-bit word x.
- * k is 0-based, so k=0 returns the position of the first 1.
- *
- * Uses the broadword selection algorithm by Vigna [1], improved by Gog
- * and Petri [2] and Vigna [3].
- *
- * [1] Sebastiano Vigna. Broadword Implementation of Rank/Select
- *    Queries. WEA, 2008
- *
- * [2] Simon Gog, Matthias Petri. Optimized succinct data
- * structures for massive data. Softw. Pract. Exper., 2014
- *
- * [3] Sebastiano Vigna. MG4J 5.2.1. http://mg4j.di.unimi.it/
- * The following code is taken from
- * https://github.com/facebook/folly/blob/b28186247104f8b90cfbe094d289c91f9e413317/folly/experimental/Select64.h
- */
+/** Position of the k-th 1 in byte b, at [b | k << 8], for `select64` */
 const uint8_t kSelectInByteAQF[2048] = {
                                      8, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0, 2, 0, 1, 0, 3, 0,
                                      1, 0, 2, 0, 1, 0, 5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4, 0, 1, 0,
@@ -132,40 +129,3 @@ const uint8_t kSelectInByteAQF[2048] = {
                                      8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
                                      8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 7
 };
-
-static inline uint64_t select64(uint64_t x, int k) {
-  if (k >= popcnt(x)) { return 64; }
-	
-  const uint64_t kOnesStep4  = 0x1111111111111111ull;
-  const uint64_t kOnesStep8  = 0x0101010101010101ull;
-  const uint64_t kMSBsStep8  = 0x80ull * kOnesStep8;
-
-  uint64_t s = x;
-  s = s - ((s & 0xAu * kOnesStep4) >> 1u);
-  s = (s & 0x3 * kOnesStep4) + ((s >> 2u) & 0x3 * kOnesStep4);
-  s = (s + (s >> 4u)) & 0xF * kOnesStep8;
-  uint64_t byteSums = s * kOnesStep8;
-
-  uint64_t kStep8 = k * kOnesStep8;
-  uint64_t geqKStep8 = (((kStep8 | kMSBsStep8) - byteSums) & kMSBsStep8);
-  uint64_t place = popcnt(geqKStep8) * 8;
-  uint64_t byteRank = k - (((byteSums << 8u) >> place) & (uint64_t)(0xFF));
-  return place + kSelectInByteAQF[((x >> place) & 0xFFu) | (byteRank << 8u)];
-}
-
-// Returns the position of the rank'th 1.  (rank = 0 returns the 1st 1)
-// Returns 64 if there are fewer than rank+1 1s.
-uint64_t bitselect(uint64_t val, uint64_t rank) {
-#ifdef __SSE4_2_
-  uint64_t i = 1ull << rank; // i = 2^rank
-  asm("pdep %[val], %[mask], %[val]"
-      : [val] "+r" (val)
-      : [mask] "r" (i));
-  asm("tzcnt %[bit], %[index]"
-      : [index] "=r" (i)
-      : [bit] "g" (val)
-      : "cc");
-  return i;
-#endif
-  return select64(val, rank);
-}
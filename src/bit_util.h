@@ -1,13 +1,156 @@
 /*
  *  Bit rank and select, taken from CQF (Pandey et al.)
+ *
+ *  These are inline so that the filters' rank-and-select loops don't pay
+ *  for a call per word.  Each picks its fastest implementation for the CPU
+ *  it runs on from `bit_util_features`, which `bit_util_init` fills in with
+ *  cpuid before main runs, falling back to portable code on CPUs without
+ *  the instructions (or on other architectures).
  */
 
 #ifndef RANKSELECT_H
 #define RANKSELECT_H
 
-int tzcnt(uint64_t val);
-int popcnt(uint64_t val);
-uint64_t bitrank(uint64_t val, uint64_t pos);
-uint64_t bitselect(uint64_t val, uint64_t rank);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+
+/* Bits of bit_util_features */
+#define BIT_UTIL_POPCNT 1       /* popcnt */
+#define BIT_UTIL_BMI1 2         /* tzcnt */
+#define BIT_UTIL_BMI2 4         /* pdep, used only where it is fast */
+#define BIT_UTIL_LZCNT 8        /* lzcnt */
+
+/** Instructions available to rank and select, detected by bit_util_init */
+extern int bit_util_features;
+
+/**
+ * Detect the CPU's features.  Runs automatically at startup; calling it
+ * again is harmless.
+ */
+void bit_util_init(void);
+
+/**
+ * Use only the instructions in `features` (e.g. 0 for the portable
+ * versions), for testing and benchmarking.
+ * @return the previous features.
+ */
+int bit_util_set_features(int features);
+
+extern const uint8_t kSelectInByteAQF[2048];
+
+// Returns the trailing zero count of val, or 64 if val is 0
+static inline int tzcnt(uint64_t val) {
+#if defined(__x86_64__)
+  if (bit_util_features & BIT_UTIL_BMI1) {
+    asm("tzcnt %[val], %[val]"
+        : [val] "+r" (val)
+        :
+        : "cc");
+    return val;
+  }
+#endif
+  return val ? __builtin_ctzll(val) : 64;
+}
+
+// Returns the leading zero count of val, or 64 if val is 0
+static inline int lzcnt(uint64_t val) {
+#if defined(__x86_64__)
+  if (bit_util_features & BIT_UTIL_LZCNT) {
+    asm("lzcnt %[val], %[val]"
+        : [val] "+r" (val)
+        :
+        : "cc");
+    return val;
+  }
+#endif
+  return val ? __builtin_clzll(val) : 64;
+}
+
+// Returns the number of 1s in val
+static inline int popcnt(uint64_t val) {
+#if defined(__x86_64__) && !defined(__POPCNT__)
+  if (bit_util_features & BIT_UTIL_POPCNT) {
+    asm("popcnt %[val], %[val]"
+        : [val] "+r" (val)
+        :
+        : "cc");
+    return val;
+  }
+#endif
+  // A single popcnt when built with -mpopcnt, a libgcc call otherwise
+  return __builtin_popcountll(val);
+}
+
+// Returns the number of 1s up to (including) the pos'th bit, indexing from 0
+static inline uint64_t bitrank(uint64_t val, uint64_t pos) {
+  assert(pos < 64 && "pos should be in [0, 63]");
+  val &= ((2ull << pos) - 1); // 2^(pos+1) - 1
+  return popcnt(val);
+}
+
+/**
+ * Returns the position of the k-th 1 in the 64-bit word x.
+ * k is 0-based, so k=0 returns the position of the first 1.
+ *
+ * Uses the broadword selection algorithm by Vigna [1], improved by Gog
+ * and Petri [2] and Vigna [3].
+ *
+ * [1] Sebastiano Vigna. Broadword Implementation of Rank/Select
+ *    Queries. WEA, 2008
+ *
+ * [2] Simon Gog, Matthias Petri. Optimized succinct data
+ * structures for massive data. Softw. Pract. Exper., 2014
+ *
+ * [3] Sebastiano Vigna. MG4J 5.2.1. http://mg4j.di.unimi.it/
+ * The following code is taken from
+ * https://github.com/facebook/folly/blob/b28186247104f8b90cfbe094d289c91f9e413317/folly/experimental/Select64.h
+ */
+static inline uint64_t select64(uint64_t x, int k) {
+  if (k >= popcnt(x)) { return 64; }
+
+  const uint64_t kOnesStep4  = 0x1111111111111111ull;
+  const uint64_t kOnesStep8  = 0x0101010101010101ull;
+  const uint64_t kMSBsStep8  = 0x80ull * kOnesStep8;
+
+  uint64_t s = x;
+  s = s - ((s & 0xAu * kOnesStep4) >> 1u);
+  s = (s & 0x3 * kOnesStep4) + ((s >> 2u) & 0x3 * kOnesStep4);
+  s = (s + (s >> 4u)) & 0xF * kOnesStep8;
+  uint64_t byteSums = s * kOnesStep8;
+
+  uint64_t kStep8 = k * kOnesStep8;
+  uint64_t geqKStep8 = (((kStep8 | kMSBsStep8) - byteSums) & kMSBsStep8);
+  uint64_t place = popcnt(geqKStep8) * 8;
+  uint64_t byteRank = k - (((byteSums << 8u) >> place) & (uint64_t)(0xFF));
+  return place + kSelectInByteAQF[((x >> place) & 0xFFu) | (byteRank << 8u)];
+}
+
+// Returns the position of the rank'th 1.  (rank = 0 returns the 1st 1)
+// Returns 64 if there are fewer than rank+1 1s.
+static inline uint64_t bitselect(uint64_t val, uint64_t rank) {
+#if defined(__x86_64__)
+  if (bit_util_features & BIT_UTIL_BMI2) {
+    // Deposit a 1 at the rank'th 1 of val, then find it
+    uint64_t bit;
+    asm("pdep %[val], %[i], %[bit]"
+        : [bit] "=r" (bit)
+        : [i] "r" (1ull << rank), [val] "r" (val));
+    asm("tzcnt %[bit], %[bit]"
+        : [bit] "+r" (bit)
+        :
+        : "cc");
+    return bit;
+  }
+#endif
+  return select64(val, rank);
+}
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif //RANKSELECT_H
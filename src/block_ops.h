@@ -0,0 +1,242 @@
+/*
+   Word-level operations on the slots of RSQF-style blocks, shared by the
+   filters whose blocks start with 64 remainders and keep runends in a word
+*/
+#ifndef BLOCK_OPS_H
+#define BLOCK_OPS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bit_util.h"
+#include "macros.h"
+#include "remainder.h"
+
+/**
+ * Where a filter's remainders and runends sit in its array of blocks:
+ * every block is `block_size` bytes, with `rem_t remainders[64]` at
+ * `rems_offset` and a `uint64_t runends` word at `runends_offset`.
+ */
+typedef struct block_layout_t {
+  char *blocks;
+  size_t block_size;
+  size_t rems_offset;
+  size_t runends_offset;
+} BlockLayout;
+
+/** The layout of `filter`'s blocks, for any filter with RSQF-style blocks */
+#define block_layout(filter)                                            \
+  ((BlockLayout) {                                                      \
+    (char *)(filter)->blocks,                                           \
+    sizeof(*(filter)->blocks),                                          \
+    (size_t)((char *)(filter)->blocks[0].remainders - (char *)(filter)->blocks), \
+    (size_t)((char *)&(filter)->blocks[0].runends - (char *)(filter)->blocks), \
+  })
+
+static inline rem_t *layout_rems(BlockLayout layout, size_t block_i) {
+  return (rem_t *)(layout.blocks + block_i * layout.block_size + layout.rems_offset);
+}
+
+static inline uint64_t *layout_runends(BlockLayout layout, size_t block_i) {
+  return (uint64_t *)(layout.blocks + block_i * layout.block_size + layout.runends_offset);
+}
+
+/**
+ * Shift the remainders and runends in [a, b] forward by 1 into [a+1, b+1],
+ * unsetting the runend at a.  The remainder at a is left as it was.
+ *
+ * Works a block at a time from the last, moving each block's remainders
+ * with one memmove and its runends with one word shift, and carrying slot
+ * 63 of the previous block into slot 0.
+ */
+static inline void block_shift_slots(BlockLayout layout, int a, int b) {
+  if (a > b) return;
+  int first = a/64;
+  for (int i = (b+1)/64; i >= first; i--) {
+    // Move the slots in [lo, hi-1] of this block to [lo+1, hi]
+    int lo = (i == first) ? a%64 : 0;
+    int hi = (i == (b+1)/64) ? (b+1)%64 : 63;
+    rem_t *rems = layout_rems(layout, i);
+    uint64_t *runends = layout_runends(layout, i);
+    uint64_t word = *runends;
+    memmove(&rems[lo+1], &rems[lo], (hi - lo) * sizeof(rem_t));
+    if (hi > lo) {
+      uint64_t mask = MASK_CLOSED(lo+1, hi);
+      word = (word & ~mask) | ((word << 1) & mask);
+    }
+    if (i > first) {
+      // Carry in the last slot of the previous block
+      rems[0] = layout_rems(layout, i-1)[63];
+      word = (word & ~1ULL) | (*layout_runends(layout, i-1) >> 63);
+    } else {
+      UNSET(word, lo);
+    }
+    *runends = word;
+  }
+}
+
+/**
+ * Shift the remainders and runends in [a+1, b] back by 1 into [a, b-1],
+ * clearing slot b.  Inverse of `block_shift_slots`.
+ */
+static inline void block_unshift_slots(BlockLayout layout, int a, int b) {
+  if (a > b) return;
+  int last = b/64;
+  for (int i = a/64; i <= last; i++) {
+    // Move the slots in [lo+1, hi] of this block to [lo, hi-1]
+    int lo = (i == a/64) ? a%64 : 0;
+    int hi = (i == last) ? b%64 : 63;
+    rem_t *rems = layout_rems(layout, i);
+    uint64_t *runends = layout_runends(layout, i);
+    uint64_t word = *runends;
+    memmove(&rems[lo], &rems[lo+1], (hi - lo) * sizeof(rem_t));
+    if (hi > lo) {
+      uint64_t mask = MASK_CLOSED(lo, hi-1);
+      word = (word & ~mask) | ((word >> 1) & mask);
+    }
+    if (i < last) {
+      // Carry in the first slot of the next block
+      rems[63] = layout_rems(layout, i+1)[0];
+      word = (word & ~ONE(63)) | (*layout_runends(layout, i+1) << 63);
+    } else {
+      rems[hi] = 0;
+      UNSET(word, hi);
+    }
+    *runends = word;
+  }
+}
+
+/**
+ * @return a mask of the slots in [lo, hi] of a block whose remainders equal
+ * `rem`, indexing from the LSB.
+ *
+ * With 8-bit remainders on x86-64, compares all 64 remainders at once (two
+ * AVX2 compares when built with -mavx2, otherwise four SSE2 compares, which
+ * every x86-64 CPU has) and masks off the slots outside [lo, hi].  Elsewhere,
+ * compares the slots in [lo, hi] one at a time.
+ */
+static inline uint64_t block_match_rems(const rem_t rems[64], rem_t rem, int lo, int hi) {
+  uint64_t range = ((2ULL << hi) - 1) & ~ONES(lo);
+#if defined(__x86_64__) && REM_SIZE <= 8
+#if defined(__AVX2__)
+  __m256i key = _mm256_set1_epi8((char)rem);
+  uint64_t lo_half = (uint32_t)_mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)rems), key));
+  uint64_t hi_half = (uint32_t)_mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(rems + 32)), key));
+  return (lo_half | hi_half << 32) & range;
+#else
+  __m128i key = _mm_set1_epi8((char)rem);
+  uint64_t matches = 0;
+  for (int i=0; i<4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(rems + 16*i));
+    matches |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, key)) << (16*i);
+  }
+  return matches & range;
+#endif
+#else
+  uint64_t matches = 0;
+  for (int i=lo; i<=hi; i++) {
+    matches |= (uint64_t)(rems[i] == rem) << i;
+  }
+  return matches & range;
+#endif
+}
+
+/**
+ * @return a mask of the slots in [lo, hi] of a block with per-slot selectors
+ * (as in the uTAF) whose remainders match a query: slot i matches if
+ * rems[i] == qrems[sels[i] % n_rems], where `qrems` holds the query's
+ * remainders for selectors 0 through n_rems-1, and 1 <= n_rems <= 16.
+ *
+ * Works on the 16-slot chunks overlapping [lo, hi].  With 8-bit remainders
+ * and SSSE3 (when built with -mssse3 or later), reduces each chunk's
+ * selectors mod n_rems with a multiply, looks up the query's remainders with
+ * one pshufb, and compares them with the chunk's remainders in one go.  With
+ * only SSE2, compares the slots with selector 0 at once and the adapted ones
+ * one at a time.
+ */
+static inline uint64_t block_match_sel_rems(const rem_t rems[64], const uint8_t sels[64],
+                                            const rem_t qrems[16], int n_rems, int lo, int hi) {
+  uint64_t range = ((2ULL << hi) - 1) & ~ONES(lo);
+  uint64_t matches = 0;
+#if defined(__x86_64__) && REM_SIZE <= 8 && defined(__SSSE3__)
+  __m128i table = _mm_loadu_si128((const __m128i *)qrems);
+  __m128i zero = _mm_setzero_si128();
+  // x / n_rems == (x * magic) >> 16 for all 8-bit x
+  __m128i magic = _mm_set1_epi16(n_rems > 1 ? (short)(65536 / n_rems + 1) : 0);
+  __m128i n = _mm_set1_epi16((short)n_rems);
+  __m128i keep = n_rems > 1 ? _mm_set1_epi8(-1) : zero;
+  for (int c = lo/16; c <= hi/16; c++) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(sels + 16*c));
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    s_lo = _mm_sub_epi16(s_lo, _mm_mullo_epi16(_mm_mulhi_epu16(s_lo, magic), n));
+    s_hi = _mm_sub_epi16(s_hi, _mm_mullo_epi16(_mm_mulhi_epu16(s_hi, magic), n));
+    __m128i idx = _mm_and_si128(_mm_packus_epi16(s_lo, s_hi), keep);
+    __m128i expected = _mm_shuffle_epi8(table, idx);
+    __m128i r = _mm_loadu_si128((const __m128i *)(rems + 16*c));
+    matches |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(r, expected)) << (16*c);
+  }
+#elif defined(__x86_64__) && REM_SIZE <= 8
+  __m128i zero = _mm_setzero_si128();
+  __m128i key = _mm_set1_epi8((char)qrems[0]);
+  for (int c = lo/16; c <= hi/16; c++) {
+    __m128i unadapted = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(sels + 16*c)), zero);
+    __m128i r = _mm_loadu_si128((const __m128i *)(rems + 16*c));
+    uint64_t chunk = (uint16_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(r, key), unadapted));
+    uint64_t adapted = (uint16_t)~_mm_movemask_epi8(unadapted);
+    for (; adapted; adapted &= adapted - 1) {
+      int i = 16*c + __builtin_ctzll(adapted);
+      chunk |= (uint64_t)(rems[i] == qrems[sels[i] % n_rems]) << (i - 16*c);
+    }
+    matches |= chunk << (16*c);
+  }
+#else
+  for (int i=lo; i<=hi; i++) {
+    matches |= (uint64_t)(rems[i] == qrems[sels[i] % n_rems]) << i;
+  }
+#endif
+  return matches & range;
+}
+
+/**
+ * @return the first slot of the run ending at slot `end` of a block, given
+ * the block's runends, or 0 if the run may start in an earlier block.
+ */
+static inline int block_run_start(uint64_t runends, int end) {
+  return 64 - lzcnt(runends & ONES(end));
+}
+
+/**
+ * @return the first slot of the run for `quot` that ends at slot `end`: the
+ * slot after the previous runend, or `quot` if that comes later.
+ *
+ * Finds the previous runend with a masked leading-zero count of the runends
+ * word of `end`'s block, only reading earlier blocks' runends if there is
+ * none there and the run could start before the block.
+ */
+static inline int block_find_run_start(BlockLayout layout, size_t quot, int end) {
+  int block_i = end/64;
+  int start = block_i*64 + block_run_start(*layout_runends(layout, block_i), end%64);
+  while (start == block_i*64 && start > (int)quot) {
+    block_i--;
+    start = block_i*64 + 64 - lzcnt(*layout_runends(layout, block_i));
+  }
+  return max(start, (int)quot);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLOCK_OPS_H
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arcd.h"
+#include "codec.h"
+#include "macros.h"
+#include "taf.h"
+
+/* Arithmetic coding */
+
+const SelCodec arcd_sel_codec = {
+  "arcd", 0, encode_sel, decode_sel, decode_sel_upto,
+};
+
+const ExtCodec arcd_ext_codec = {
+  "arcd", 0, encode_ext, decode_ext,
+};
+
+/* Sparse coding */
+
+/**
+ * Each byte of the code, from the lowest, is an entry (slot << 2 | inc) that
+ * adds `inc` (1-3) to the selector of `slot`.  Entries are in slot order and
+ * are never 0, so the first zero byte ends the code.
+ */
+static int sparse_encode_sel(const int sels[64], uint64_t *code) {
+  uint64_t out = 0;
+  int n = 0;
+  for (int i=0; i<64; i++) {
+    int sel = sels[i];
+    if (sel > MAX_SELECTOR) sel %= MAX_SELECTOR;
+    while (sel > 0) {
+      if (n == SEL_CODE_BYTES) {
+        return -1;
+      }
+      int inc = min(sel, 3);
+      out |= (uint64_t)((i << 2) | inc) << (8 * n);
+      sel -= inc;
+      n++;
+    }
+  }
+  *code = out;
+  return 0;
+}
+
+static void sparse_decode_sel_upto(uint64_t code, int k, int out[64]) {
+  memset(out, 0, (k + 1) * sizeof(int));
+  for (; code != 0; code >>= 8) {
+    int slot = (int)(code & 0xff) >> 2;
+    if (slot > k) {
+      break;
+    }
+    out[slot] += (int)(code & 3);
+  }
+}
+
+static void sparse_decode_sel(uint64_t code, int out[64]) {
+  sparse_decode_sel_upto(code, 63, out);
+}
+
+const SelCodec sparse_sel_codec = {
+  "sparse", 1, sparse_encode_sel, sparse_decode_sel, sparse_decode_sel_upto,
+};
+
+/* Lookup */
+
+static const SelCodec *sel_codecs[] = {&arcd_sel_codec, &sparse_sel_codec};
+static const ExtCodec *ext_codecs[] = {&arcd_ext_codec};
+
+const SelCodec *sel_codec_by_id(int id) {
+  for (size_t i=0; i < sizeof(sel_codecs)/sizeof(sel_codecs[0]); i++) {
+    if (sel_codecs[i]->id == id) {
+      return sel_codecs[i];
+    }
+  }
+  return NULL;
+}
+
+const ExtCodec *ext_codec_by_id(int id) {
+  for (size_t i=0; i < sizeof(ext_codecs)/sizeof(ext_codecs[0]); i++) {
+    if (ext_codecs[i]->id == id) {
+      return ext_codecs[i];
+    }
+  }
+  return NULL;
+}
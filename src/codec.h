@@ -0,0 +1,67 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "ext.h"
+
+/**
+ * A coder for the 64 selectors of a TAF block, packed into SEL_CODE_LEN bits.
+ *
+ * Every codec encodes all-zero selectors as 0, so zeroed blocks need no
+ * encoding, and decoders can return early on code 0.
+ */
+typedef struct sel_codec_t {
+  const char *name;
+  int id;                       /* identifies the codec in saved filters */
+  /** Encodes `sels`, returning 0, or -1 if they don't fit in a code. */
+  int (*encode)(const int sels[64], uint64_t *code);
+  /** Decodes all 64 selectors. */
+  void (*decode)(uint64_t code, int out[64]);
+  /** Decodes only selectors 0 through k into out[0..k]. */
+  void (*decode_upto)(uint64_t code, int k, int out[64]);
+} SelCodec;
+
+/**
+ * A coder for the 64 extensions of an exAF block, packed into EXT_CODE_LEN
+ * bits.  Empty extensions encode as 0.
+ */
+typedef struct ext_codec_t {
+  const char *name;
+  int id;                       /* identifies the codec in saved filters */
+  /** Encodes `exts`, returning 0, or -1 if they don't fit in a code. */
+  int (*encode)(const Ext exts[64], uint64_t *code);
+  /** Decodes all 64 extensions. */
+  void (*decode)(uint64_t code, Ext exts[64]);
+} ExtCodec;
+
+/** Arithmetic coding (arcd.h) with probabilities fit to how selectors grow:
+    the default, and the codec that fits the most adapted selectors per block */
+extern const SelCodec arcd_sel_codec;
+
+/** One byte per unit of each nonzero selector: its slot and an increment of
+    1-3.  Holds at most SEL_CODE_BYTES increments per block, but decodes with
+    a handful of byte reads and no compare chains. */
+extern const SelCodec sparse_sel_codec;
+
+/** Arithmetic coding (arcd.h): the default extension codec */
+extern const ExtCodec arcd_ext_codec;
+
+/**
+ * @return the selector codec with `id`, or NULL if there is none.
+ */
+const SelCodec *sel_codec_by_id(int id);
+
+/**
+ * @return the extension codec with `id`, or NULL if there is none.
+ */
+const ExtCodec *ext_codec_by_id(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CODEC_H
@@ -0,0 +1,254 @@
+/*
+ * Benchmarks for the selector and extension codecs in codec.h.
+ *
+ * Blocks are generated by adapting random slots of an empty block, as the
+ * filters do: a selector adaptation bumps a slot's selector (mod
+ * MAX_SELECTOR), and an extension adaptation gives a slot an extension of
+ * length k with probability 2^-k.  For each codec and number of adaptations
+ * per block, the benchmark reports:
+ * - fit_rate:       the fraction of blocks the codec can encode
+ * - encode_ns, decode_ns: time to encode/decode one block that fits
+ * - decode_upto_ns: time to decode the selectors up to a random slot, as
+ *                   lookups do (selector codecs only)
+ * and, per codec, `capacity`, the mean number of adaptations a block takes
+ * before its code overflows, and `bits_per_adapt`, the code bits spent per
+ * adaptation at capacity.
+ *
+ * Results are written to stdout as CSV, one row per (codec, adaptations).
+ *
+ * Usage: ./codec_bench [nblocks] [seed]
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "codec.h"
+#include "taf.h"
+
+#define CODEC_BENCH_DEFAULT_NBLOCKS (1 << 16)
+#define CODEC_BENCH_DEFAULT_SEED 32776517
+#define CODEC_BENCH_REPS 8
+
+static const SelCodec *sel_codecs[] = {&arcd_sel_codec, &sparse_sel_codec};
+#define N_SEL_CODECS (sizeof(sel_codecs)/sizeof(sel_codecs[0]))
+
+static const ExtCodec *ext_codecs[] = {&arcd_ext_codec};
+#define N_EXT_CODECS (sizeof(ext_codecs)/sizeof(ext_codecs[0]))
+
+static const int adapts[] = {0, 1, 2, 4, 8, 16};
+#define N_ADAPTS (sizeof(adapts)/sizeof(adapts[0]))
+
+/* Helpers */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/**
+ * splitmix64: a fast, deterministic source of random words.
+ */
+static uint64_t next_word(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void adapt_sel(int sels[64], uint64_t *rng) {
+  int slot = (int)(next_word(rng) % 64);
+  sels[slot] = (sels[slot] + 1) % MAX_SELECTOR;
+}
+
+static void adapt_ext(Ext exts[64], uint64_t *rng) {
+  uint64_t word = next_word(rng);
+  int slot = (int)(word % 64);
+  // Length k with probability 2^-k
+  int len = 1 + __builtin_ctzll((word >> 6) | (1ULL << 32));
+  exts[slot].len = len;
+  exts[slot].bits = next_word(rng) & ((1ULL << len) - 1);
+}
+
+static void print_header(void) {
+  printf("codec,kind,adapts,blocks,fit_rate,encode_ns,decode_ns,decode_upto_ns,"
+         "capacity,bits_per_adapt\n");
+}
+
+/* Selector codecs */
+
+/**
+ * Mean adaptations an empty block takes before `codec` can't encode it.
+ */
+static double sel_capacity(const SelCodec *codec, size_t nblocks, uint64_t seed) {
+  uint64_t rng = seed;
+  uint64_t code;
+  size_t total = 0;
+  for (size_t b=0; b<nblocks; b++) {
+    int sels[64] = {0};
+    while (1) {
+      adapt_sel(sels, &rng);
+      if (codec->encode(sels, &code) == -1) {
+        break;
+      }
+      total++;
+    }
+  }
+  return (double)total / (double)nblocks;
+}
+
+static void bench_sel_codec(const SelCodec *codec, size_t nblocks, uint64_t seed) {
+  double capacity = sel_capacity(codec, nblocks / 16, seed);
+  int (*sels)[64] = malloc(nblocks * sizeof(*sels));
+  int (*out)[64] = malloc(nblocks * sizeof(*out));
+  uint64_t *codes = malloc(nblocks * sizeof(uint64_t));
+  int *ks = malloc(nblocks * sizeof(int));
+  for (size_t a=0; a<N_ADAPTS; a++) {
+    // Same blocks for every codec
+    uint64_t rng = seed + a;
+    size_t nfit = 0;
+    for (size_t b=0; b<nblocks; b++) {
+      memset(sels[nfit], 0, sizeof(sels[nfit]));
+      for (int i=0; i<adapts[a]; i++) {
+        adapt_sel(sels[nfit], &rng);
+      }
+      ks[nfit] = (int)(next_word(&rng) % 64);
+      if (codec->encode(sels[nfit], &codes[nfit]) == 0) {
+        nfit++;
+      }
+    }
+    if (nfit == 0) {
+      printf("%s,sel,%d,%zu,0,,,,%.2f,%.2f\n", codec->name, adapts[a], nblocks,
+             capacity, SEL_CODE_LEN / capacity);
+      continue;
+    }
+    double start = now();
+    for (int r=0; r<CODEC_BENCH_REPS; r++) {
+      for (size_t b=0; b<nfit; b++) {
+        codec->encode(sels[b], &codes[b]);
+      }
+    }
+    double encode_secs = now() - start;
+    start = now();
+    for (int r=0; r<CODEC_BENCH_REPS; r++) {
+      for (size_t b=0; b<nfit; b++) {
+        codec->decode(codes[b], out[b]);
+      }
+    }
+    double decode_secs = now() - start;
+    for (size_t b=0; b<nfit; b++) {
+      if (memcmp(sels[b], out[b], sizeof(out[b])) != 0) {
+        fprintf(stderr, "%s failed to decode block %zu\n", codec->name, b);
+        exit(1);
+      }
+    }
+    start = now();
+    long sink = 0;
+    for (int r=0; r<CODEC_BENCH_REPS; r++) {
+      for (size_t b=0; b<nfit; b++) {
+        codec->decode_upto(codes[b], ks[b], out[b]);
+        sink += out[b][ks[b]];
+      }
+    }
+    double upto_secs = now() - start;
+    if (sink < 0) {
+      printf("%ld\n", sink);
+    }
+    double ops = (double)nfit * CODEC_BENCH_REPS;
+    printf("%s,sel,%d,%zu,%.4f,%.2f,%.2f,%.2f,%.2f,%.2f\n", codec->name, adapts[a], nblocks,
+           (double)nfit / (double)nblocks, encode_secs * 1e9 / ops, decode_secs * 1e9 / ops,
+           upto_secs * 1e9 / ops, capacity, SEL_CODE_LEN / capacity);
+    fflush(stdout);
+  }
+  free(sels);
+  free(out);
+  free(codes);
+  free(ks);
+}
+
+/* Extension codecs */
+
+static double ext_capacity(const ExtCodec *codec, size_t nblocks, uint64_t seed) {
+  uint64_t rng = seed;
+  uint64_t code;
+  size_t total = 0;
+  for (size_t b=0; b<nblocks; b++) {
+    Ext exts[64];
+    memset(exts, 0, sizeof(exts));
+    while (1) {
+      adapt_ext(exts, &rng);
+      if (codec->encode(exts, &code) == -1) {
+        break;
+      }
+      total++;
+    }
+  }
+  return (double)total / (double)nblocks;
+}
+
+static void bench_ext_codec(const ExtCodec *codec, size_t nblocks, uint64_t seed) {
+  double capacity = ext_capacity(codec, nblocks / 16, seed);
+  Ext (*exts)[64] = malloc(nblocks * sizeof(*exts));
+  Ext (*out)[64] = malloc(nblocks * sizeof(*out));
+  uint64_t *codes = malloc(nblocks * sizeof(uint64_t));
+  for (size_t a=0; a<N_ADAPTS; a++) {
+    uint64_t rng = seed + a;
+    size_t nfit = 0;
+    for (size_t b=0; b<nblocks; b++) {
+      memset(exts[nfit], 0, sizeof(exts[nfit]));
+      for (int i=0; i<adapts[a]; i++) {
+        adapt_ext(exts[nfit], &rng);
+      }
+      if (codec->encode(exts[nfit], &codes[nfit]) == 0) {
+        nfit++;
+      }
+    }
+    if (nfit == 0) {
+      printf("%s,ext,%d,%zu,0,,,,%.2f,%.2f\n", codec->name, adapts[a], nblocks,
+             capacity, EXT_CODE_LEN / capacity);
+      continue;
+    }
+    double start = now();
+    for (int r=0; r<CODEC_BENCH_REPS; r++) {
+      for (size_t b=0; b<nfit; b++) {
+        codec->encode(exts[b], &codes[b]);
+      }
+    }
+    double encode_secs = now() - start;
+    start = now();
+    for (int r=0; r<CODEC_BENCH_REPS; r++) {
+      for (size_t b=0; b<nfit; b++) {
+        codec->decode(codes[b], out[b]);
+      }
+    }
+    double decode_secs = now() - start;
+    double ops = (double)nfit * CODEC_BENCH_REPS;
+    printf("%s,ext,%d,%zu,%.4f,%.2f,%.2f,,%.2f,%.2f\n", codec->name, adapts[a], nblocks,
+           (double)nfit / (double)nblocks, encode_secs * 1e9 / ops, decode_secs * 1e9 / ops,
+           capacity, EXT_CODE_LEN / capacity);
+    fflush(stdout);
+  }
+  free(exts);
+  free(out);
+  free(codes);
+}
+
+int main(int argc, char **argv) {
+  long nblocks = argc > 1 ? atol(argv[1]) : CODEC_BENCH_DEFAULT_NBLOCKS;
+  uint64_t seed = argc > 2 ? (uint64_t)atol(argv[2]) : CODEC_BENCH_DEFAULT_SEED;
+  if (nblocks < 16) {
+    fprintf(stderr, "usage: %s [nblocks >= 16] [seed]\n", argv[0]);
+    return 1;
+  }
+  print_header();
+  for (size_t c=0; c<N_SEL_CODECS; c++) {
+    bench_sel_codec(sel_codecs[c], nblocks, seed);
+  }
+  for (size_t c=0; c<N_EXT_CODECS; c++) {
+    bench_ext_codec(ext_codecs[c], nblocks, seed);
+  }
+  return 0;
+}
@@ -9,4 +9,29 @@
  * Must be power of 2 since mod is taken using & */
 #define REM_SIZE 8
 
+/** Number of keys whose memory accesses are overlapped in batched lookups */
+#define LOOKUP_BATCH 32
+
+/** Number of keys per task in parallel lookups: a multiple of 64, so that
+ * tasks write separate words of the result bitmap */
+#define LOOKUP_PARALLEL_CHUNK 4096
+
+/** Number of blocks guarded by each lock in concurrent filters (4096 slots) */
+#define LOCK_REGION_BLOCKS 64
+
+/** Optimistic reads tried by concurrent lookups before they take locks */
+#define OPTIMISTIC_READ_RETRIES 8
+
+/** Most regions a concurrent lookup reads optimistically before taking locks */
+#define OPTIMISTIC_READ_REGIONS 4
+
+/** Set to 1 to have TAFs and uTAFs keep only keys in their remotes (8 bytes
+ * per slot instead of 16), rehashing them when adapting */
+#ifndef REMOTE_KEYS_ONLY
+#define REMOTE_KEYS_ONLY 0
+#endif
+
+/** Most false positives a TAF queues while deferring adaptation */
+#define ADAPT_QUEUE_MAX (1 << 16)
+
 #endif //EXAF_CONSTANTS_H
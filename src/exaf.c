@@ -11,6 +11,8 @@
 #include "arcd.h"
 #include "exaf.h"
 #include "bit_util.h"
+#include "block_ops.h"
+#include "serial.h"
 #include "set.h"
 
 /**
@@ -82,7 +84,7 @@ static int shortest_diff_ext(ExAF* filter, uint64_t member_hash, uint64_t non_me
   }
 }
 
-static int ext_matches_hash(ExAF* filter, Ext* ext, uint64_t hash) {
+static int ext_matches_hash(const ExAF* filter, const Ext* ext, uint64_t hash) {
   if (ext->len == 0) {
     return 1;
   } else {
@@ -204,16 +206,18 @@ static int first_unused(const ExAF* filter, size_t x) {
   }
 }
 
+/**
+ * Returns the first slot of the run for `quot` ending at `loc`.
+ */
+static int run_start(const ExAF* filter, size_t quot, int loc) {
+  return block_find_run_start(block_layout(filter), quot, loc);
+}
+
 /**
  * Shift the remainders and runends in [a, b] forward by 1 into [a+1, b+1]
  */
 static void shift_rems_and_runends(ExAF* filter, int a, int b) {
-  if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    remainder(filter, i+1) = remainder(filter, i);
-    set_runend_to(filter, i+1, get_runend(filter, i));
-  }
-  set_runend_to(filter, a, 0);
+  block_shift_slots(block_layout(filter), a, b);
 }
 
 /**
@@ -221,10 +225,7 @@ static void shift_rems_and_runends(ExAF* filter, int a, int b) {
  */
 static void shift_remote_elts(ExAF* filter, int a, int b) {
   if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    filter->remote[i+1] = filter->remote[i];
-  }
-  filter->remote[a] = 0;
+  remote_shift(&filter->remote, a, b);
 }
 
 /**
@@ -236,7 +237,7 @@ static void shift_block_exts(ExAF *filter, int block_i, Ext exts[64], const Ext
     exts[i] = exts[i-1];
   }
   exts[0] = prev_exts[63];
-  if (encode_ext(exts, &code) == -1) {
+  if (filter->codec->encode(exts, &code) == -1) {
     code = 0;
   }
   set_ext_code(filter, block_i, code);
@@ -257,13 +258,13 @@ static void shift_exts(ExAF* filter, int a, int b) {
   if (a/64 == (b+1)/64) {
     // a and b+1 in the same block
     Ext exts[64];
-    decode_ext(get_ext_code(filter, a/64), exts);
+    filter->codec->decode(get_ext_code(filter, a/64), exts);
     for (int i = (b+1)%64; i > a%64; i--) {
       exts[i] = exts[i-1];
     }
     exts[a%64].bits = 0;
     exts[a%64].len = 0;
-    if (encode_ext(exts, &code) == -1) {
+    if (filter->codec->encode(exts, &code) == -1) {
       code = 0;
     }
     set_ext_code(filter, a/64, code);
@@ -273,13 +274,13 @@ static void shift_exts(ExAF* filter, int a, int b) {
     Ext* prev_exts = malloc(64 * sizeof(Ext));
     // (1) last block
     int block_i = (b+1)/64;
-    decode_ext(get_ext_code(filter, block_i), exts);
-    decode_ext(get_ext_code(filter, block_i - 1), prev_exts);
+    filter->codec->decode(get_ext_code(filter, block_i), exts);
+    filter->codec->decode(get_ext_code(filter, block_i - 1), prev_exts);
     shift_block_exts(filter, block_i, exts, prev_exts, (b + 1) % 64);
     swap_ptrs(&exts, &prev_exts);
     // (2) middle blocks
     for (block_i--; block_i > a/64; block_i--) {
-      decode_ext(get_ext_code(filter, block_i-1), prev_exts);
+      filter->codec->decode(get_ext_code(filter, block_i-1), prev_exts);
       shift_block_exts(filter, block_i, exts, prev_exts, 63);
       swap_ptrs(&exts, &prev_exts);
     }
@@ -289,7 +290,7 @@ static void shift_exts(ExAF* filter, int a, int b) {
     }
     exts[a%64].bits = 0;
     exts[a%64].len = 0;
-    if (encode_ext(exts, &code) == -1) {
+    if (filter->codec->encode(exts, &code) == -1) {
       code = 0;
     }
     set_ext_code(filter, a/64, code);
@@ -359,24 +360,55 @@ static void inc_offsets_for_new_run(ExAF* filter, size_t quot, size_t loc) {
   }
 }
 
-static void add_block(ExAF *filter) {
-  // Add block to new_blocks
-  ExAFBlock *new_blocks = realloc(filter->blocks, (filter->nblocks + 1) * sizeof(ExAFBlock));
-  if (new_blocks == NULL) {
-    printf("add_block failed to realloc new blocks\n");
+/**
+ * Move blocks loaded by exaf_load_mmap out of the file into an array with
+ * room for `nblocks_alloc` blocks, so that they can be grown.
+ */
+static void copy_mapped_blocks(ExAF *filter, size_t nblocks_alloc) {
+  ExAFBlock *blocks = malloc(nblocks_alloc * sizeof(ExAFBlock));
+  if (blocks == NULL) {
+    printf("copy_mapped_blocks failed to allocate %lu blocks\n", nblocks_alloc);
     exit(1);
   }
-  filter->blocks = new_blocks;
-  memset(filter->blocks + filter->nblocks, 0, sizeof(ExAFBlock));
+  memcpy(blocks, filter->blocks, filter->nblocks * sizeof(ExAFBlock));
+  filter->blocks = blocks;
+  filter->nblocks_alloc = nblocks_alloc;
+  filter->blocks_mapped = 0;
+}
 
-  // Reallocate remote rep
-  elt_t *new_remote = realloc(filter->remote,(filter->nslots + 64) * sizeof(elt_t));
-  if (new_remote == NULL) {
-    printf("add_block failed to realloc new remote rep\n");
-    exit(1);
+/**
+ * Free the filter's blocks, unless they're in a mapped file.
+ */
+static void free_blocks(ExAF *filter) {
+  if (filter->blocks_mapped) {
+    filter->blocks_mapped = 0;
+  } else {
+    free(filter->blocks);
+  }
+}
+
+/**
+ * Append an empty block (and its remote slots) to the end of the filter.
+ *
+ * Blocks are allocated in geometrically growing chunks, so that appending
+ * costs amortized O(1) instead of copying the whole filter each time.
+ */
+static void add_block(ExAF *filter) {
+  if (filter->blocks_mapped) {
+    copy_mapped_blocks(filter, grown_nblocks(filter->nblocks));
+  } else if (filter->nblocks == filter->nblocks_alloc) {
+    size_t nblocks_alloc = grown_nblocks(filter->nblocks_alloc);
+    // Reallocate blocks
+    ExAFBlock *new_blocks = realloc(filter->blocks, nblocks_alloc * sizeof(ExAFBlock));
+    if (new_blocks == NULL) {
+      printf("add_block failed to realloc new blocks\n");
+      exit(1);
+    }
+    filter->blocks = new_blocks;
+    filter->nblocks_alloc = nblocks_alloc;
   }
-  filter->remote = new_remote;
-  memset(filter->remote + filter->nslots, 0, 64 * sizeof(elt_t));
+  memset(filter->blocks + filter->nblocks, 0, sizeof(ExAFBlock));
+  remote_resize(&filter->remote, filter->nslots + 64);
 
   // Update counters
   filter->nblocks += 1;
@@ -395,14 +427,14 @@ static void adapt_loc(ExAF *filter, size_t loc, uint64_t in_hash, uint64_t out_h
   }
   // Write encoding to the appropriate block
   Ext exts[64];
-  decode_ext(get_ext_code(filter, loc/64), exts);
+  filter->codec->decode(get_ext_code(filter, loc/64), exts);
   exts[loc%64] = new_ext;
   uint64_t code;
-  if (encode_ext(exts, &code) == -1) {
+  if (filter->codec->encode(exts, &code) == -1) {
     // Encoding failed: rebuild
     memset(exts, 0, 64 * sizeof(Ext)); // clear exts
     exts[loc % 64] = new_ext;
-    if (encode_ext(exts, &code) == -1) {
+    if (filter->codec->encode(exts, &code) == -1) {
       fprintf(stderr, "Encoding failed after rebuild!\n");
       exts[loc % 64].len = 0;
       exts[loc % 64].bits = 0;
@@ -420,23 +452,24 @@ static void adapt_loc(ExAF *filter, size_t loc, uint64_t in_hash, uint64_t out_h
  */
 static void adapt(ExAF *filter, elt_t query, int loc, size_t quot, rem_t rem, uint64_t hash, Ext exts[64]) {
   assert(quot <= loc && loc < filter->nslots);
+  int start = run_start(filter, quot, loc);
   // Make sure the query elt isn't mapped to an earlier index in the sequence
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
-    if (filter->remote[i] == query) {
+  for (int i=loc; i>=start; i--) {
+    if (remote_fetch(&filter->remote, i) == query) {
       return;
     }
   }
   // Adapt on all collisions in the run
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
+  for (int i=loc; i>=start; i--) {
     // Re-decode if at a new block
     if (i != loc && i % 64 == 63) {
-      decode_ext(get_ext_code(filter, i/64), exts);
+      filter->codec->decode(get_ext_code(filter, i/64), exts);
     }
     // Check collision
     Ext ext = exts[i % 64];
     if (remainder(filter, i) == rem && ext_matches_hash(filter, &ext, hash)) {
       // Adapt on hash collision
-      uint64_t in_hash = exaf_hash(filter, filter->remote[i]);
+      uint64_t in_hash = exaf_hash(filter, remote_fetch(&filter->remote, i));
       adapt_loc(filter, i, in_hash, hash);
       // TODO: reuse `exts`
     }
@@ -446,6 +479,15 @@ static void adapt(ExAF *filter, elt_t query, int loc, size_t quot, rem_t rem, ui
 /* ExAF */
 
 void exaf_init(ExAF *filter, size_t n, int seed) {
+  exaf_init_remote(filter, n, seed, new_array_remote(0, 0));
+}
+
+/**
+ * Initialize a filter that keeps its elements in `remote`.  The ExAF
+ * rehashes elements instead of calling `fetch_hash`, so `remote` only needs
+ * to keep keys.  The filter takes ownership of `remote`.
+ */
+void exaf_init_remote(ExAF *filter, size_t n, int seed, Remote remote) {
   filter->seed = seed;
   filter->nelts = 0;
   filter->nblocks = max(1, nearest_pow_of_2(n)/64);
@@ -454,21 +496,137 @@ void exaf_init(ExAF *filter, size_t n, int seed) {
   filter->r = REM_SIZE;
   filter->p = filter->q + filter->r;
   filter->blocks = calloc(filter->nblocks, sizeof(ExAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(elt_t));
+  filter->nblocks_alloc = filter->nblocks;
+  filter->blocks_mapped = 0;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  filter->codec = &arcd_ext_codec;
+  filter->remote = remote;
+  remote_resize(&filter->remote, filter->nslots);
 }
 
 void exaf_destroy(ExAF* filter) {
-  free(filter->blocks);
-  free(filter->remote);
+  free_blocks(filter);
+  remote_destroy(&filter->remote);
+  if (filter->mapping != NULL) {
+    serial_unmap(filter->mapping, filter->mapping_size);
+  }
   free(filter);
 }
 
 void exaf_clear(ExAF* filter) {
   filter->nelts = 0;
-  free(filter->blocks);
-  free(filter->remote);
+  free_blocks(filter);
   filter->blocks = calloc(filter->nblocks, sizeof(ExAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(elt_t));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+}
+
+/**
+ * Re-encode the filter's extensions with `codec`, and use it from now on.
+ * @return 0 on success, or -1 if some block's extensions don't fit in
+ * `codec`'s codes, in which case the filter is unchanged.
+ */
+int exaf_set_codec(ExAF *filter, const ExtCodec *codec) {
+  uint64_t *codes = malloc(filter->nblocks * sizeof(uint64_t));
+  if (codes == NULL) {
+    printf("exaf_set_codec failed to allocate codes for %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  Ext exts[64];
+  for (size_t i=0; i < filter->nblocks; i++) {
+    filter->codec->decode(get_ext_code(filter, i), exts);
+    if (codec->encode(exts, &codes[i]) == -1) {
+      free(codes);
+      return -1;
+    }
+  }
+  for (size_t i=0; i < filter->nblocks; i++) {
+    set_ext_code(filter, i, codes[i]);
+  }
+  filter->codec = codec;
+  free(codes);
+  return 0;
+}
+
+/**
+ * Save the filter to `path`: its blocks, then its remote's elements and
+ * hashes (only elements if the remote has no fetch_hash).
+ * @return 0 on success, -1 if the file couldn't be written or the remote
+ * can't fetch its elements.
+ */
+int exaf_save(const ExAF *filter, const char *path) {
+  if (filter->remote.ops->fetch == NULL) {
+    return -1;
+  }
+  int with_hashes = filter->remote.ops->fetch_hash != NULL;
+  SerialHeader header;
+  memset(&header, 0, sizeof(header));
+  header.kind = SERIAL_EXAF;
+  header.block_size = sizeof(ExAFBlock);
+  header.p = filter->p;
+  header.q = filter->q;
+  header.r = filter->r;
+  header.nslots = filter->nslots;
+  header.nblocks = filter->nblocks;
+  header.nelts = filter->nelts;
+  header.seed = filter->seed;
+  header.codec = filter->codec->id;
+  header.remote_slot_size = with_hashes ? sizeof(Remote_elt) : sizeof(elt_t);
+  FILE *file = serial_create(path, &header);
+  if (file == NULL) {
+    return -1;
+  }
+  fwrite(filter->blocks, sizeof(ExAFBlock), filter->nblocks, file);
+  for (size_t i=0; i < filter->nslots; i++) {
+    Remote_elt slot;
+    slot.elt = remote_fetch(&filter->remote, i);
+    slot.hash = with_hashes ? remote_fetch_hash(&filter->remote, i) : 0;
+    fwrite(&slot, header.remote_slot_size, 1, file);
+  }
+  return serial_close(file);
+}
+
+/**
+ * Initialize a filter from one saved by exaf_save, using the file itself as
+ * the filter's blocks and remote slots instead of reading them in.  The file
+ * is mapped copy-on-write: pages are read as the filter touches them, and
+ * changes to the filter never reach the file.  The blocks are copied out of
+ * the file when the filter first grows.  The filter keeps its remote in an
+ * array.
+ * @return 0 on success, -1 if the file couldn't be mapped or isn't an ExAF
+ * saved by this build.
+ */
+int exaf_load_mmap(ExAF *filter, const char *path) {
+  SerialMap map;
+  if (serial_map(path, SERIAL_EXAF, sizeof(ExAFBlock), &map) != 0) {
+    return -1;
+  }
+  const SerialHeader *header = map.header;
+  const ExtCodec *codec = ext_codec_by_id((int)header->codec);
+  if (header->r != REM_SIZE || codec == NULL ||
+      (header->remote_slot_size != sizeof(Remote_elt) &&
+       header->remote_slot_size != sizeof(elt_t))) {
+    serial_unmap(map.base, map.size);
+    return -1;
+  }
+  filter->p = header->p;
+  filter->q = header->q;
+  filter->r = header->r;
+  filter->nslots = header->nslots;
+  filter->nblocks = header->nblocks;
+  filter->nblocks_alloc = header->nblocks;
+  filter->nelts = header->nelts;
+  filter->seed = (int)header->seed;
+  filter->codec = codec;
+  filter->blocks = map.blocks;
+  filter->blocks_mapped = 1;
+  filter->mapping = map.base;
+  filter->mapping_size = map.size;
+  filter->remote = new_array_remote_over(map.remote, filter->nslots,
+                                         header->remote_slot_size == sizeof(Remote_elt) ?
+                                         ARRAY_REMOTE_HASHES : 0);
+  return 0;
 }
 
 static void raw_insert(ExAF* filter, elt_t elt, uint64_t hash) {
@@ -483,7 +641,7 @@ static void raw_insert(ExAF* filter, elt_t elt, uint64_t hash) {
       set_occupied(filter, quot);
       set_runend(filter, quot);
       remainder(filter, quot) = rem;
-      filter->remote[quot] = elt;
+      remote_store(&filter->remote, quot, elt, hash);
       break;
     }
     case RANK_SELECT_OVERFLOW: {
@@ -518,42 +676,71 @@ static void raw_insert(ExAF* filter, elt_t elt, uint64_t hash) {
       }
       set_runend(filter, r+1);
       remainder(filter, r+1) = rem;
-      filter->remote[r+1] = elt;
+      remote_store(&filter->remote, r+1, elt, hash);
     }
   }
 }
 
+/**
+ * Returns the location of the last fingerprint matching `hash` in the run for
+ * `quot` ending at `loc`, or -1 if there is none.  `loc` is the result of
+ * `rank_select(filter, quot)`.
+ *
+ * On a match, `decoded` holds the extensions of the match's block.
+ */
+static int match_in_run(const ExAF* filter, uint64_t hash, size_t quot, int loc,
+                        Ext decoded[64]) {
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return -1;
+  }
+  rem_t rem = calc_rem(filter, hash);
+  // Cache decoded extensions
+  int decoded_i = -1;
+  // Find the run's start only if its runend doesn't match, as most runs are
+  // short
+  int start = -1;
+  do {
+    if (remainder(filter, loc) == rem) {
+      // Refresh cached code
+      if (decoded_i != loc/64) {
+        decoded_i = loc/64;
+        uint64_t code = get_ext_code(filter, loc/64);
+        filter->codec->decode(code, decoded);
+      }
+      // Check if extensions match
+      if (ext_matches_hash(filter, &decoded[loc%64], hash)) {
+        return loc;
+      }
+    }
+    if (start < 0) {
+      start = run_start(filter, quot, loc);
+    }
+  } while (--loc >= start);
+  return -1;
+}
+
+/**
+ * Returns 1 if the run for `quot` ending at `loc` contains a fingerprint
+ * matching `hash`, adapting if the match is a false positive.
+ * `loc` is the result of `rank_select(filter, quot)`.
+ */
+static int probe_run(ExAF* filter, elt_t elt, uint64_t hash, size_t quot, int loc) {
+  Ext decoded[64];
+  int match = match_in_run(filter, hash, quot, loc, decoded);
+  if (match < 0) {
+    return 0;
+  }
+  if (elt != remote_fetch(&filter->remote, match)) {
+    adapt(filter, elt, match, quot, calc_rem(filter, hash), hash, decoded);
+  }
+  return 1;
+}
+
 static int raw_lookup(ExAF* filter, elt_t elt, uint64_t hash) {
   size_t quot = calc_quot(filter, hash);
-  rem_t rem = calc_rem(filter, hash);
 
   if (get_occupied(filter, quot)) {
-    int loc = rank_select(filter, quot);
-    if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
-      return 0;
-    }
-    // Cache decoded extensions
-    Ext decoded[64];
-    int decoded_i = -1;
-    do {
-      if (remainder(filter, loc) == rem) {
-        // Refresh cached code
-        if (decoded_i != loc/64) {
-          decoded_i = loc/64;
-          uint64_t code = get_ext_code(filter, loc/64);
-          decode_ext(code, decoded);
-        }
-        // Check if extensions match
-        Ext ext = decoded[loc%64];
-        if (ext_matches_hash(filter, &ext, hash)) {
-          if (elt != filter->remote[loc]) {
-            adapt(filter, elt, loc, quot, rem, hash, decoded);
-          }
-          return 1;
-        }
-      }
-      loc--;
-    } while (loc >= (int)quot && !get_runend(filter, loc));
+    return probe_run(filter, elt, hash, quot, rank_select(filter, quot));
   }
   return 0;
 }
@@ -570,11 +757,143 @@ int exaf_lookup(ExAF *filter, elt_t elt) {
   return raw_lookup(filter, elt, hash);
 }
 
+/**
+ * Return 1 if word may be in the filter, without consulting the remote
+ * representation or adapting.
+ */
+int exaf_contains(const ExAF *filter, elt_t elt) {
+  uint64_t hash = exaf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  Ext decoded[64];
+  return match_in_run(filter, hash, quot, rank_select(filter, quot), decoded) >= 0;
+}
+
+/**
+ * Adapt on `elt`, which the caller found to be a false positive.  Does
+ * nothing if `elt` is stored in its run.
+ *
+ * Returns 1 if `elt` matched a fingerprint, 0 if it was a negative.
+ */
+int exaf_report_false_positive(ExAF *filter, elt_t elt) {
+  uint64_t hash = exaf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  Ext decoded[64];
+  int match = match_in_run(filter, hash, quot, rank_select(filter, quot), decoded);
+  if (match < 0) {
+    return 0;
+  }
+  adapt(filter, elt, match, quot, calc_rem(filter, hash), hash, decoded);
+  return 1;
+}
+
+/**
+ * Look up `n` elements, writing 1 to `out[i]` if `elts[i]` is in the filter
+ * and 0 otherwise.  Adapts on false positives like `exaf_lookup`.
+ *
+ * Keys are processed in groups of `LOOKUP_BATCH`, prefetching home blocks,
+ * then runend blocks and remote elements, before probing any run.
+ */
+void exaf_lookup_batch(ExAF *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  uint64_t hashes[LOOKUP_BATCH];
+  int locs[LOOKUP_BATCH];
+  for (size_t base=0; base < n; base += LOOKUP_BATCH) {
+    size_t m = min(LOOKUP_BATCH, n - base);
+    // Hash keys and prefetch home blocks
+    for (size_t i=0; i<m; i++) {
+      hashes[i] = exaf_hash(filter, elts[base + i]);
+      prefetch(&block_containing(filter, calc_quot(filter, hashes[i])));
+    }
+    // Find runends and prefetch the blocks and remote elements there
+    for (size_t i=0; i<m; i++) {
+      size_t quot = calc_quot(filter, hashes[i]);
+      if (get_occupied(filter, quot)) {
+        locs[i] = rank_select(filter, quot);
+        if (locs[i] >= 0) {
+          prefetch(&block_containing(filter, locs[i]));
+          remote_prefetch(&filter->remote, locs[i]);
+        }
+      } else {
+        locs[i] = RANK_SELECT_EMPTY;
+      }
+    }
+    // Probe runs; adapting doesn't move runends, so `locs` stays valid
+    for (size_t i=0; i<m; i++) {
+      out[base + i] = probe_run(filter, elts[base + i], hashes[i],
+                                calc_quot(filter, hashes[i]), locs[i]);
+    }
+  }
+}
+
 void exaf_insert(ExAF *filter, elt_t elt) {
   uint64_t hash = exaf_hash(filter, elt);
   raw_insert(filter, elt, hash);
 }
 
+/**
+ * Double the number of slots in the filter by reinserting every element from
+ * the remote representation into a filter with one more quotient bit.
+ *
+ * Extensions are not carried over: their bits follow the remainder in the
+ * hash, so they would shift when the quotient grows.  The expanded filter
+ * starts out with no adaptations.
+ *
+ * Returns 0 on success, or -1 (leaving the filter unchanged) if the hash is
+ * too short to supply a remainder after growing the quotient.
+ */
+int exaf_expand(ExAF *filter) {
+  if (filter->q + 1 + filter->r > 64) {
+    return -1;
+  }
+  size_t n = filter->nelts;
+  elt_t *elts = malloc(max(n, 1) * sizeof(elt_t));
+  if (elts == NULL) {
+    printf("exaf_expand failed to allocate buffer for %lu elements\n", n);
+    exit(1);
+  }
+  // Walk runs in quotient order, collecting elements
+  size_t i = 0;
+  size_t loc = 0;
+  for (size_t quot=0; quot < ONE(filter->q); quot++) {
+    if (!get_occupied(filter, quot)) {
+      continue;
+    }
+    loc = max(loc, quot);
+    int at_runend;
+    do {
+      elts[i++] = remote_fetch(&filter->remote, loc);
+      at_runend = get_runend(filter, loc) != 0;
+      loc++;
+    } while (!at_runend);
+  }
+  assert(i == n);
+
+  free_blocks(filter);
+  filter->q += 1;
+  filter->p = filter->q + filter->r;
+  filter->nslots = ONE(filter->q);
+  filter->nblocks = filter->nslots/64;
+  filter->nelts = 0;
+  filter->blocks = calloc(filter->nblocks, sizeof(ExAFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+  remote_resize(&filter->remote, filter->nslots);
+  if (filter->blocks == NULL) {
+    printf("exaf_expand failed to allocate %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  for (i=0; i<n; i++) {
+    raw_insert(filter, elts[i], exaf_hash(filter, elts[i]));
+  }
+  free(elts);
+  return 0;
+}
+
 double exaf_load(ExAF *filter) {
   return (double)filter->nelts/filter->nslots;
 }
@@ -612,7 +931,7 @@ void print_exaf_block(ExAF* filter, size_t block_index) {
   printf("  extension code=0x%lx\n", get_ext_code(filter, block_index));
   printf("  extensions=\n");
   Ext exts [64];
-  decode_ext(get_ext_code(filter, block_index), exts);
+  filter->codec->decode(get_ext_code(filter, block_index), exts);
   for (int i=0; i<8; i++) {
     printf("   ");
     for (int j=0; j<8; j++) {
@@ -629,7 +948,7 @@ void print_exaf_block(ExAF* filter, size_t block_index) {
   for (int i=0; i<8; i++) {
     printf("   ");
     for (int j=0; j<8; j++) {
-      printf(" 0x%-*lx", 8, filter->remote[block_index * 64 + i*8 + j]);
+      printf(" 0x%-*lx", 8, remote_fetch(&filter->remote, block_index * 64 + i*8 + j));
     }
     printf("\n");
   }
@@ -646,6 +965,8 @@ void print_exaf(ExAF* filter) {
 //#define TEST_EXAF 1
 #ifdef TEST_EXAF
 
+#include <unistd.h>
+
 void print_backtrace() {
   void* callstack[128];
   int i, frames = backtrace(callstack, 128);
@@ -767,7 +1088,7 @@ void test_add_block() {
   }
   // Check remote rep
   for (int i=0; i<64; i++) {
-    assert_eq(filter->remote[i + 128], 0);
+    assert_eq(remote_fetch(&filter->remote, i + 128), 0);
   }
   exaf_destroy(filter);
   printf("passed.\n");
@@ -782,7 +1103,7 @@ void test_add_block_no_clobber() {
     set_occupied(filter, i);
     set_runend(filter, i);
     remainder(filter, i) = i%16;
-    filter->remote[i] = i;
+    remote_store(&filter->remote, i, i, 0);
   }
   add_block(filter);
   // Check that data in first 2 blocks is preserved
@@ -790,14 +1111,14 @@ void test_add_block_no_clobber() {
     assert(get_occupied(filter, i));
     assert(get_runend(filter, i));
     assert_eq(remainder(filter, i), i%16);
-    assert_eq(filter->remote[i], i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
   }
   // Check that 3rd block is empty
   for (int i=128; i<filter->nslots; i++) {
     assert(!get_occupied(filter, i));
     assert(!get_runend(filter, i));
     assert_eq(remainder(filter, i), 0);
-    assert_eq(filter->remote[i], 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
   }
   // Check filter metadata
   assert_eq(filter->nslots, 192);
@@ -919,22 +1240,22 @@ void test_shift_remote_elts() {
   printf("Testing %s...", __FUNCTION__);
   ExAF *filter = new_exaf(128);
   for (int i=0; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i], 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
   }
   for (int i=0; i<filter->nslots; i++) {
-    filter->remote[i] = i;
+    remote_store(&filter->remote, i, i, 0);
   }
   // Shift elts in [32, 64+32] to [33, 64+33]
   shift_remote_elts(filter, 32, 64+32);
   for (int i=0; i<=31; i++) {
-    assert_eq(filter->remote[i], i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
   }
-  assert_eq(filter->remote[32], 0);
+  assert_eq(remote_fetch(&filter->remote, 32), 0);
   for (int i=33; i<=64+33; i++) {
-    assert_eq(filter->remote[i], i-1);
+    assert_eq(remote_fetch(&filter->remote, i), i-1);
   }
   for (int i=64+34; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i], i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
   }
   exaf_destroy(filter);
   printf("passed.\n");
@@ -1178,6 +1499,150 @@ void test_template() {
   printf("passed.\n");
 }
 
+void test_contains_and_report() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  ExAF *filter = new_exaf(n);
+  ExAF *expected = new_exaf(n);
+  srandom(EXAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      exaf_insert(filter, elts[i]);
+      exaf_insert(expected, elts[i]);
+    }
+  }
+  // Contains finds every member without changing the filter
+  for (size_t i=0; i<nelts; i++) {
+    assert(exaf_contains(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(ExAFBlock)), 0);
+  // Reporting each positive adapts exactly as lookups do
+  size_t fps = 0;
+  for (size_t i=nelts; i<nelts + nqueries; i++) {
+    int found = exaf_contains(filter, elts[i]);
+    if (found) {
+      assert(exaf_report_false_positive(filter, elts[i]));
+      fps++;
+    } else {
+      assert(!exaf_report_false_positive(filter, elts[i]));
+    }
+    assert_eq(found, exaf_lookup(expected, elts[i]));
+  }
+  assert(fps > 0);
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(ExAFBlock)), 0);
+  // Reporting a member is harmless
+  for (size_t i=0; i<nelts; i++) {
+    assert(exaf_report_false_positive(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(ExAFBlock)), 0);
+  free(elts);
+  exaf_destroy(filter);
+  exaf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_expand() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 9/10;
+  ExAF *filter = new_exaf(n);
+  ExAF *expected = new_exaf(2*n);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  srandom(EXAF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = random();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    exaf_insert(filter, elts[i]);
+    exaf_insert(expected, elts[i]);
+  }
+  for (size_t i=nelts; i<2*nelts; i++) {
+    exaf_lookup(filter, elts[i]);
+  }
+  assert_eq(exaf_expand(filter), 0);
+  assert_eq(filter->nslots, 2*n);
+  assert_eq(filter->q, expected->q);
+  assert_eq(filter->nelts, nelts);
+  // Same result as inserting into a filter that started out twice as large
+  for (size_t i=0; i<filter->nblocks; i++) {
+    assert_eq(memcmp(&filter->blocks[i], &expected->blocks[i], sizeof(ExAFBlock)), 0);
+  }
+  for (size_t i=0; i<filter->nslots; i++) {
+    assert_eq(remote_fetch(&filter->remote, i), remote_fetch(&expected->remote, i));
+  }
+  for (size_t i=0; i<nelts; i++) {
+    assert(exaf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  exaf_destroy(filter);
+  exaf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_save_and_load_mmap() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  ExAF *filter = new_exaf(n);
+  srandom(EXAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      exaf_insert(filter, elts[i]);
+    } else {
+      exaf_lookup(filter, elts[i]);
+    }
+  }
+  char path[] = "/tmp/exaf_save_XXXXXX";
+  close(mkstemp(path));
+  assert_eq(exaf_save(filter, path), 0);
+  ExAFBlock *saved = malloc(filter->nblocks * sizeof(ExAFBlock));
+  memcpy(saved, filter->blocks, filter->nblocks * sizeof(ExAFBlock));
+
+  // The loaded filter uses the file's blocks and remote as they were saved
+  ExAF *loaded = malloc(sizeof(ExAF));
+  assert_eq(exaf_load_mmap(loaded, path), 0);
+  assert(loaded->blocks_mapped);
+  assert(loaded->codec == filter->codec);
+  assert_eq(loaded->q, filter->q);
+  assert_eq(loaded->nelts, filter->nelts);
+  assert_eq(memcmp(loaded->blocks, saved, filter->nblocks * sizeof(ExAFBlock)), 0);
+  for (size_t i=0; i<filter->nslots; i++) {
+    assert_eq(remote_fetch(&loaded->remote, i), remote_fetch(&filter->remote, i));
+  }
+
+  // Lookups and adaptations behave as in the original, and don't reach the file
+  srandom(EXAF_SEED + 1);
+  for (size_t i=0; i<nqueries; i++) {
+    elt_t elt = random();
+    assert_eq(exaf_lookup(loaded, elt), exaf_lookup(filter, elt));
+  }
+  assert_eq(memcmp(loaded->blocks, filter->blocks, filter->nblocks * sizeof(ExAFBlock)), 0);
+  ExAF *reloaded = malloc(sizeof(ExAF));
+  assert_eq(exaf_load_mmap(reloaded, path), 0);
+  assert_eq(memcmp(reloaded->blocks, saved, filter->nblocks * sizeof(ExAFBlock)), 0);
+  exaf_destroy(reloaded);
+
+  // Growing moves the blocks out of the file
+  add_block(loaded);
+  assert(!loaded->blocks_mapped);
+  for (size_t i=0; i<nelts; i++) {
+    assert(exaf_lookup(loaded, elts[i]));
+  }
+  unlink(path);
+  free(saved);
+  free(elts);
+  exaf_destroy(loaded);
+  exaf_destroy(filter);
+  printf("passed.\n");
+}
+
 int main() {
   test_calc_ext();
   test_shortest_diff_ext();
@@ -1195,5 +1660,8 @@ int main() {
   test_swap_exts();
   test_insert_and_query();
   test_insert_and_query_w_repeats();
+  test_contains_and_report();
+  test_expand();
+  test_save_and_load_mmap();
 }
 #endif // TEST_EXAF
\ No newline at end of file
@@ -12,6 +12,8 @@ extern "C" {
 #include <stdint.h>
 #include "constants.h"
 #include "remainder.h"
+#include "remote.h"
+#include "codec.h"
 #include "ext.h"
 
 typedef struct exaf_block_t {
@@ -22,25 +24,38 @@ typedef struct exaf_block_t {
   uint8_t ext_code[EXT_CODE_BYTES];
 } ExAFBlock;
 
-typedef uint64_t elt_t;
-
 typedef struct exaf_t {
   size_t p;                     /* fingerprint prefix size = log2(n/E) to get false-pos rate E */
   size_t q;                     /* length of quotient */
   size_t r;                     /* length of remainder */
   size_t nslots;                /* number of slots available (2^q) */
   size_t nblocks;               /* nslots/64 */
+  size_t nblocks_alloc;         /* blocks allocated, including room for overflow blocks */
   size_t nelts;                 /* number of elements stored  */
   int seed;                     /* seed for Murmurhash */
   ExAFBlock* blocks;           /* blocks of 64 remainders with metadata  */
-  elt_t* remote;                /* array of inserted elements (up to 64 bits) */
+  const ExtCodec *codec;        /* encodes each block's extensions into its ext_code */
+  int blocks_mapped;            /* blocks are in `mapping`, so aren't freed or realloced */
+  void *mapping;                /* file mapped by exaf_load_mmap, or NULL */
+  size_t mapping_size;
+  Remote remote;                /* inserted elements (up to 64 bits), by slot */
 } ExAF;
 
 void exaf_init(ExAF *filter, size_t n, int seed);
+void exaf_init_remote(ExAF *filter, size_t n, int seed, Remote remote);
 void exaf_destroy(ExAF* filter);
 int exaf_lookup(ExAF *filter, elt_t elt);
+int exaf_contains(const ExAF *filter, elt_t elt);
+int exaf_report_false_positive(ExAF *filter, elt_t elt);
+void exaf_lookup_batch(ExAF *filter, const elt_t *elts, size_t n, uint8_t *out);
 void exaf_insert(ExAF *filter, elt_t elt);
+int exaf_expand(ExAF *filter);
 void exaf_clear(ExAF* filter);
+int exaf_set_codec(ExAF *filter, const ExtCodec *codec);
+
+// Saving and loading (see serial.h for the format)
+int exaf_save(const ExAF *filter, const char *path);
+int exaf_load_mmap(ExAF *filter, const char *path);
 
 // Printing
 double exaf_load(ExAF *filter);
@@ -24,6 +24,12 @@ extern "C" {
 #define min(a,b) ((a) <= (b) ? (a) : (b))
 #define max(a,b) ((a) >= (b) ? (a) : (b))
 
+/** Capacity to grow a block array of size n to when it runs out of room */
+#define grown_nblocks(n) ((n) + max(1, (n) >> 3))
+
+/** Hint that the cache line holding addr will be read soon */
+#define prefetch(addr) __builtin_prefetch((addr), 0, 3)
+
 /* 
    Access metadata 
    - occupieds, runends index from *LSB*
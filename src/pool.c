@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pool.h"
+
+/**
+ * Run tasks from the current batch until none are left.
+ */
+static void run_tasks(Pool *pool) {
+  size_t task;
+  while ((task = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED)) < pool->ntasks) {
+    pool->fn(pool->arg, task);
+  }
+}
+
+static void *worker(void *p) {
+  Pool *pool = p;
+  size_t seen = 0;
+  while (1) {
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    }
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->mutex);
+      return NULL;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->nbusy == 0) {
+      pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+Pool *new_pool(int nthreads) {
+  Pool *pool = malloc(sizeof(Pool));
+  if (pool == NULL) {
+    printf("new_pool failed to allocate pool\n");
+    exit(1);
+  }
+  pool->nthreads = nthreads > 1 ? nthreads - 1 : 0;
+  pool->threads = malloc((pool->nthreads + 1) * sizeof(pthread_t));
+  if (pool->threads == NULL) {
+    printf("new_pool failed to allocate %d threads\n", pool->nthreads);
+    exit(1);
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->fn = NULL;
+  pool->arg = NULL;
+  pool->ntasks = 0;
+  pool->next_task = 0;
+  pool->generation = 0;
+  pool->nbusy = 0;
+  pool->shutdown = 0;
+  for (int i=0; i<pool->nthreads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+      printf("new_pool failed to start worker %d\n", i);
+      exit(1);
+    }
+  }
+  return pool;
+}
+
+void pool_destroy(Pool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (int i=0; i<pool->nthreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->threads);
+  free(pool);
+}
+
+void pool_run(Pool *pool, void (*fn)(void *arg, size_t task), void *arg, size_t ntasks) {
+  if (pool->nthreads == 0 || ntasks <= 1) {
+    for (size_t i=0; i<ntasks; i++) {
+      fn(arg, i);
+    }
+    return;
+  }
+  pthread_mutex_lock(&pool->mutex);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->ntasks = ntasks;
+  pool->next_task = 0;
+  pool->nbusy = pool->nthreads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  // The caller works on the batch too
+  run_tasks(pool);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->nbusy > 0) {
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * A fixed set of worker threads that run batches of independent tasks.
+ *
+ * `pool_run` hands out task indices to the workers and the calling thread
+ * until all have run, then returns.  A pool runs one batch at a time.
+ */
+typedef struct pool_t {
+  int nthreads;                 /* worker threads, not counting the caller */
+  pthread_t *threads;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;     /* signalled when a batch starts or the pool shuts down */
+  pthread_cond_t done_cond;     /* signalled when the last worker finishes a batch */
+
+  // Current batch
+  void (*fn)(void *arg, size_t task);
+  void *arg;
+  size_t ntasks;
+  size_t next_task;             /* next task index to hand out */
+  size_t generation;            /* number of batches started */
+  int nbusy;                    /* workers still in the current batch */
+  int shutdown;
+} Pool;
+
+/**
+ * Create a pool that runs tasks on `nthreads` threads in total, including
+ * the thread calling `pool_run`.  A pool with `nthreads` <= 1 runs tasks
+ * on the caller only.
+ */
+Pool *new_pool(int nthreads);
+void pool_destroy(Pool *pool);
+
+/**
+ * Run `fn(arg, i)` for every i in [0, ntasks), in parallel and in no
+ * particular order, and wait for all of them to finish.
+ */
+void pool_run(Pool *pool, void (*fn)(void *arg, size_t task), void *arg, size_t ntasks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POOL_H
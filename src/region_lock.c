@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "constants.h"
+#include "macros.h"
+#include "region_lock.h"
+
+RegionLocks *new_region_locks(size_t base_nblocks) {
+  RegionLocks *locks = aligned_alloc(sizeof(RegionVersion), sizeof(RegionLocks));
+  if (locks == NULL) {
+    printf("new_region_locks failed to allocate locks\n");
+    exit(1);
+  }
+  locks->base_nblocks = base_nblocks;
+  locks->nregions = (base_nblocks + LOCK_REGION_BLOCKS - 1)/LOCK_REGION_BLOCKS + 1;
+  locks->regions = malloc(locks->nregions * sizeof(pthread_rwlock_t));
+  locks->versions = aligned_alloc(sizeof(RegionVersion), locks->nregions * sizeof(RegionVersion));
+  if (locks->regions == NULL || locks->versions == NULL) {
+    printf("new_region_locks failed to allocate %lu region locks\n", locks->nregions);
+    exit(1);
+  }
+  pthread_rwlock_init(&locks->resize_lock, NULL);
+  locks->resize_version.v = 0;
+  for (size_t i=0; i<locks->nregions; i++) {
+    pthread_rwlock_init(&locks->regions[i], NULL);
+    locks->versions[i].v = 0;
+  }
+  locks->retired = NULL;
+  locks->nretired = 0;
+  return locks;
+}
+
+void region_locks_destroy(RegionLocks *locks) {
+  for (size_t i=0; i<locks->nregions; i++) {
+    pthread_rwlock_destroy(&locks->regions[i]);
+  }
+  pthread_rwlock_destroy(&locks->resize_lock);
+  for (size_t i=0; i<locks->nretired; i++) {
+    free(locks->retired[i]);
+  }
+  free(locks->retired);
+  free(locks->versions);
+  free(locks->regions);
+  free(locks);
+}
+
+size_t region_of(const RegionLocks *locks, size_t block_i) {
+  if (block_i >= locks->base_nblocks) {
+    return locks->nregions - 1;
+  }
+  return block_i / LOCK_REGION_BLOCKS;
+}
+
+size_t region_last_block(const RegionLocks *locks, size_t region, size_t nblocks) {
+  if (region == locks->nregions - 1) {
+    return nblocks - 1;
+  }
+  return min((region + 1) * LOCK_REGION_BLOCKS, locks->base_nblocks) - 1;
+}
+
+/**
+ * Mark the start of a write: the version becomes odd before any of the
+ * writer's stores are visible.  Only the holder of the matching exclusive
+ * lock calls this.
+ */
+static void write_begin(RegionVersion *version) {
+  __atomic_store_n(&version->v, version->v + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Mark the end of a write: the version becomes even after all of the
+ * writer's stores are visible.
+ */
+static void write_end(RegionVersion *version) {
+  __atomic_store_n(&version->v, version->v + 1, __ATOMIC_RELEASE);
+}
+
+void lock_regions(RegionLocks *locks, size_t lo, size_t hi, int exclusive) {
+  for (size_t i=lo; i<=hi; i++) {
+    if (exclusive) {
+      pthread_rwlock_wrlock(&locks->regions[i]);
+      write_begin(&locks->versions[i]);
+    } else {
+      pthread_rwlock_rdlock(&locks->regions[i]);
+    }
+  }
+}
+
+void unlock_regions(RegionLocks *locks, size_t lo, size_t hi, int exclusive) {
+  for (size_t i=lo; i<=hi; i++) {
+    if (exclusive) {
+      write_end(&locks->versions[i]);
+    }
+    pthread_rwlock_unlock(&locks->regions[i]);
+  }
+}
+
+void lock_resize(RegionLocks *locks, int exclusive) {
+  if (exclusive) {
+    pthread_rwlock_wrlock(&locks->resize_lock);
+    write_begin(&locks->resize_version);
+  } else {
+    pthread_rwlock_rdlock(&locks->resize_lock);
+  }
+}
+
+void unlock_resize(RegionLocks *locks, int exclusive) {
+  if (exclusive) {
+    write_end(&locks->resize_version);
+  }
+  pthread_rwlock_unlock(&locks->resize_lock);
+}
+
+int read_regions_begin(const RegionLocks *locks, size_t lo, size_t hi, uint64_t *versions) {
+  // Read the resize version first: regions can't be trusted mid-resize
+  uint64_t v = __atomic_load_n(&locks->resize_version.v, __ATOMIC_ACQUIRE);
+  if (v & 1) {
+    return 0;
+  }
+  versions[hi - lo + 1] = v;
+  for (size_t i=lo; i<=hi; i++) {
+    v = __atomic_load_n(&locks->versions[i].v, __ATOMIC_ACQUIRE);
+    if (v & 1) {
+      return 0;
+    }
+    versions[i - lo] = v;
+  }
+  return 1;
+}
+
+int read_regions_validate(const RegionLocks *locks, size_t lo, size_t hi,
+                          const uint64_t *versions) {
+  // Order the caller's reads before re-reading the versions
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  for (size_t i=lo; i<=hi; i++) {
+    if (__atomic_load_n(&locks->versions[i].v, __ATOMIC_RELAXED) != versions[i - lo]) {
+      return 0;
+    }
+  }
+  return __atomic_load_n(&locks->resize_version.v, __ATOMIC_RELAXED) == versions[hi - lo + 1];
+}
+
+void retire(RegionLocks *locks, void *ptr) {
+  void **retired = realloc(locks->retired, (locks->nretired + 1) * sizeof(void *));
+  if (retired == NULL) {
+    printf("retire failed to grow the retired list\n");
+    exit(1);
+  }
+  locks->retired = retired;
+  locks->retired[locks->nretired++] = ptr;
+}
@@ -0,0 +1,106 @@
+#ifndef REGION_LOCK_H
+#define REGION_LOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * A seqlock version word, padded to its own cache line so that writers in
+ * one region don't invalidate the versions readers check in another.
+ * The version is odd while a writer is active.
+ */
+typedef struct region_version_t {
+  uint64_t v;
+} __attribute__((aligned(64))) RegionVersion;
+
+/**
+ * Reader-writer locks over contiguous regions of a filter's blocks.
+ *
+ * Blocks [0, base_nblocks) are split into regions of LOCK_REGION_BLOCKS
+ * blocks each.  One extra region at the end covers all overflow blocks
+ * appended past base_nblocks.  Operations lock a range of regions in
+ * ascending order, so two operations never deadlock.
+ *
+ * `resize_lock` is held shared by every locking operation and exclusively
+ * by anything that reallocates the filter's blocks.
+ *
+ * Each region (and the resize lock) also has a version that exclusive
+ * holders bump on lock and unlock, so readers can skip locking entirely:
+ * they record the versions, read, and retry if any version changed.
+ * Arrays replaced while readers may still be reading them are retired
+ * rather than freed, and freed along with the locks.
+ */
+typedef struct region_locks_t {
+  size_t base_nblocks;          /* blocks in the filter before overflow */
+  size_t nregions;              /* number of region locks, including the overflow region */
+  pthread_rwlock_t resize_lock; /* held exclusively when blocks may move */
+  pthread_rwlock_t *regions;    /* one lock per region */
+  RegionVersion resize_version; /* version of resize_lock */
+  RegionVersion *versions;      /* version of each region */
+  void **retired;               /* arrays to free in region_locks_destroy */
+  size_t nretired;
+} RegionLocks;
+
+RegionLocks *new_region_locks(size_t base_nblocks);
+void region_locks_destroy(RegionLocks *locks);
+
+/**
+ * @return the region containing block `block_i`.
+ */
+size_t region_of(const RegionLocks *locks, size_t block_i);
+
+/**
+ * @return the last block in `region`, given that the filter currently has
+ * `nblocks` blocks.
+ */
+size_t region_last_block(const RegionLocks *locks, size_t region, size_t nblocks);
+
+/**
+ * Lock regions [lo, hi] in ascending order, exclusively if `exclusive` is
+ * nonzero and shared otherwise.  `unlock_regions` must be passed the same
+ * `exclusive`.
+ */
+void lock_regions(RegionLocks *locks, size_t lo, size_t hi, int exclusive);
+void unlock_regions(RegionLocks *locks, size_t lo, size_t hi, int exclusive);
+
+/**
+ * Lock the whole filter against resizing, exclusively if `exclusive` is
+ * nonzero and shared otherwise.
+ */
+void lock_resize(RegionLocks *locks, int exclusive);
+void unlock_resize(RegionLocks *locks, int exclusive);
+
+/**
+ * Start an optimistic read of regions [lo, hi], storing their versions (and
+ * the resize version) in `versions`, which must have room for hi-lo+2
+ * entries.
+ *
+ * Returns 0 if a writer is active in one of the regions, in which case the
+ * read should be retried.
+ */
+int read_regions_begin(const RegionLocks *locks, size_t lo, size_t hi, uint64_t *versions);
+
+/**
+ * Returns 1 if no writer has touched regions [lo, hi] since
+ * `read_regions_begin` stored `versions`, so that everything read from them
+ * in between is consistent.
+ */
+int read_regions_validate(const RegionLocks *locks, size_t lo, size_t hi,
+                          const uint64_t *versions);
+
+/**
+ * Free `ptr` when the locks are destroyed instead of now.  Must be called
+ * with the resize lock held exclusively.
+ */
+void retire(RegionLocks *locks, void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REGION_LOCK_H
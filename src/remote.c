@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "macros.h"
+#include "remote.h"
+
+/* In-memory array backend */
+
+typedef struct array_remote_t {
+  char *slots;                  /* Remote_elt[] with ARRAY_REMOTE_HASHES, elt_t[] otherwise */
+  size_t slot_size;
+  size_t nslots;                /* slots in use */
+  size_t capacity;              /* slots allocated */
+  int flags;
+  int borrowed;                 /* slots belong to the caller, so aren't freed or realloced */
+  void **retired;               /* replaced arrays, with ARRAY_REMOTE_CONCURRENT */
+  size_t nretired;
+  int (*verify)(void *verify_ctx, elt_t elt); /* confirms hash matches in hash32 remotes */
+  void *verify_ctx;
+} ArrayRemote;
+
+/**
+ * Returns the array of slots.  Resizes in a concurrent remote publish the
+ * new array before the filter publishes its new slot count, so lock-free
+ * readers see an array at least as long as the filter they read.
+ */
+static char *array_slots(ArrayRemote *remote) {
+  return __atomic_load_n(&remote->slots, __ATOMIC_RELAXED);
+}
+
+static elt_t array_fetch(void *ctx, size_t slot) {
+  return ((Remote_elt *)array_slots(ctx))[slot].elt;
+}
+
+static uint64_t array_fetch_hash(void *ctx, size_t slot) {
+  return ((Remote_elt *)array_slots(ctx))[slot].hash;
+}
+
+static void array_store(void *ctx, size_t slot, elt_t elt, uint64_t hash) {
+  Remote_elt *slots = (Remote_elt *)((ArrayRemote *)ctx)->slots;
+  slots[slot].elt = elt;
+  slots[slot].hash = hash;
+}
+
+static elt_t key_array_fetch(void *ctx, size_t slot) {
+  return ((elt_t *)array_slots(ctx))[slot];
+}
+
+static void key_array_store(void *ctx, size_t slot, elt_t elt, uint64_t hash) {
+  ((elt_t *)((ArrayRemote *)ctx)->slots)[slot] = elt;
+}
+
+static uint64_t hash32_fetch_hash(void *ctx, size_t slot) {
+  return ((uint32_t *)array_slots(ctx))[slot];
+}
+
+static int hash32_matches(void *ctx, size_t slot, elt_t elt, uint64_t hash) {
+  ArrayRemote *remote = ctx;
+  return ((uint32_t *)array_slots(remote))[slot] == (uint32_t)hash &&
+    remote->verify(remote->verify_ctx, elt);
+}
+
+static void hash32_store(void *ctx, size_t slot, elt_t elt, uint64_t hash) {
+  ((uint32_t *)((ArrayRemote *)ctx)->slots)[slot] = (uint32_t)hash;
+}
+
+static void array_shift(void *ctx, size_t a, size_t b) {
+  ArrayRemote *remote = ctx;
+  if (a > b) return;
+  memmove(remote->slots + (a+1) * remote->slot_size, remote->slots + a * remote->slot_size,
+          (b - a + 1) * remote->slot_size);
+  memset(remote->slots + a * remote->slot_size, 0, remote->slot_size);
+}
+
+static void array_unshift(void *ctx, size_t a, size_t b) {
+  ArrayRemote *remote = ctx;
+  if (a > b) return;
+  memmove(remote->slots + a * remote->slot_size, remote->slots + (a+1) * remote->slot_size,
+          (b - a) * remote->slot_size);
+  memset(remote->slots + b * remote->slot_size, 0, remote->slot_size);
+}
+
+static void array_resize(void *ctx, size_t nslots) {
+  ArrayRemote *remote = ctx;
+  if (nslots > remote->capacity) {
+    // Grow geometrically, so that adding a block at a time is amortized O(1)
+    size_t capacity = max(nslots, remote->capacity + (remote->capacity >> 3));
+    char *slots;
+    if (remote->flags & ARRAY_REMOTE_CONCURRENT) {
+      // Leave room to grow, so that later resizes rarely retire the array
+      capacity = max(capacity, nslots + (nslots >> 3));
+      slots = malloc(capacity * remote->slot_size);
+      if (slots != NULL) {
+        memcpy(slots, remote->slots, remote->nslots * remote->slot_size);
+        void **retired = realloc(remote->retired, (remote->nretired + 1) * sizeof(void *));
+        if (retired == NULL) {
+          printf("array_resize failed to grow the retired list\n");
+          exit(1);
+        }
+        remote->retired = retired;
+        remote->retired[remote->nretired++] = remote->slots;
+      }
+    } else if (remote->borrowed) {
+      slots = malloc(capacity * remote->slot_size);
+      if (slots != NULL) {
+        memcpy(slots, remote->slots, remote->nslots * remote->slot_size);
+        remote->borrowed = 0;
+      }
+    } else {
+      slots = realloc(remote->slots, capacity * remote->slot_size);
+    }
+    if (slots == NULL) {
+      printf("array_resize failed to allocate %lu slots\n", capacity);
+      exit(1);
+    }
+    __atomic_store_n(&remote->slots, slots, __ATOMIC_RELEASE);
+    remote->capacity = capacity;
+  }
+  if (nslots > remote->nslots) {
+    memset(remote->slots + remote->nslots * remote->slot_size, 0,
+           (nslots - remote->nslots) * remote->slot_size);
+  }
+  remote->nslots = nslots;
+}
+
+static void array_clear(void *ctx) {
+  ArrayRemote *remote = ctx;
+  memset(remote->slots, 0, remote->nslots * remote->slot_size);
+}
+
+static void array_prefetch(void *ctx, size_t slot) {
+  ArrayRemote *remote = ctx;
+  prefetch(remote->slots + slot * remote->slot_size);
+}
+
+static void array_destroy(void *ctx) {
+  ArrayRemote *remote = ctx;
+  for (size_t i=0; i<remote->nretired; i++) {
+    free(remote->retired[i]);
+  }
+  free(remote->retired);
+  if (!remote->borrowed) {
+    free(remote->slots);
+  }
+  free(remote);
+}
+
+static const RemoteOps array_ops = {
+  array_fetch, array_fetch_hash, NULL, array_store, array_shift, array_unshift,
+  array_resize, array_clear, array_prefetch, array_destroy,
+};
+
+static const RemoteOps key_array_ops = {
+  key_array_fetch, NULL, NULL, key_array_store, array_shift, array_unshift,
+  array_resize, array_clear, array_prefetch, array_destroy,
+};
+
+static const RemoteOps hash32_ops = {
+  NULL, hash32_fetch_hash, hash32_matches, hash32_store, array_shift, array_unshift,
+  array_resize, array_clear, array_prefetch, array_destroy,
+};
+
+/**
+ * Allocate an array backend with `nslots` empty slots of `slot_size` bytes.
+ */
+static ArrayRemote *new_array_ctx(size_t nslots, size_t slot_size, int flags) {
+  ArrayRemote *ctx = malloc(sizeof(ArrayRemote));
+  if (ctx == NULL) {
+    printf("new_array_remote failed to allocate remote\n");
+    exit(1);
+  }
+  ctx->slot_size = slot_size;
+  ctx->nslots = nslots;
+  ctx->capacity = nslots;
+  ctx->slots = calloc(max(ctx->capacity, 1), ctx->slot_size);
+  if (ctx->slots == NULL) {
+    printf("new_array_remote failed to allocate %lu slots\n", ctx->capacity);
+    exit(1);
+  }
+  ctx->flags = flags;
+  ctx->borrowed = 0;
+  ctx->retired = NULL;
+  ctx->nretired = 0;
+  ctx->verify = NULL;
+  ctx->verify_ctx = NULL;
+  return ctx;
+}
+
+Remote new_array_remote(size_t nslots, int flags) {
+  size_t slot_size = (flags & ARRAY_REMOTE_HASHES) ? sizeof(Remote_elt) : sizeof(elt_t);
+  Remote remote;
+  remote.ops = (flags & ARRAY_REMOTE_HASHES) ? &array_ops : &key_array_ops;
+  remote.ctx = new_array_ctx(nslots, slot_size, flags);
+  remote.concurrent_fetch = (flags & ARRAY_REMOTE_CONCURRENT) != 0;
+  remote.hash_bits = 64;
+  remote.hash_shift = 0;
+  return remote;
+}
+
+Remote new_array_remote_over(void *slots, size_t nslots, int flags) {
+  Remote remote = new_array_remote(0, flags);
+  ArrayRemote *ctx = remote.ctx;
+  free(ctx->slots);
+  ctx->slots = slots;
+  ctx->nslots = nslots;
+  ctx->capacity = nslots;
+  ctx->borrowed = 1;
+  return remote;
+}
+
+Remote new_hash32_remote(size_t nslots, int (*verify)(void *verify_ctx, elt_t elt),
+                         void *verify_ctx) {
+  ArrayRemote *ctx = new_array_ctx(nslots, sizeof(uint32_t), 0);
+  ctx->verify = verify;
+  ctx->verify_ctx = verify_ctx;
+  Remote remote;
+  remote.ops = &hash32_ops;
+  remote.ctx = ctx;
+  remote.concurrent_fetch = 0;
+  remote.hash_bits = 32;
+  remote.hash_shift = 0;
+  return remote;
+}
+
+/* Log backend */
+
+typedef struct log_remote_t {
+  uint32_t *slots;              /* index of each slot's log entry, 0 if empty */
+  size_t nslots;
+  size_t capacity;
+  Remote_elt *log;              /* stored elements; entry 0 is unused */
+  size_t nlog;                  /* entries in use, including entry 0 */
+  size_t log_capacity;
+  uint32_t *free_entries;       /* log entries of removed elements */
+  size_t nfree;
+  size_t free_capacity;
+} LogRemote;
+
+/**
+ * Grow `*arr`, an array of `*capacity` elements of `size` bytes, to hold at
+ * least `n` elements.
+ */
+static void grow_to(void **arr, size_t *capacity, size_t n, size_t size) {
+  if (n <= *capacity) {
+    return;
+  }
+  size_t new_capacity = max(n, *capacity + (*capacity >> 1));
+  void *new_arr = realloc(*arr, new_capacity * size);
+  if (new_arr == NULL) {
+    printf("log remote failed to allocate %lu entries\n", new_capacity);
+    exit(1);
+  }
+  *arr = new_arr;
+  *capacity = new_capacity;
+}
+
+static elt_t log_fetch(void *ctx, size_t slot) {
+  LogRemote *remote = ctx;
+  return remote->log[remote->slots[slot]].elt;
+}
+
+static uint64_t log_fetch_hash(void *ctx, size_t slot) {
+  LogRemote *remote = ctx;
+  return remote->log[remote->slots[slot]].hash;
+}
+
+static void log_store(void *ctx, size_t slot, elt_t elt, uint64_t hash) {
+  LogRemote *remote = ctx;
+  uint32_t entry = remote->slots[slot];
+  if (entry == 0) {
+    if (remote->nfree > 0) {
+      entry = remote->free_entries[--remote->nfree];
+    } else {
+      if (remote->nlog > UINT32_MAX) {
+        printf("log remote is full (%lu elements)\n", remote->nlog - 1);
+        exit(1);
+      }
+      grow_to((void **)&remote->log, &remote->log_capacity, remote->nlog + 1, sizeof(Remote_elt));
+      entry = (uint32_t)remote->nlog++;
+    }
+    remote->slots[slot] = entry;
+  }
+  remote->log[entry].elt = elt;
+  remote->log[entry].hash = hash;
+}
+
+/**
+ * Return the log entry of the element at `slot` to the free list.
+ */
+static void log_free(LogRemote *remote, size_t slot) {
+  if (remote->slots[slot] == 0) {
+    return;
+  }
+  grow_to((void **)&remote->free_entries, &remote->free_capacity, remote->nfree + 1,
+          sizeof(uint32_t));
+  remote->free_entries[remote->nfree++] = remote->slots[slot];
+  remote->slots[slot] = 0;
+}
+
+static void log_shift(void *ctx, size_t a, size_t b) {
+  LogRemote *remote = ctx;
+  if (a > b) return;
+  memmove(&remote->slots[a+1], &remote->slots[a], (b - a + 1) * sizeof(uint32_t));
+  remote->slots[a] = 0;
+}
+
+static void log_unshift(void *ctx, size_t a, size_t b) {
+  LogRemote *remote = ctx;
+  if (a > b) return;
+  // The element at a is overwritten: reuse its entry
+  log_free(remote, a);
+  memmove(&remote->slots[a], &remote->slots[a+1], (b - a) * sizeof(uint32_t));
+  remote->slots[b] = 0;
+}
+
+static void log_resize(void *ctx, size_t nslots) {
+  LogRemote *remote = ctx;
+  for (size_t i=nslots; i<remote->nslots; i++) {
+    log_free(remote, i);
+  }
+  grow_to((void **)&remote->slots, &remote->capacity, nslots, sizeof(uint32_t));
+  if (nslots > remote->nslots) {
+    memset(&remote->slots[remote->nslots], 0, (nslots - remote->nslots) * sizeof(uint32_t));
+  }
+  remote->nslots = nslots;
+}
+
+static void log_clear(void *ctx) {
+  LogRemote *remote = ctx;
+  memset(remote->slots, 0, remote->nslots * sizeof(uint32_t));
+  remote->nlog = 1;
+  remote->nfree = 0;
+}
+
+static void log_prefetch(void *ctx, size_t slot) {
+  LogRemote *remote = ctx;
+  prefetch(&remote->slots[slot]);
+}
+
+static void log_destroy(void *ctx) {
+  LogRemote *remote = ctx;
+  free(remote->slots);
+  free(remote->log);
+  free(remote->free_entries);
+  free(remote);
+}
+
+static const RemoteOps log_ops = {
+  log_fetch, log_fetch_hash, NULL, log_store, log_shift, log_unshift,
+  log_resize, log_clear, log_prefetch, log_destroy,
+};
+
+Remote new_log_remote(size_t nslots) {
+  LogRemote *ctx = calloc(1, sizeof(LogRemote));
+  if (ctx == NULL) {
+    printf("new_log_remote failed to allocate remote\n");
+    exit(1);
+  }
+  ctx->nlog = 1;
+  grow_to((void **)&ctx->log, &ctx->log_capacity, max(nslots, 1), sizeof(Remote_elt));
+  // Empty slots point at entry 0, which holds element 0 with hash 0
+  ctx->log[0].elt = 0;
+  ctx->log[0].hash = 0;
+  grow_to((void **)&ctx->slots, &ctx->capacity, max(nslots, 1), sizeof(uint32_t));
+  log_resize(ctx, nslots);
+
+  Remote remote;
+  remote.ops = &log_ops;
+  remote.ctx = ctx;
+  remote.concurrent_fetch = 0;
+  remote.hash_bits = 64;
+  remote.hash_shift = 0;
+  return remote;
+}
@@ -0,0 +1,171 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t elt_t;
+
+typedef struct remote_elt_t {
+  uint64_t elt;
+  uint64_t hash;
+} Remote_elt ;
+
+/**
+ * The remote representation of an adaptive filter: the element stored in
+ * each of the filter's slots, which the filter consults to tell true
+ * positives from false positives.
+ *
+ * Slots are indexed like the filter's slots and move with them: when the
+ * filter shifts a cluster to make room for an insert, it shifts the remote
+ * the same way.  Empty slots hold element 0 with hash 0.
+ *
+ * Backends may keep the elements anywhere (memory, disk, another process,
+ * an existing key store).  They needn't keep whole elements or hashes: a
+ * backend without `fetch_hash` has its elements rehashed by the filter, and
+ * one without `fetch` has to answer `matches` instead.
+ * In concurrent filters, which use an array remote made with
+ * ARRAY_REMOTE_CONCURRENT, operations on disjoint slot ranges may run in
+ * parallel.  Other backends needn't support this: the hash32 and log remotes
+ * below are single-threaded only.
+ */
+typedef struct remote_ops_t {
+  /** Returns the element stored at `slot`.  May be NULL if `matches` isn't,
+      in which case the filter can't expand. */
+  elt_t (*fetch)(void *ctx, size_t slot);
+  /** Returns the hash of the element stored at `slot`.  May be NULL, in which
+      case the filter rehashes fetched elements. */
+  uint64_t (*fetch_hash)(void *ctx, size_t slot);
+  /** Returns 1 if `elt`, whose hash is `hash`, is the element stored at
+      `slot`.  May be NULL, in which case `fetch` is compared with `elt`. */
+  int (*matches)(void *ctx, size_t slot, elt_t elt, uint64_t hash);
+  /** Stores `elt`, whose hash is `hash`, at `slot`. */
+  void (*store)(void *ctx, size_t slot, elt_t elt, uint64_t hash);
+  /** Moves the elements in [a, b] to [a+1, b+1], emptying slot a. */
+  void (*shift)(void *ctx, size_t a, size_t b);
+  /** Moves the elements in [a+1, b] to [a, b-1], emptying slot b. */
+  void (*unshift)(void *ctx, size_t a, size_t b);
+  /** Grows or shrinks to `nslots` slots, keeping the elements in slots that remain; new slots are empty. */
+  void (*resize)(void *ctx, size_t nslots);
+  /** Empties every slot. */
+  void (*clear)(void *ctx);
+  /** Hints that `slot` will be fetched soon.  May be NULL. */
+  void (*prefetch)(void *ctx, size_t slot);
+  /** Frees the backend. */
+  void (*destroy)(void *ctx);
+} RemoteOps;
+
+typedef struct remote_t {
+  const RemoteOps *ops;
+  void *ctx;
+  int concurrent_fetch;         /* nonzero if fetch is safe to call without locks, even
+                                   alongside writers and resizes (it may return stale elements) */
+  int hash_bits;                /* bits of each hash the backend keeps, starting at bit
+                                   hash_shift; 64 if it keeps whole hashes */
+  int hash_shift;               /* set by the filter to its quotient length if hash_bits < 64:
+                                   hashes are shifted right by this much before the backend sees them */
+} Remote;
+
+static inline elt_t remote_fetch(const Remote *remote, size_t slot) {
+  return remote->ops->fetch(remote->ctx, slot);
+}
+
+static inline uint64_t remote_fetch_hash(const Remote *remote, size_t slot) {
+  return remote->ops->fetch_hash(remote->ctx, slot) << remote->hash_shift;
+}
+
+static inline int remote_matches(const Remote *remote, size_t slot, elt_t elt, uint64_t hash) {
+  if (remote->ops->matches != NULL) {
+    return remote->ops->matches(remote->ctx, slot, elt, hash >> remote->hash_shift);
+  }
+  return remote->ops->fetch(remote->ctx, slot) == elt;
+}
+
+static inline void remote_store(Remote *remote, size_t slot, elt_t elt, uint64_t hash) {
+  remote->ops->store(remote->ctx, slot, elt, hash >> remote->hash_shift);
+}
+
+static inline void remote_shift(Remote *remote, size_t a, size_t b) {
+  remote->ops->shift(remote->ctx, a, b);
+}
+
+static inline void remote_unshift(Remote *remote, size_t a, size_t b) {
+  remote->ops->unshift(remote->ctx, a, b);
+}
+
+static inline void remote_resize(Remote *remote, size_t nslots) {
+  remote->ops->resize(remote->ctx, nslots);
+}
+
+static inline void remote_clear(Remote *remote) {
+  remote->ops->clear(remote->ctx);
+}
+
+static inline void remote_prefetch(const Remote *remote, size_t slot) {
+  if (remote->ops->prefetch != NULL) {
+    (remote->ops->prefetch)(remote->ctx, slot);
+  }
+}
+
+static inline void remote_destroy(Remote *remote) {
+  remote->ops->destroy(remote->ctx);
+}
+
+/* In-memory array backend */
+
+/** Keep each element's hash alongside it, so fetch_hash is a lookup */
+#define ARRAY_REMOTE_HASHES 1
+/** Keep arrays replaced by resize readable until destroy, for lock-free fetches */
+#define ARRAY_REMOTE_CONCURRENT 2
+
+/**
+ * A remote holding its elements in an array in this process's memory.
+ * Without ARRAY_REMOTE_HASHES, it takes 8 bytes per slot instead of 16 and
+ * has no fetch_hash.
+ */
+Remote new_array_remote(size_t nslots, int flags);
+
+/**
+ * An array remote whose `nslots` slots are already at `slots`, laid out as
+ * new_array_remote(nslots, flags) would lay them out (e.g. mapped from a
+ * saved filter).  Stores write to `slots` in place; the remote copies them
+ * when it grows and never frees them.  `flags` can't include
+ * ARRAY_REMOTE_CONCURRENT.
+ */
+Remote new_array_remote_over(void *slots, size_t nslots, int flags);
+
+/**
+ * A remote holding only 32 bits of each element's hash (4 bytes per slot):
+ * the bits just above the filter's quotient, which are the bits its
+ * remainders come from.  Keys themselves live in the caller's store:
+ * a stored hash matching a query's is confirmed by `verify(verify_ctx, elt)`,
+ * which returns 1 if `elt` is in the store.  `verify` is only called on
+ * fingerprint matches.  Single-threaded only.
+ *
+ * Filters using this remote derive at most 32 bits of remainders per element
+ * and can't expand.
+ */
+Remote new_hash32_remote(size_t nslots, int (*verify)(void *verify_ctx, elt_t elt),
+                         void *verify_ctx);
+
+/* Log backend */
+
+/**
+ * A remote that appends elements and their hashes to a log, with each slot
+ * holding only the 4-byte index of its element's log entry.  When the filter
+ * shifts a cluster, only the indexes move, not the 16-byte entries.  Entries
+ * of removed elements are reused by later stores.  Holds up to 2^32 - 1
+ * elements.  Single-threaded only: stores to any slots grow the same log and
+ * free list, with no locking.
+ */
+Remote new_log_remote(size_t nslots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REMOTE_H
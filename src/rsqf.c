@@ -5,11 +5,15 @@
 #include <assert.h>
 #include <string.h>
 #include <execinfo.h>
+#include <pthread.h>
 
 #include "murmur3.h"
 #include "macros.h"
 #include "rsqf.h"
 #include "bit_util.h"
+#include "block_ops.h"
+#include "region_lock.h"
+#include "serial.h"
 #include "set.h"
 
 /**
@@ -37,47 +41,74 @@ static rem_t calc_rem(const RSQF* filter, const uint64_t hash) {
 
 /* RSQF Helpers */
 
+/**
+ * Looks for the `*rank`-th 1 bit (from 0) in the runends of the block at
+ * `block_index`.  Returns its absolute index, or -1 if the block has too few
+ * runends, in which case they are subtracted from `*rank`.
+ */
+static inline int select_runend_in_block(const RSQF* filter, size_t block_index,
+                                         size_t *rank) {
+  uint64_t runends = filter->blocks[block_index].runends;
+  size_t step = bitselect(runends, *rank >= 64 ? 63 : (int)*rank);
+  if (step == 64) {
+    *rank -= popcnt(runends);
+    return -1;
+  }
+  return (int)(block_index * 64 + step);
+}
+
 /**
  * Returns the absolute index of the `rank`-th 1 bit in Q.runends past the start of
- * the block at `block_index`. `rank` indexes from 0.
+ * the block at `block_index`, reading no blocks at or after `end_block`.
+ * `rank` indexes from 0.
  *
- * Returns -1 if result is invalid (out of bounds).
+ * Returns -1 if result is invalid (at or after `end_block`).
  */
-static int select_runend(const RSQF* filter, size_t block_index, size_t rank) {
-  assert(block_index < filter->nblocks && "block_index out of bounds");
-
-  size_t step;
-  size_t loc = block_index * 64;
-  while (1) {
-    RSQFBlock* b = &filter->blocks[loc / 64];
-    step = bitselect(b->runends, rank >= 64 ? 63 : (int)rank);
-    loc += step;
-    if (step != 64 || loc >= filter->nslots) {
-      break;
+static int select_runend_upto(const RSQF* filter, size_t block_index, size_t rank,
+                              size_t end_block) {
+  assert(block_index < end_block && "block_index out of bounds");
+  for (size_t i = block_index; i < end_block; i++) {
+    int loc = select_runend_in_block(filter, i, &rank);
+    if (loc >= 0) {
+      return loc;
     }
-    rank -= popcnt(b->runends);
-  }
-  if (loc >= filter->nslots) {
-    return -1;
-  } else {
-    return (int)loc;
   }
+  return -1;
+}
+
+static int select_runend(const RSQF* filter, size_t block_index, size_t rank) {
+  return select_runend_upto(filter, block_index, rank, filter->nblocks);
 }
 
 #define RANK_SELECT_EMPTY (-1)
 #define RANK_SELECT_OVERFLOW (-2)
-/** Performs the blocked equivalent of the unblocked operation
- *    y = select(Q.runends, rank(Q.occupieds, x)).
- *  Note: x indexes from 0.
+/** rank_select_start and rank_select_resume: the next block must be read */
+#define RANK_SELECT_PENDING (-3)
+
+/**
+ * A `rank_select` in progress.  It is split at each block it reads, so that
+ * batched lookups can prefetch `block_i` and switch to other lookups before
+ * resuming it.
+ */
+typedef struct rank_select_state_t {
+  size_t x;                     /* slot being located */
+  size_t block_i;               /* block to read next */
+  size_t rank;                  /* occupieds counted so far, or the rank of the
+                                   runend to select once `selecting` */
+  size_t offset;                /* count the runends of block_i in [0, offset] */
+  int selecting;
+} RankSelectState;
+
+/**
+ * Starts a `rank_select_upto(filter, x, end_block)` by reading x's block.
  *
- *  Return behavior:
- *  - If y <= x, returns Empty
- * - If y > x, returns Full(y)
- * - If y runs off the edge, returns Overflow
+ * Returns its result if that block is enough, or RANK_SELECT_PENDING with
+ * `state` set up to read `state->block_i` next.
  */
-static int rank_select(const RSQF* filter, size_t x) {
+static inline int rank_select_start(const RSQF* filter, size_t x, size_t end_block,
+                                    RankSelectState *state) {
   // Exit early if x obviously out of range
-  if (x >= filter->nslots) {
+  if (x >= end_block * 64) {
     return RANK_SELECT_OVERFLOW;
   }
   size_t block_i = x/64;
@@ -101,43 +132,83 @@ static int rank_select(const RSQF* filter, size_t x) {
   }
 
   // Handle case where offset runs off the edge
-  if (block_i >= filter->nblocks) {
+  if (block_i >= end_block) {
     return RANK_SELECT_OVERFLOW;
   }
 
+  state->x = x;
+  state->block_i = block_i;
   // Count the number of occupied quotients between i+1 (b.start + i) and j (x)
-  uint64_t d = bitrank(b->occupieds, slot_i) - GET(b->occupieds, 0);
-
+  state->rank = bitrank(b->occupieds, slot_i) - GET(b->occupieds, 0);
   // Advance offset to relevant value for the block that b.offset points to
-  size_t offset = b->offset % 64;
-  b = &filter->blocks[block_i];
-
-  // Account for the runends in [0, offset] of the new block
-  d += bitrank(b->runends, offset);
+  state->offset = b->offset % 64;
+  state->selecting = 0;
+  return RANK_SELECT_PENDING;
+}
 
-  // If rank(Q.occupieds, x) == 0, then there's nothing to see here
-  if (d == 0) {
-    return RANK_SELECT_EMPTY;
-  } else {
+/**
+ * Continues a `rank_select_upto` by reading `state->block_i`.
+ *
+ * Returns its result, or RANK_SELECT_PENDING if the next block must be read.
+ */
+static inline int rank_select_resume(const RSQF* filter, RankSelectState *state,
+                                     size_t end_block) {
+  if (!state->selecting) {
+    // Account for the runends in [0, offset] of the new block
+    size_t d = state->rank + bitrank(filter->blocks[state->block_i].runends, state->offset);
+    // If rank(Q.occupieds, x) == 0, then there's nothing to see here
+    if (d == 0) {
+      return RANK_SELECT_EMPTY;
+    }
     // (rank-1) accounts for select's indexing from 0
-    int loc = select_runend(filter, block_i, d-1);
-    if (loc == -1) {
+    state->rank = d - 1;
+    state->selecting = 1;
+  }
+  int loc = select_runend_in_block(filter, state->block_i, &state->rank);
+  if (loc == -1) {
+    if (++state->block_i >= end_block) {
       return RANK_SELECT_OVERFLOW;
-    } else if (loc < x) {
-      return RANK_SELECT_EMPTY;
-    } else {
-      return loc;
     }
+    return RANK_SELECT_PENDING;
+  } else if (loc < state->x) {
+    return RANK_SELECT_EMPTY;
+  } else {
+    return loc;
   }
 }
 
+/** Performs the blocked equivalent of the unblocked operation
+ *    y = select(Q.runends, rank(Q.occupieds, x)).
+ *  Note: x indexes from 0.
+ *
+ *  Return behavior:
+ *  - If y <= x, returns Empty
+ * - If y > x, returns Full(y)
+ * - If y runs off the edge, returns Overflow
+ *
+ *  Blocks at or after `end_block` are never read, and count as off the edge.
+ */
+static int rank_select_upto(const RSQF* filter, size_t x, size_t end_block) {
+  RankSelectState state;
+  int loc = rank_select_start(filter, x, end_block, &state);
+  while (loc == RANK_SELECT_PENDING) {
+    loc = rank_select_resume(filter, &state, end_block);
+  }
+  return loc;
+}
+
+static int rank_select(const RSQF* filter, size_t x) {
+  return rank_select_upto(filter, x, filter->nblocks);
+}
+
 #define NO_UNUSED (-1)
 /**
- * Finds the first unused slot at or after absolute location x.
+ * Finds the first unused slot at or after absolute location x, reading no
+ * blocks at or after `end_block`.
  */
-static int first_unused(const RSQF* filter, size_t x) {
+static int first_unused_upto(const RSQF* filter, size_t x, size_t end_block) {
   while (1) {
-    int loc = rank_select(filter, x);
+    int loc = rank_select_upto(filter, x, end_block);
     switch (loc) {
       case RANK_SELECT_EMPTY: return x;
       case RANK_SELECT_OVERFLOW: return NO_UNUSED;
@@ -151,30 +222,39 @@ static int first_unused(const RSQF* filter, size_t x) {
   }
 }
 
+static int first_unused(const RSQF* filter, size_t x) {
+  return first_unused_upto(filter, x, filter->nblocks);
+}
+
+/**
+ * Returns the first slot of the run for `quot` ending at `loc`.
+ */
+static int run_start(const RSQF* filter, size_t quot, int loc) {
+  return block_find_run_start(block_layout(filter), quot, loc);
+}
+
 /**
  * Shift the remainders and runends in [a, b] forward by 1 into [a+1, b+1]
  */
 static void shift_rems_and_runends(RSQF* filter, int a, int b) {
-  if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    remainder(filter, i+1) = remainder(filter, i);
-    set_runend_to(filter, i+1, get_runend(filter, i));
-  }
-  set_runend_to(filter, a, 0);
+  block_shift_slots(block_layout(filter), a, b);
 }
 
 /**
- * Increment all non-negative offsets with targets in [a,b]
+ * Increment all non-negative offsets with targets in [a,b], in blocks at or
+ * after `first_block`.  Callers pass the first block that could have a
+ * target in [a,b], so that blocks before it aren't read.
  */
-static void inc_offsets(RSQF* filter, size_t a, size_t b) {
+static void inc_offsets(RSQF* filter, size_t a, size_t b, size_t first_block) {
   assert(a < filter->nslots && b < filter->nslots);
   // Exit early if invalid range
   if (a > b) {
     return;
   }
-  // Start i at the first block after b, clamping it so it doesn't go off the end, and work backwards
-  size_t start = min(b/64 + 1, filter->nblocks - 1);
-  for (int i = start; i>=0; i--) {
+  // Start i at the block containing b (offsets of later blocks target
+  // slots after b) and work backwards
+  size_t start = min(b/64, filter->nblocks - 1);
+  for (int i = start; i>=(int)first_block; i--) {
     RSQFBlock *block = &filter->blocks[i];
     size_t block_start = i * 64;
     // Skip this block if it has a negative offset
@@ -203,10 +283,10 @@ static void inc_offsets(RSQF* filter, size_t a, size_t b) {
  */
 static void inc_offsets_for_new_run(RSQF* filter, size_t quot, size_t loc) {
   assert(loc < filter->nslots);
-  // Start i at the first block after loc,
-  // clamping it so it doesn't go off the end
-  size_t start = min(loc/64 + 1, filter->nblocks - 1);
-  for (int i=start; i>=0; i--) {
+  // Start i at the block containing loc (offsets of later blocks target
+  // slots after loc) and stop at the block containing quot
+  size_t start = min(loc/64, filter->nblocks - 1);
+  for (int i=start; i>=(int)(quot/64); i--) {
     RSQFBlock *b = &filter->blocks[i];
     size_t b_start = i*64;
     // Skip this block if it has a negative offset
@@ -224,11 +304,135 @@ static void inc_offsets_for_new_run(RSQF* filter, size_t quot, size_t loc) {
   }
 }
 
+/**
+ * Shift the remainders and runends in [a+1, b] back by 1 into [a, b-1],
+ * clearing slot b.  Inverse of `shift_rems_and_runends`.
+ */
+static void unshift_rems_and_runends(RSQF* filter, int a, int b) {
+  block_unshift_slots(block_layout(filter), a, b);
+}
+
+/**
+ * Decrement all positive offsets with targets in [a,b].
+ *
+ * A zero offset whose target moves before its block becomes negative on its
+ * own, since its block's first slot is then neither occupied nor a runend.
+ */
+static void dec_offsets(RSQF* filter, size_t a, size_t b) {
+  assert(a < filter->nslots && b < filter->nslots);
+  if (a > b) {
+    return;
+  }
+  for (int i = b/64; i>=0; i--) {
+    RSQFBlock *block = &filter->blocks[i];
+    // Skip this block if it has a negative offset
+    if (!GET(block->occupieds, 0) &&
+        block->offset == 0 &&
+        !GET(block->runends, 0)) {
+      continue;
+    }
+    size_t target = i * 64 + block->offset;
+    if (target < a) {
+      break;
+    } else if (target <= b && block->offset > 0) {
+      block->offset--;
+    }
+  }
+}
+
+/**
+ * Returns the first occupied quotient in [a, b], or -1 if there is none.
+ */
+static int64_t next_occupied(const RSQF* filter, size_t a, size_t b) {
+  b = min(b, filter->nslots - 1);
+  while (a <= b) {
+    uint64_t word = filter->blocks[a/64].occupieds >> (a%64);
+    if (word) {
+      size_t x = a + tzcnt(word);
+      return x <= b ? (int64_t)x : -1;
+    }
+    a = (a/64 + 1) * 64;
+  }
+  return -1;
+}
+
+/**
+ * Returns the last slot that moves back when an element is removed from the
+ * run for `quot`: the runend of the last run in the chain of runs after
+ * `quot`'s that start after their quotients.
+ */
+static int removal_shift_end(const RSQF* filter, size_t quot) {
+  int end = rank_select(filter, quot);
+  for (int64_t next = next_occupied(filter, quot + 1, end);
+       next >= 0;
+       next = next_occupied(filter, next + 1, end)) {
+    end = rank_select(filter, next);
+  }
+  return end;
+}
+
+/**
+ * Move blocks loaded by rsqf_load_mmap out of the file into an array with
+ * room for `nblocks_alloc` blocks, so that they can be grown.
+ */
+static void copy_mapped_blocks(RSQF *filter, size_t nblocks_alloc) {
+  RSQFBlock *blocks = malloc(nblocks_alloc * sizeof(RSQFBlock));
+  if (blocks == NULL) {
+    printf("copy_mapped_blocks failed to allocate %lu blocks\n", nblocks_alloc);
+    exit(1);
+  }
+  memcpy(blocks, filter->blocks, filter->nblocks * sizeof(RSQFBlock));
+  filter->blocks = blocks;
+  filter->nblocks_alloc = nblocks_alloc;
+  filter->blocks_mapped = 0;
+}
+
+/**
+ * Free the filter's blocks, unless they're in a mapped file.
+ */
+static void free_blocks(RSQF *filter) {
+  if (filter->blocks_mapped) {
+    filter->blocks_mapped = 0;
+  } else {
+    free(filter->blocks);
+  }
+}
+
+/**
+ * Append an empty block to the end of the filter.
+ *
+ * Blocks are allocated in geometrically growing chunks, so that appending
+ * costs amortized O(1) instead of copying the whole filter each time.
+ *
+ * In a concurrent filter, optimistic readers may still be reading the old
+ * blocks, so they're retired instead of freed, and the new block count is
+ * published only after the blocks that hold it.
+ */
 static void add_block(RSQF *filter) {
-  filter->blocks = realloc(filter->blocks, (filter->nblocks + 1) * sizeof(RSQFBlock));
+  if (filter->blocks_mapped) {
+    copy_mapped_blocks(filter, grown_nblocks(filter->nblocks));
+  } else if (filter->nblocks == filter->nblocks_alloc) {
+    size_t nblocks_alloc = grown_nblocks(filter->nblocks_alloc);
+    RSQFBlock *new_blocks;
+    if (filter->locks != NULL) {
+      new_blocks = malloc(nblocks_alloc * sizeof(RSQFBlock));
+      if (new_blocks != NULL) {
+        memcpy(new_blocks, filter->blocks, filter->nblocks * sizeof(RSQFBlock));
+        retire(filter->locks, filter->blocks);
+      }
+    } else {
+      new_blocks = realloc(filter->blocks, nblocks_alloc * sizeof(RSQFBlock));
+    }
+    if (new_blocks == NULL) {
+      printf("add_block failed to realloc new blocks\n");
+      exit(1);
+    }
+    filter->blocks = new_blocks;
+    filter->nblocks_alloc = nblocks_alloc;
+  }
   memset(filter->blocks + filter->nblocks, 0, sizeof(RSQFBlock));
-  filter->nblocks += 1;
   filter->nslots += 64;
+  __atomic_store_n(&filter->nblocks, filter->nblocks + 1, __ATOMIC_RELEASE);
 }
 
 /* RSQF */
@@ -242,16 +446,28 @@ void rsqf_init(RSQF *filter, size_t n, int seed) {
   filter->r = REM_SIZE;
   filter->p = filter->q + filter->r;
   filter->blocks = calloc(filter->nblocks, sizeof(RSQFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+  filter->blocks_mapped = 0;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  filter->locks = NULL;
 }
 
 void rsqf_destroy(RSQF* filter) {
-  free(filter->blocks);
+  if (filter->locks != NULL) {
+    region_locks_destroy(filter->locks);
+  }
+  free_blocks(filter);
+  if (filter->mapping != NULL) {
+    serial_unmap(filter->mapping, filter->mapping_size);
+  }
   free(filter);
 }
 
 static void raw_insert(RSQF* filter, size_t quot, rem_t rem) {
   assert(quot < filter->nslots);
-  filter->nelts++;
+  // Concurrent inserts may run raw_insert in parallel on different regions
+  __atomic_add_fetch(&filter->nelts, 1, __ATOMIC_RELAXED);
 
   // Find the appropriate runend
   int r = rank_select(filter, quot);
@@ -277,12 +493,13 @@ static void raw_insert(RSQF* filter, size_t quot, rem_t rem) {
           add_block(filter);
           u = filter->nslots - 64;
       }
-      inc_offsets(filter, r+1, u-1);
+      // Offsets of blocks before quot's block target slots before r
+      inc_offsets(filter, r+1, u-1, quot/64);
       shift_rems_and_runends(filter, r + 1, (int)u - 1);
       // Start a new run or extend an existing one
       if (get_occupied(filter, quot)) {
         // quot occupied: extend an existing run
-        inc_offsets(filter, r, r);
+        inc_offsets(filter, r, r, quot/64);
         set_runend_to(filter, r, 0);
         set_runend_to(filter, r + 1, 1);
         remainder(filter, r+1) = rem;
@@ -297,18 +514,52 @@ static void raw_insert(RSQF* filter, size_t quot, rem_t rem) {
   }
 }
 
+/**
+ * Remove the fingerprint at `loc` from the run for `quot`, shifting the rest
+ * of the cluster back by 1.  Inverse of `raw_insert`.
+ */
+static void raw_remove(RSQF* filter, size_t quot, int loc) {
+  assert(quot <= loc && loc < filter->nslots);
+  filter->nelts--;
+
+  int end = removal_shift_end(filter, quot);
+  dec_offsets(filter, loc, end);
+  if (get_runend(filter, loc)) {
+    if (loc == quot || get_runend(filter, loc - 1)) {
+      // Removing the only element in the run
+      unset_occupied(filter, quot);
+    } else {
+      // Removing the last element: the run now ends one slot earlier
+      set_runend(filter, loc - 1);
+    }
+  }
+  unshift_rems_and_runends(filter, loc, end);
+}
+
+/**
+ * Returns 1 if the run for `quot` ending at `loc` contains `rem`.
+ * `loc` is the result of `rank_select(filter, quot)`.
+ */
+static int probe_run(const RSQF* filter, size_t quot, rem_t rem, int loc) {
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return 0;
+  }
+  // Compare the run's remainders a block at a time, from the block holding
+  // its runend back to the block it starts in
+  int start = run_start(filter, quot, loc);
+  for (int block_i = loc/64; block_i >= start/64; block_i--) {
+    int lo = (block_i == start/64) ? start%64 : 0;
+    int hi = (block_i == loc/64) ? loc%64 : 63;
+    if (block_match_rems(filter->blocks[block_i].remainders, rem, lo, hi)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 static int raw_lookup(const RSQF* filter, size_t quot, rem_t rem) {
   if (get_occupied(filter, quot)) {
-    int loc = rank_select(filter, quot);
-    if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
-      return 0;
-    }
-    do {
-      if (remainder(filter, loc) == rem) {
-        return 1;
-      }
-      loc--;
-    } while (loc >= (int)quot && !get_runend(filter, loc));
+    return probe_run(filter, quot, rem, rank_select(filter, quot));
   }
   return 0;
 }
@@ -327,6 +578,165 @@ int rsqf_lookup(const RSQF *filter, uint64_t elt) {
   return raw_lookup(filter, quot, rem);
 }
 
+/** Stages of a batched lookup: each starts by reading memory that the
+    previous stage prefetched */
+enum lookup_stage {
+  LOOKUP_HOME,                  /* read the home block */
+  LOOKUP_RANK_SELECT,           /* read the next block of rank_select */
+  LOOKUP_PROBE,                 /* read the run */
+};
+
+/**
+ * One of the lookups that `rsqf_lookup_batch` has in flight.
+ */
+typedef struct lookup_lane_t {
+  size_t i;                     /* index of the key in the batch */
+  size_t quot;
+  rem_t rem;
+  int loc;                      /* end of the run, once found */
+  enum lookup_stage stage;
+  RankSelectState rank_select;
+} LookupLane;
+
+static void start_lookup(const RSQF *filter, LookupLane *lane, size_t i, uint64_t elt) {
+  uint64_t hash = rsqf_hash(filter, elt);
+  lane->i = i;
+  lane->quot = calc_quot(filter, hash);
+  lane->rem = calc_rem(filter, hash);
+  lane->stage = LOOKUP_HOME;
+  prefetch(&block_containing(filter, lane->quot));
+}
+
+/**
+ * Runs `lane`'s current stage, and the next ones while they only read the
+ * block it read, then prefetches what the next stage reads.
+ * Returns 0 or 1 if the lookup finished, or -1 if it has more stages.
+ */
+static int step_lookup(const RSQF *filter, LookupLane *lane) {
+  int loc;
+  size_t read;                  /* the block this stage read */
+  switch (lane->stage) {
+    case LOOKUP_HOME:
+      if (!get_occupied(filter, lane->quot)) {
+        return 0;
+      }
+      loc = rank_select_start(filter, lane->quot, filter->nblocks, &lane->rank_select);
+      read = lane->quot/64;
+      if (loc == RANK_SELECT_PENDING && lane->rank_select.block_i == read) {
+        // The runend is usually in the home block, which is now cached
+        loc = rank_select_resume(filter, &lane->rank_select, filter->nblocks);
+      }
+      break;
+    case LOOKUP_RANK_SELECT:
+      read = lane->rank_select.block_i;
+      loc = rank_select_resume(filter, &lane->rank_select, filter->nblocks);
+      break;
+    case LOOKUP_PROBE:
+      return probe_run(filter, lane->quot, lane->rem, lane->loc);
+  }
+  if (loc == RANK_SELECT_PENDING) {
+    lane->stage = LOOKUP_RANK_SELECT;
+    prefetch(&filter->blocks[lane->rank_select.block_i]);
+    return -1;
+  }
+  if (loc < 0) {
+    return 0;
+  }
+  lane->loc = loc;
+  lane->stage = LOOKUP_PROBE;
+  if ((size_t)loc/64 == read) {
+    return probe_run(filter, lane->quot, lane->rem, loc);
+  }
+  prefetch(&block_containing(filter, loc));
+  return -1;
+}
+
+/**
+ * Look up `n` elements, writing 1 to `out[i]` if `elts[i]` is in the filter
+ * and 0 otherwise.
+ *
+ * Keeps `LOOKUP_BATCH` lookups in flight, each a small state machine that
+ * stops at every block it needs (the home block, each block `rank_select`
+ * reads past it, and the block holding the runend), prefetches it, and
+ * yields to the next lookup.  By the time a lookup is resumed its block has
+ * usually arrived, so the cache misses of up to `LOOKUP_BATCH` lookups
+ * overlap.  A finished lookup's lane is refilled with the next key.
+ */
+void rsqf_lookup_batch(const RSQF *filter, const uint64_t *elts, size_t n, uint8_t *out) {
+  LookupLane lanes[LOOKUP_BATCH];
+  size_t nlanes = min(LOOKUP_BATCH, n);
+  size_t next = 0;
+  for (; next < nlanes; next++) {
+    start_lookup(filter, &lanes[next], next, elts[next]);
+  }
+  size_t active = nlanes;
+  while (active > 0) {
+    for (size_t j=0; j < nlanes; j++) {
+      LookupLane *lane = &lanes[j];
+      if (lane->i == SIZE_MAX) {
+        continue;
+      }
+      int result = step_lookup(filter, lane);
+      if (result < 0) {
+        continue;
+      }
+      out[lane->i] = result;
+      if (next < n) {
+        start_lookup(filter, lane, next, elts[next]);
+        next++;
+      } else {
+        lane->i = SIZE_MAX;
+        active--;
+      }
+    }
+  }
+}
+
+/** Arguments of `lookup_chunk_task` */
+typedef struct parallel_lookup_t {
+  const RSQF *filter;
+  const uint64_t *elts;
+  size_t n;
+  uint64_t *bits;
+} ParallelLookup;
+
+/** Packs `n` results, 1 per byte, into bits, 64 per word */
+static void pack_results(const uint8_t *out, size_t n, uint64_t *bits) {
+  for (size_t w=0; w < (n + 63)/64; w++) {
+    uint64_t word = 0;
+    for (size_t j=0; j < 64 && w*64 + j < n; j++) {
+      word |= (uint64_t)out[w*64 + j] << j;
+    }
+    bits[w] = word;
+  }
+}
+
+/** Look up the `task`th chunk of `LOOKUP_PARALLEL_CHUNK` keys */
+static void lookup_chunk_task(void *arg, size_t task) {
+  ParallelLookup *lookup = arg;
+  size_t start = task * LOOKUP_PARALLEL_CHUNK;
+  size_t n = min(LOOKUP_PARALLEL_CHUNK, lookup->n - start);
+  uint8_t out[LOOKUP_PARALLEL_CHUNK];
+  rsqf_lookup_batch(lookup->filter, lookup->elts + start, n, out);
+  pack_results(out, n, lookup->bits + start/64);
+}
+
+/**
+ * Like `rsqf_lookup_batch`, but splits the elements across the threads of
+ * `pool`, and sets bit i%64 of `bits[i/64]` to whether `elts[i]` is in the
+ * filter.  `bits` holds (n+63)/64 words.
+ *
+ * Each task looks up `LOOKUP_PARALLEL_CHUNK` elements, a multiple of 64, so
+ * tasks write separate words of `bits`.  Lookups only read the filter, so
+ * they need no locks, but the filter must not change during the call.
+ */
+void rsqf_lookup_parallel(const RSQF *filter, Pool *pool, const uint64_t *elts,
+                          size_t n, uint64_t *bits) {
+  ParallelLookup lookup = {filter, elts, n, bits};
+  pool_run(pool, lookup_chunk_task, &lookup,
+           (n + LOOKUP_PARALLEL_CHUNK - 1)/LOOKUP_PARALLEL_CHUNK);
+}
+
 void rsqf_insert(RSQF *filter, uint64_t elt) {
   uint64_t hash = rsqf_hash(filter, elt);
   size_t quot = calc_quot(filter, hash);
@@ -334,14 +744,440 @@ void rsqf_insert(RSQF *filter, uint64_t elt) {
   raw_insert(filter, quot, rem);
 }
 
+/* Concurrent operations */
+
+/**
+ * Stores `rank_select(filter, quot)` in `loc`, reading only blocks in
+ * [quot/64, last_block].
+ *
+ * Returns 0 if the result lies past `last_block` (so more blocks need to be
+ * locked), and 1 otherwise.
+ */
+static int runend_within(const RSQF* filter, size_t quot, size_t last_block, int *loc) {
+  *loc = rank_select_upto(filter, quot, last_block + 1);
+  return *loc != RANK_SELECT_OVERFLOW || last_block == filter->nblocks - 1;
+}
+
+/**
+ * Checks whether `raw_insert` for `quot` only touches blocks in
+ * [quot/64, last_block], reading only those blocks.
+ *
+ * Returns 1 if so, 0 if it reaches past `last_block`, and -1 if it may need
+ * to add a block.
+ */
+static int insert_within(const RSQF* filter, size_t quot, size_t last_block) {
+  int at_end = last_block == filter->nblocks - 1;
+  int r = rank_select_upto(filter, quot, last_block + 1);
+  if (r == RANK_SELECT_OVERFLOW) {
+    return at_end ? -1 : 0;
+  } else if (r == RANK_SELECT_EMPTY) {
+    return 1;
+  }
+  int u = first_unused_upto(filter, r+1, last_block + 1);
+  if (u == NO_UNUSED) {
+    return at_end ? -1 : 0;
+  }
+  return 1;
+}
+
+/**
+ * Initialize a filter that supports `rsqf_insert_concurrent` and
+ * `rsqf_lookup_concurrent`.
+ */
+void rsqf_init_concurrent(RSQF *filter, size_t n, int seed) {
+  rsqf_init(filter, n, seed);
+  filter->locks = new_region_locks(filter->nblocks);
+  // Leave room for overflow blocks up front, so that add_block rarely has
+  // to retire the blocks
+  filter->nblocks_alloc = grown_nblocks(filter->nblocks);
+  filter->blocks = realloc(filter->blocks, filter->nblocks_alloc * sizeof(RSQFBlock));
+  if (filter->blocks == NULL) {
+    printf("rsqf_init_concurrent failed to allocate %lu blocks\n", filter->nblocks_alloc);
+    exit(1);
+  }
+}
+
+/**
+ * Look up `quot` and `rem` without taking any locks, storing the result in
+ * `found`.
+ *
+ * Reads from a snapshot of the filter's header, taken after the block count
+ * so that the snapshot's blocks are at least that long even if add_block
+ * replaces them.  Returns 0 if a writer may have changed what was read, in
+ * which case `found` is meaningless.
+ */
+static int lookup_optimistic(const RSQF *filter, size_t quot, rem_t rem, int *found) {
+  RegionLocks *locks = filter->locks;
+  uint64_t versions[OPTIMISTIC_READ_REGIONS + 1];
+  size_t lo = region_of(locks, quot/64);
+  for (size_t hi = min(lo + 1, locks->nregions - 1);
+       hi < locks->nregions && hi - lo < OPTIMISTIC_READ_REGIONS; hi++) {
+    if (!read_regions_begin(locks, lo, hi, versions)) {
+      return 0;
+    }
+    RSQF snapshot = *filter;
+    snapshot.nblocks = __atomic_load_n(&filter->nblocks, __ATOMIC_ACQUIRE);
+    snapshot.nslots = snapshot.nblocks * 64;
+    snapshot.blocks = __atomic_load_n(&filter->blocks, __ATOMIC_RELAXED);
+
+    int loc;
+    int ok = runend_within(&snapshot, quot, region_last_block(locks, hi, snapshot.nblocks), &loc);
+    int result = ok && get_occupied(&snapshot, quot) && probe_run(&snapshot, quot, rem, loc);
+    if (!read_regions_validate(locks, lo, hi, versions)) {
+      return 0;
+    }
+    if (ok) {
+      *found = result;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Thread-safe `rsqf_lookup`.
+ *
+ * Reads optimistically first, retrying if an insert changed the regions
+ * being read, so lookups usually neither wait on inserts nor write to any
+ * shared lock.  Under heavy contention, falls back to shared locks on the
+ * regions from quot's block to its runend.
+ */
+int rsqf_lookup_concurrent(const RSQF *filter, uint64_t elt) {
+  RegionLocks *locks = filter->locks;
+  uint64_t hash = rsqf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  rem_t rem = calc_rem(filter, hash);
+
+  int found = 0;
+  for (int i=0; i<OPTIMISTIC_READ_RETRIES; i++) {
+    if (lookup_optimistic(filter, quot, rem, &found)) {
+      return found;
+    }
+  }
+  lock_resize(locks, 0);
+  size_t lo = region_of(locks, quot/64);
+  // The last region always suffices, so this terminates
+  for (size_t hi = min(lo + 1, locks->nregions - 1); hi < locks->nregions; hi++) {
+    lock_regions(locks, lo, hi, 0);
+    int loc;
+    int ok = runend_within(filter, quot, region_last_block(locks, hi, filter->nblocks), &loc);
+    if (ok && get_occupied(filter, quot)) {
+      found = probe_run(filter, quot, rem, loc);
+    }
+    unlock_regions(locks, lo, hi, 0);
+    if (ok) {
+      break;
+    }
+  }
+  unlock_resize(locks, 0);
+  return found;
+}
+
+/**
+ * Thread-safe `rsqf_insert`.
+ *
+ * Takes exclusive locks on the regions from quot's block through the first
+ * unused slot after its run, starting with two regions and retrying with
+ * more if the insert's shift reaches past them.  Inserts that need to add a
+ * block take the whole filter.
+ */
+void rsqf_insert_concurrent(RSQF *filter, uint64_t elt) {
+  RegionLocks *locks = filter->locks;
+  uint64_t hash = rsqf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  rem_t rem = calc_rem(filter, hash);
+
+  lock_resize(locks, 0);
+  size_t lo = region_of(locks, quot/64);
+  for (size_t hi = min(lo + 1, locks->nregions - 1); hi < locks->nregions; hi++) {
+    lock_regions(locks, lo, hi, 1);
+    int within = insert_within(filter, quot, region_last_block(locks, hi, filter->nblocks));
+    if (within == 1) {
+      raw_insert(filter, quot, rem);
+    }
+    unlock_regions(locks, lo, hi, 1);
+    if (within == 1) {
+      unlock_resize(locks, 0);
+      return;
+    } else if (within == -1) {
+      break;
+    }
+  }
+  // The insert may add a block: take the whole filter
+  unlock_resize(locks, 0);
+  lock_resize(locks, 1);
+  raw_insert(filter, quot, rem);
+  unlock_resize(locks, 1);
+}
+
+/* Bulk construction */
+
+/**
+ * Set the offsets of blocks in [*next_block, end) during a bulk build.
+ * `runend` is the runend of the last run whose quotient is at or before the
+ * start of each of these blocks, or -1 if there is no such run.
+ */
+static void set_bulk_offsets(RSQF *filter, size_t *next_block, size_t end, int64_t runend) {
+  for (; *next_block < end; (*next_block)++) {
+    int64_t b_start = (int64_t)(*next_block * 64);
+    // A run ending before the block start leaves the offset negative
+    filter->blocks[*next_block].offset = runend >= b_start ? (size_t)(runend - b_start) : 0;
+  }
+}
+
+/**
+ * Write fingerprints sorted by quotient into a cleared filter in a single
+ * left-to-right pass: each run starts at its quotient or right after the
+ * previous run, whichever is later.  `run_ends[quot]` is one past the index
+ * of the last remainder of run `quot` in `rems`.
+ */
+static void bulk_write(RSQF *filter, const rem_t *rems, const size_t *run_ends, size_t n) {
+  size_t nquots = ONE(filter->q);
+  filter->nelts = n;
+  size_t next_block = 0;   // first block whose offset hasn't been set
+  size_t loc = 0;          // first slot not used by a run
+  int64_t runend = -1;     // runend of the last run written
+  size_t i = 0;            // next remainder to write
+  for (size_t quot=0; quot<nquots; quot++) {
+    if (i == run_ends[quot]) {
+      continue;
+    }
+    // Blocks starting before quot follow the previous run
+    set_bulk_offsets(filter, &next_block, (quot + 63)/64, runend);
+    loc = max(loc, quot);
+    set_occupied(filter, quot);
+    for (; i < run_ends[quot]; i++, loc++) {
+      if (loc >= filter->nslots) {
+        add_block(filter);
+      }
+      remainder(filter, loc) = rems[i];
+    }
+    runend = (int64_t)loc - 1;
+    set_runend(filter, runend);
+  }
+  set_bulk_offsets(filter, &next_block, filter->nblocks, runend);
+}
+
+/**
+ * Stably counting-sort `n` remainders by quotient, writing them to `sorted`.
+ * Fills `run_ends[0..nquots]` as expected by `bulk_write`.
+ */
+static void sort_by_quot(const size_t *quots, const rem_t *rems, size_t n, size_t nquots,
+                         rem_t *sorted, size_t *run_ends) {
+  memset(run_ends, 0, (nquots + 1) * sizeof(size_t));
+  // Count run lengths, then turn counts into the index of each run in `sorted`
+  for (size_t i=0; i<n; i++) {
+    run_ends[quots[i] + 1]++;
+  }
+  for (size_t quot=0; quot<nquots; quot++) {
+    run_ends[quot + 1] += run_ends[quot];
+  }
+  // Placing each element advances run_ends[quot] from the start to the end of run quot
+  for (size_t i=0; i<n; i++) {
+    sorted[run_ends[quots[i]]++] = rems[i];
+  }
+}
+
+/**
+ * Replace the contents of the filter with the `n` elements in `elts`.
+ *
+ * Fingerprints are counting-sorted by quotient, then written out in one
+ * linear pass.  This avoids the per-element rank/select and shifting done by
+ * `rsqf_insert`.  Elements with the same quotient keep their relative order,
+ * so the result is identical to inserting `elts` in order into an empty
+ * filter.
+ */
+void rsqf_build_bulk(RSQF *filter, const uint64_t *elts, size_t n) {
+  size_t nquots = ONE(filter->q);
+  size_t *quots = malloc(max(n, 1) * sizeof(size_t));
+  rem_t *rems = malloc(max(n, 1) * sizeof(rem_t));
+  rem_t *sorted = malloc(max(n, 1) * sizeof(rem_t));
+  size_t *run_ends = malloc((nquots + 1) * sizeof(size_t));
+  if (quots == NULL || rems == NULL || sorted == NULL || run_ends == NULL) {
+    printf("rsqf_build_bulk failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  for (size_t i=0; i<n; i++) {
+    uint64_t hash = rsqf_hash(filter, elts[i]);
+    quots[i] = calc_quot(filter, hash);
+    rems[i] = calc_rem(filter, hash);
+  }
+  sort_by_quot(quots, rems, n, nquots, sorted, run_ends);
+  free(quots);
+  free(rems);
+
+  rsqf_clear(filter);
+  bulk_write(filter, sorted, run_ends, n);
+  free(sorted);
+  free(run_ends);
+}
+
+/**
+ * Double the number of slots in the filter by moving the low bit of each
+ * remainder into its quotient.  Fingerprints are unchanged, so the filter
+ * answers queries exactly as before, but with one fewer remainder bit per
+ * element its false positive rate roughly doubles for a given load.
+ *
+ * Returns 0 on success, or -1 (leaving the filter unchanged) if remainders
+ * have no bits left to give up.
+ */
+int rsqf_expand(RSQF *filter) {
+  if (filter->r <= 1) {
+    return -1;
+  }
+  size_t old_nquots = ONE(filter->q);
+  size_t nquots = 2 * old_nquots;
+  size_t n = filter->nelts;
+  size_t *quots = malloc(max(n, 1) * sizeof(size_t));
+  rem_t *rems = malloc(max(n, 1) * sizeof(rem_t));
+  rem_t *sorted = malloc(max(n, 1) * sizeof(rem_t));
+  size_t *run_ends = malloc((nquots + 1) * sizeof(size_t));
+  if (quots == NULL || rems == NULL || sorted == NULL || run_ends == NULL) {
+    printf("rsqf_expand failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  // Walk runs in quotient order, splitting each fingerprint into its new
+  // quotient and remainder
+  size_t i = 0;
+  size_t loc = 0;
+  for (size_t quot=0; quot<old_nquots; quot++) {
+    if (!get_occupied(filter, quot)) {
+      continue;
+    }
+    loc = max(loc, quot);
+    int at_runend;
+    do {
+      rem_t rem = remainder(filter, loc);
+      quots[i] = quot | ((size_t)(rem & 1) << filter->q);
+      rems[i] = rem >> 1;
+      at_runend = get_runend(filter, loc) != 0;
+      i++;
+      loc++;
+    } while (!at_runend);
+  }
+  assert(i == n);
+  sort_by_quot(quots, rems, n, nquots, sorted, run_ends);
+  free(quots);
+  free(rems);
+
+  free_blocks(filter);
+  filter->q += 1;
+  filter->r -= 1;
+  filter->nslots = nquots;
+  filter->nblocks = nquots/64;
+  filter->blocks = calloc(filter->nblocks, sizeof(RSQFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+  if (filter->blocks == NULL) {
+    printf("rsqf_expand failed to allocate %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  bulk_write(filter, sorted, run_ends, n);
+  free(sorted);
+  free(run_ends);
+  // Regions are sized for the filter's original blocks
+  if (filter->locks != NULL) {
+    region_locks_destroy(filter->locks);
+    filter->locks = new_region_locks(filter->nblocks);
+  }
+  return 0;
+}
+
+/**
+ * Remove one copy of elt's fingerprint from the filter.
+ *
+ * Returns 1 if a matching fingerprint was found and removed, 0 otherwise.
+ * Removing an element that was never inserted may remove the fingerprint
+ * of a different element that collides with it.
+ */
+int rsqf_remove(RSQF *filter, uint64_t elt) {
+  uint64_t hash = rsqf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  rem_t rem = calc_rem(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  int loc = rank_select(filter, quot);
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return 0;
+  }
+  int start = run_start(filter, quot, loc);
+  for (; loc >= start; loc--) {
+    if (remainder(filter, loc) == rem) {
+      raw_remove(filter, quot, loc);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 double rsqf_load(RSQF *filter) {
   return (double)filter->nelts/(double)filter->nslots;
 }
 
 void rsqf_clear(RSQF* filter) {
   filter->nelts = 0;
-  free(filter->blocks);
+  free_blocks(filter);
   filter->blocks = calloc(filter->nblocks, sizeof(RSQFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+}
+
+/**
+ * Save the filter's blocks to `path`.
+ * @return 0 on success, -1 if the file couldn't be written.
+ */
+int rsqf_save(const RSQF *filter, const char *path) {
+  SerialHeader header;
+  memset(&header, 0, sizeof(header));
+  header.kind = SERIAL_RSQF;
+  header.block_size = sizeof(RSQFBlock);
+  header.p = filter->p;
+  header.q = filter->q;
+  header.r = filter->r;
+  header.nslots = filter->nslots;
+  header.nblocks = filter->nblocks;
+  header.nelts = filter->nelts;
+  header.seed = filter->seed;
+  FILE *file = serial_create(path, &header);
+  if (file == NULL) {
+    return -1;
+  }
+  fwrite(filter->blocks, sizeof(RSQFBlock), filter->nblocks, file);
+  return serial_close(file);
+}
+
+/**
+ * Initialize a filter from one saved by rsqf_save, using the file itself as
+ * the filter's blocks instead of reading them in.  The file is mapped
+ * copy-on-write: pages are read as the filter touches them, and changes to
+ * the filter never reach the file.  The blocks are copied out of the file
+ * when the filter first grows.  The filter isn't concurrent.
+ * @return 0 on success, -1 if the file couldn't be mapped or isn't an RSQF
+ * saved by this build.
+ */
+int rsqf_load_mmap(RSQF *filter, const char *path) {
+  SerialMap map;
+  if (serial_map(path, SERIAL_RSQF, sizeof(RSQFBlock), &map) != 0) {
+    return -1;
+  }
+  const SerialHeader *header = map.header;
+  if (header->r == 0 || header->r > REM_SIZE) {
+    serial_unmap(map.base, map.size);
+    return -1;
+  }
+  filter->p = header->p;
+  filter->q = header->q;
+  filter->r = header->r;
+  filter->nslots = header->nslots;
+  filter->nblocks = header->nblocks;
+  filter->nblocks_alloc = header->nblocks;
+  filter->nelts = header->nelts;
+  filter->seed = (int)header->seed;
+  filter->blocks = map.blocks;
+  filter->blocks_mapped = 1;
+  filter->mapping = map.base;
+  filter->mapping_size = map.size;
+  filter->locks = NULL;
+  return 0;
 }
 
 /* Printing */
@@ -387,6 +1223,8 @@ void print_rsqf(RSQF* filter) {
 //#define TEST_RSQF 1
 #ifdef TEST_RSQF
 
+#include <unistd.h>
+
 void print_backtrace() {
   void* callstack[128];
   int i, frames = backtrace(callstack, 128);
@@ -858,6 +1696,46 @@ void test_lookup_multi_singletons() {
   printf("passed.\n");
 }
 
+/**
+ * Check that every implementation of rank and select the CPU can run gives
+ * the same answers as the portable ones.
+ */
+void test_bit_util_dispatch() {
+  printf("Testing %s...", __FUNCTION__);
+  int features = bit_util_features;
+  uint64_t words[] = {0, 1, ONE(63), ~0ULL, 0x5555555555555555ULL, 0x8000000100000001ULL};
+  uint64_t rng = RSQF_SEED;
+  for (int trial=0; trial < 10000; trial++) {
+    uint64_t word;
+    if (trial < (int)(sizeof(words)/sizeof(words[0]))) {
+      word = words[trial];
+    } else {
+      rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+      // Sparse and dense words
+      word = rng & (rng >> (trial % 7)) & (rng << (trial % 5));
+    }
+    int ones = __builtin_popcountll(word);
+    for (int f=0; f <= features; f++) {
+      if ((f & features) != f) continue;
+      bit_util_set_features(f);
+      assert_eq(popcnt(word), ones);
+      assert_eq(tzcnt(word), word ? __builtin_ctzll(word) : 64);
+      for (int i=0; i<64; i++) {
+        assert_eq(bitrank(word, i), __builtin_popcountll(i == 63 ? word : word & ONES(i+1)));
+        uint64_t sel = bitselect(word, i);
+        if (i < ones) {
+          assert_eq(bitrank(word, sel), i+1);
+          assert(GET(word, sel));
+        } else {
+          assert_eq(sel, 64);
+        }
+      }
+    }
+  }
+  bit_util_set_features(features);
+  printf("passed.\n");
+}
+
 void test_shift_rems_and_runends() {
   printf("Testing %s...", __FUNCTION__);
   RSQF *filter = new_rsqf(128);
@@ -877,6 +1755,109 @@ void test_shift_rems_and_runends() {
   printf("passed.\n");
 }
 
+/**
+ * Check shifts and unshifts of random ranges across blocks against shifting
+ * one slot at a time.
+ */
+void test_shift_rems_and_runends_multi_block() {
+  printf("Testing %s...", __FUNCTION__);
+  RSQF *filter = new_rsqf(64 * 4);
+  int n = (int)filter->nslots;
+  rem_t *rems = malloc(n * sizeof(rem_t));
+  int *runends = malloc(n * sizeof(int));
+  srand(RSQF_SEED);
+  for (int i=0; i<n; i++) {
+    rems[i] = rand() & ONES(REM_SIZE);
+    runends[i] = rand() % 2;
+    remainder(filter, i) = rems[i];
+    set_runend_to(filter, i, runends[i]);
+  }
+  for (int trial=0; trial<1000; trial++) {
+    int a = rand() % (n-1);
+    int b = a + rand() % (n-1-a);
+    if (trial % 2 == 0) {
+      shift_rems_and_runends(filter, a, b);
+      for (int i=b; i>=a; i--) {
+        rems[i+1] = rems[i];
+        runends[i+1] = runends[i];
+      }
+      runends[a] = 0;
+    } else {
+      unshift_rems_and_runends(filter, a, b);
+      for (int i=a; i<b; i++) {
+        rems[i] = rems[i+1];
+        runends[i] = runends[i+1];
+      }
+      rems[b] = 0;
+      runends[b] = 0;
+    }
+    for (int i=0; i<n; i++) {
+      assert_eq(remainder(filter, i), rems[i]);
+      assert_eq(!!get_runend(filter, i), runends[i]);
+    }
+  }
+  free(rems);
+  free(runends);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+/**
+ * Check run_start against walking back from each run's end one slot at a
+ * time, in a nearly full filter so that runs cross blocks.
+ */
+void test_run_start() {
+  printf("Testing %s...", __FUNCTION__);
+  RSQF *filter = new_rsqf(64 * 8);
+  srand(RSQF_SEED);
+  while (filter->nelts < filter->nslots * 95 / 100) {
+    rsqf_insert(filter, rand());
+  }
+  int long_runs = 0;
+  for (size_t quot=0; quot < filter->nslots; quot++) {
+    if (!get_occupied(filter, quot)) continue;
+    int end = rank_select(filter, quot);
+    int start = end;
+    while (start > (int)quot && !get_runend(filter, start-1)) {
+      start--;
+    }
+    assert_eq(run_start(filter, quot, end), start);
+    long_runs += start/64 < end/64;
+  }
+  assert(long_runs > 0);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+/**
+ * Check probe_run against probing one slot at a time, for every remainder of
+ * every occupied quotient of a nearly full filter, so that runs cross blocks.
+ */
+void test_probe_run() {
+  printf("Testing %s...", __FUNCTION__);
+  RSQF *filter = new_rsqf(64 * 8);
+  srand(RSQF_SEED);
+  while (filter->nelts < filter->nslots * 95 / 100) {
+    rsqf_insert(filter, rand());
+  }
+  for (size_t quot=0; quot < filter->nslots; quot++) {
+    if (!get_occupied(filter, quot)) continue;
+    int end = rank_select(filter, quot);
+    assert(end != RANK_SELECT_EMPTY && end != RANK_SELECT_OVERFLOW);
+    for (int rem=0; rem <= (int)ONES(REM_SIZE); rem++) {
+      int expected = 0;
+      int loc = end;
+      do {
+        expected |= remainder(filter, loc) == rem;
+        loc--;
+      } while (loc >= (int)quot && !get_runend(filter, loc));
+      assert_eq(probe_run(filter, quot, rem, end), expected);
+    }
+  }
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
 RSQF* offset_state_init() {
   RSQF *filter = new_rsqf(64 * 7);
   RSQFBlock* b = filter->blocks;
@@ -929,7 +1910,7 @@ void test_inc_nonneg_offsets_full() {
   printf("Testing %s...", __FUNCTION__);
   RSQF* filter = offset_state_init();
   // Inc all offsets [0, n-2] -> [1, n-1]
-  inc_offsets(filter, 0, filter->nslots-1);
+  inc_offsets(filter, 0, filter->nslots-1, 0);
   RSQFBlock* b = filter->blocks;
   assert_eq(b[0].offset, 1);
   assert_eq(b[1].offset, 1);
@@ -943,7 +1924,7 @@ void test_inc_nonneg_offsets_full() {
 }
 
 void inc_and_check_offsets_unchanged(RSQF* filter, size_t start, size_t end) {
-  inc_offsets(filter, start, end);
+  inc_offsets(filter, start, end, 0);
   RSQFBlock* b = filter->blocks;
   assert_eq(b[0].offset, 0);
   assert_eq(b[1].offset, 0);
@@ -970,7 +1951,7 @@ void test_inc_nonneg_offsets_untargeted() {
 void inc_and_check_offsets_match(size_t target, size_t o0, size_t o1, size_t o2,
                                  size_t o3, size_t o4, size_t o5, size_t o6) {
   RSQF* filter = offset_state_init();
-  inc_offsets(filter, target, target);
+  inc_offsets(filter, target, target, 0);
   RSQFBlock* b = filter->blocks;
   test_assert_eq(b[0].offset, o0, "offset=%lu, o=%lu", b[0].offset, o0);
   assert_eq(b[1].offset, o1);
@@ -1000,23 +1981,23 @@ void test_inc_offsets_negative_target() {
 
   // Check that target doesn't go negative (block_i ==0 and block[0] unoccupied)
   // Negative -> 0
-  inc_offsets(filter, 0, 0);
+  inc_offsets(filter, 0, 0, 0);
   assert_eq(b[0].offset, 0);
 
   // 0 -> 1
   set_occupied(filter, 0);
   set_runend(filter, 0);
-  inc_offsets(filter, 0, 0);
+  inc_offsets(filter, 0, 0, 0);
   assert_eq(b[0].offset, 1);
 
   // 1 -> 2
-  inc_offsets(filter, 1, 1);
+  inc_offsets(filter, 1, 1, 0);
   assert_eq(b[0].offset, 2);
 
   // Check for multiblock case
   rsqf_destroy(filter);
   filter = new_rsqf(64 * 5);
-  inc_offsets(filter, 0, filter->nslots-1);
+  inc_offsets(filter, 0, filter->nslots-1, 0);
   assert_eq(filter->blocks[0].offset, 0);
 
   rsqf_destroy(filter);
@@ -1031,7 +2012,7 @@ void test_inc_offsets_zero_offset() {
   set_runend(filter, 64);
   b[0].offset = 0;
   b[1].offset = 0;
-  inc_offsets(filter, 64, 64);
+  inc_offsets(filter, 64, 64, 0);
   assert_eq(b[0].offset, 0); // shouldn't increment, negative
   assert_eq(b[1].offset, 1); // should increment, zero
   rsqf_destroy(filter);
@@ -1057,6 +2038,31 @@ void test_add_block() {
   printf("passed.\n");
 }
 
+void test_add_block_geometric() {
+  printf("Testing %s...", __FUNCTION__);
+  RSQF *filter = new_rsqf(64 * 64);
+  size_t nblocks = filter->nblocks;
+  int n_grows = 0;
+  for (int i=0; i<256; i++) {
+    size_t nblocks_alloc = filter->nblocks_alloc;
+    add_block(filter);
+    n_grows += filter->nblocks_alloc != nblocks_alloc;
+    assert(filter->nblocks <= filter->nblocks_alloc);
+    // Mark the new block so that stale data would show up if reused
+    filter->blocks[filter->nblocks - 1].offset = 1;
+  }
+  assert_eq(filter->nblocks, nblocks + 256);
+  // Growing by 1/8 each time takes ~13 reallocs to go from 64 to 320 blocks
+  assert(n_grows <= 16);
+  // Cleared filters get a fresh allocation
+  rsqf_clear(filter);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    assert_eq(filter->blocks[i].offset, 0);
+  }
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
 int is_pow_of_2(size_t x) {
   size_t mask = x==0 ? 0 : x-1;
   return (x & mask) == 0;
@@ -1250,6 +2256,409 @@ void test_insert_and_query() {
   set_deallocate(set, nset);
 }
 
+void test_lookup_batch() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 8;
+  RSQF *filter = new_rsqf(n);
+  uint64_t elts[2 * 64 * 8];
+  uint8_t out[2 * 64 * 8];
+  srand(RSQF_SEED);
+  for (size_t i=0; i<2*n; i++) {
+    elts[i] = rand();
+    if (i < n * 9/10) {
+      rsqf_insert(filter, elts[i]);
+    }
+  }
+  // Batch results match single lookups, including a partial final batch
+  rsqf_lookup_batch(filter, elts, 2*n - 5, out);
+  for (size_t i=0; i<2*n - 5; i++) {
+    assert_eq(out[i], rsqf_lookup(filter, elts[i]));
+    if (i < n * 9/10) {
+      assert_eq(out[i], 1);
+    }
+  }
+  // Fewer keys than lookups in flight
+  memset(out, 2, sizeof(out));
+  rsqf_lookup_batch(filter, elts, 3, out);
+  for (size_t i=0; i<3; i++) {
+    assert_eq(out[i], 1);
+  }
+  assert_eq(out[3], 2);
+  rsqf_lookup_batch(filter, elts, 0, out);
+  assert_eq(out[0], 1);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_lookup_parallel() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 128;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 2*n - 5;    // several chunks, ending with a partial word
+  RSQF *filter = new_rsqf(n);
+  Pool *pool = new_pool(4);
+  uint64_t *elts = malloc(nqueries * sizeof(uint64_t));
+  uint64_t *bits = malloc((nqueries + 63)/64 * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<nqueries; i++) {
+    elts[i] = rand();
+    if (i < nelts) {
+      rsqf_insert(filter, elts[i]);
+    }
+  }
+  rsqf_lookup_parallel(filter, pool, elts, nqueries, bits);
+  for (size_t i=0; i<nqueries; i++) {
+    assert_eq(GET(bits[i/64], i%64) != 0, rsqf_lookup(filter, elts[i]));
+  }
+  // Bits past the last key are cleared
+  assert_eq(bits[nqueries/64] >> (nqueries%64), 0);
+  free(bits);
+  free(elts);
+  pool_destroy(pool);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_build_bulk() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  RSQF *bulk = new_rsqf(n);
+  RSQF *incremental = new_rsqf(n);
+  uint64_t *elts = malloc(2 * nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = rand();
+  }
+  // Build over a non-empty filter to check that it is cleared first
+  rsqf_insert(bulk, 1);
+  rsqf_build_bulk(bulk, elts, nelts);
+  for (size_t i=0; i<nelts; i++) {
+    rsqf_insert(incremental, elts[i]);
+  }
+  // Blocks match incremental construction exactly
+  assert_eq(bulk->nelts, incremental->nelts);
+  assert_eq(bulk->nblocks, incremental->nblocks);
+  for (size_t i=0; i<bulk->nblocks; i++) {
+    test_assert_eq(memcmp(&bulk->blocks[i], &incremental->blocks[i], sizeof(RSQFBlock)), 0,
+                   "block_i=%lu", i);
+  }
+  for (size_t i=0; i<2*nelts; i++) {
+    assert_eq(rsqf_lookup(bulk, elts[i]), rsqf_lookup(incremental, elts[i]));
+  }
+  // An empty build leaves an empty filter
+  rsqf_build_bulk(bulk, elts, 0);
+  assert_eq(bulk->nelts, 0);
+  assert_eq(rsqf_lookup(bulk, elts[0]), 0);
+  free(elts);
+  rsqf_destroy(bulk);
+  rsqf_destroy(incremental);
+  printf("passed.\n");
+}
+
+void test_remove_single() {
+  printf("Testing %s...", __FUNCTION__);
+  RSQF *filter = new_rsqf(64 * 3);
+  assert_eq(rsqf_remove(filter, 1), 0);
+  rsqf_insert(filter, 1);
+  rsqf_insert(filter, 1);
+  assert_eq(rsqf_remove(filter, 1), 1);
+  assert(rsqf_lookup(filter, 1));
+  assert_eq(rsqf_remove(filter, 1), 1);
+  assert(!rsqf_lookup(filter, 1));
+  assert_eq(rsqf_remove(filter, 1), 0);
+  assert_eq(filter->nelts, 0);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    RSQFBlock *b = &filter->blocks[i];
+    assert_eq(b->occupieds, 0);
+    assert_eq(b->runends, 0);
+    assert_eq(b->offset, 0);
+  }
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_remove() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  RSQF *filter = new_rsqf(n);
+  RSQF *expected = new_rsqf(n);
+  uint64_t *elts = malloc(nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = rand();
+    rsqf_insert(filter, elts[i]);
+  }
+  // Remove every other element
+  for (size_t i=0; i<nelts; i += 2) {
+    assert_eq(rsqf_remove(filter, elts[i]), 1);
+  }
+  for (size_t i=1; i<nelts; i += 2) {
+    assert(rsqf_lookup(filter, elts[i]));
+    rsqf_insert(expected, elts[i]);
+  }
+  // The result is the filter we'd get from inserting the remaining elements
+  assert_eq(filter->nelts, expected->nelts);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    if (i < expected->nblocks) {
+      test_assert_eq(memcmp(&filter->blocks[i], &expected->blocks[i], sizeof(RSQFBlock)), 0,
+                     "block_i=%lu", i);
+    } else {
+      assert_eq(filter->blocks[i].runends, 0);
+    }
+  }
+  // Removing the rest empties the filter
+  for (size_t i=1; i<nelts; i += 2) {
+    assert_eq(rsqf_remove(filter, elts[i]), 1);
+  }
+  assert_eq(filter->nelts, 0);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    RSQFBlock *b = &filter->blocks[i];
+    test_assert_eq(b->occupieds | b->runends | b->offset, 0, "block_i=%lu", i);
+  }
+  free(elts);
+  rsqf_destroy(filter);
+  rsqf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_expand() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  RSQF *filter = new_rsqf(n);
+  // Expected result: a filter that started with one more quotient bit and
+  // one fewer remainder bit
+  RSQF *expected = new_rsqf(2*n);
+  expected->r = filter->r - 1;
+  uint64_t *elts = malloc(2 * nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = rand();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    rsqf_insert(filter, elts[i]);
+    rsqf_insert(expected, elts[i]);
+  }
+  uint8_t *before = malloc(2 * nelts);
+  for (size_t i=0; i<2*nelts; i++) {
+    before[i] = rsqf_lookup(filter, elts[i]);
+  }
+  assert_eq(rsqf_expand(filter), 0);
+  assert_eq(filter->nslots, 2*n);
+  assert_eq(filter->q, expected->q);
+  assert_eq(filter->nelts, nelts);
+  // Layout matches the expected filter, and lookups are unchanged
+  for (size_t i=0; i<filter->nblocks; i++) {
+    test_assert_eq(memcmp(&filter->blocks[i], &expected->blocks[i], sizeof(RSQFBlock)), 0,
+                   "block_i=%lu", i);
+  }
+  for (size_t i=0; i<2*nelts; i++) {
+    assert_eq(rsqf_lookup(filter, elts[i]), before[i]);
+  }
+  // Expanding until remainders run out fails cleanly
+  while (filter->r > 1) {
+    assert_eq(rsqf_expand(filter), 0);
+  }
+  assert_eq(rsqf_expand(filter), -1);
+  for (size_t i=0; i<nelts; i++) {
+    assert(rsqf_lookup(filter, elts[i]));
+  }
+  free(before);
+  free(elts);
+  rsqf_destroy(filter);
+  rsqf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_save_and_load_mmap() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  RSQF *filter = new_rsqf(n);
+  uint64_t *elts = malloc(2 * nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = rand();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    rsqf_insert(filter, elts[i]);
+  }
+  char path[] = "/tmp/rsqf_save_XXXXXX";
+  close(mkstemp(path));
+  assert_eq(rsqf_save(filter, path), 0);
+
+  // The loaded filter uses the file's blocks and answers the same lookups
+  RSQF *loaded = malloc(sizeof(RSQF));
+  assert_eq(rsqf_load_mmap(loaded, path), 0);
+  assert(loaded->blocks_mapped);
+  assert_eq(loaded->q, filter->q);
+  assert_eq(loaded->r, filter->r);
+  assert_eq(loaded->nelts, filter->nelts);
+  assert_eq(memcmp(loaded->blocks, filter->blocks, filter->nblocks * sizeof(RSQFBlock)), 0);
+  for (size_t i=0; i<2*nelts; i++) {
+    assert_eq(rsqf_lookup(loaded, elts[i]), rsqf_lookup(filter, elts[i]));
+  }
+  // Growing moves the blocks out of the file, without changing the file
+  add_block(loaded);
+  assert(!loaded->blocks_mapped);
+  for (size_t i=nelts; i<nelts + n/32; i++) {
+    rsqf_insert(loaded, elts[i]);
+  }
+  RSQF *reloaded = malloc(sizeof(RSQF));
+  assert_eq(rsqf_load_mmap(reloaded, path), 0);
+  assert_eq(memcmp(reloaded->blocks, filter->blocks, filter->nblocks * sizeof(RSQFBlock)), 0);
+  rsqf_destroy(reloaded);
+  for (size_t i=0; i<nelts; i++) {
+    assert(rsqf_lookup(loaded, elts[i]));
+  }
+  // Missing files are rejected
+  unlink(path);
+  RSQF *bad = malloc(sizeof(RSQF));
+  assert_eq(rsqf_load_mmap(bad, path), -1);
+  free(bad);
+  free(elts);
+  rsqf_destroy(loaded);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
+#define CONCURRENT_THREADS 8
+
+typedef struct concurrent_test_arg_t {
+  RSQF *filter;
+  const uint64_t *elts;
+  size_t n;
+  size_t misses;
+} ConcurrentTestArg;
+
+static void *insert_and_lookup_worker(void *p) {
+  ConcurrentTestArg *arg = p;
+  for (size_t i=0; i<arg->n; i++) {
+    rsqf_insert_concurrent(arg->filter, arg->elts[i]);
+    // Every element inserted by this thread so far must be visible
+    if (!rsqf_lookup_concurrent(arg->filter, arg->elts[i/2])) {
+      arg->misses++;
+    }
+  }
+  return NULL;
+}
+
+void test_insert_concurrent() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 16;
+  size_t nelts = n * 95/100;
+  RSQF *filter = malloc(sizeof(RSQF));
+  rsqf_init_concurrent(filter, n, RSQF_SEED);
+  RSQF *expected = new_rsqf(n);
+  uint64_t *elts = malloc(nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = ((uint64_t)rand() << 32) | rand();
+    rsqf_insert(expected, elts[i]);
+  }
+  // Each thread inserts its own slice of elts
+  pthread_t threads[CONCURRENT_THREADS];
+  ConcurrentTestArg args[CONCURRENT_THREADS];
+  size_t per_thread = nelts / CONCURRENT_THREADS;
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    args[t].filter = filter;
+    args[t].elts = elts + t * per_thread;
+    args[t].n = (t == CONCURRENT_THREADS - 1) ? nelts - t * per_thread : per_thread;
+    args[t].misses = 0;
+    pthread_create(&threads[t], NULL, insert_and_lookup_worker, &args[t]);
+  }
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+    assert_eq(args[t].misses, 0);
+  }
+  // Metadata doesn't depend on insertion order, so it must match a filter
+  // built sequentially
+  assert_eq(filter->nelts, nelts);
+  assert_eq(filter->nblocks, expected->nblocks);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    test_assert_eq(filter->blocks[i].occupieds, expected->blocks[i].occupieds, "block_i=%lu", i);
+    test_assert_eq(filter->blocks[i].runends, expected->blocks[i].runends, "block_i=%lu", i);
+    test_assert_eq(filter->blocks[i].offset, expected->blocks[i].offset, "block_i=%lu", i);
+  }
+  for (size_t i=0; i<nelts; i++) {
+    assert(rsqf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  rsqf_destroy(filter);
+  rsqf_destroy(expected);
+  printf("passed.\n");
+}
+
+static void *insert_worker(void *p) {
+  ConcurrentTestArg *arg = p;
+  for (size_t i=0; i<arg->n; i++) {
+    rsqf_insert_concurrent(arg->filter, arg->elts[i]);
+  }
+  return NULL;
+}
+
+static void *lookup_worker(void *p) {
+  ConcurrentTestArg *arg = p;
+  for (int pass=0; pass<4; pass++) {
+    for (size_t i=0; i<arg->n; i++) {
+      if (!rsqf_lookup_concurrent(arg->filter, arg->elts[i])) {
+        arg->misses++;
+      }
+    }
+  }
+  return NULL;
+}
+
+void test_lookup_concurrent_with_inserts() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 16;
+  size_t nelts = n * 95/100;
+  size_t nprefill = nelts/2;
+  RSQF *filter = malloc(sizeof(RSQF));
+  rsqf_init_concurrent(filter, n, RSQF_SEED);
+  uint64_t *elts = malloc(nelts * sizeof(uint64_t));
+  srand(RSQF_SEED);
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = ((uint64_t)rand() << 32) | rand();
+  }
+  for (size_t i=0; i<nprefill; i++) {
+    rsqf_insert(filter, elts[i]);
+  }
+  // Half the threads insert the rest of elts while the other half look up
+  // the prefilled elements, which shifts keep moving under the readers
+  pthread_t threads[CONCURRENT_THREADS];
+  ConcurrentTestArg args[CONCURRENT_THREADS];
+  int nwriters = CONCURRENT_THREADS/2;
+  size_t per_writer = (nelts - nprefill) / nwriters;
+  size_t per_reader = nprefill / (CONCURRENT_THREADS - nwriters);
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    args[t].filter = filter;
+    args[t].misses = 0;
+    if (t < nwriters) {
+      args[t].elts = elts + nprefill + t * per_writer;
+      args[t].n = (t == nwriters - 1) ? nelts - nprefill - t * per_writer : per_writer;
+      pthread_create(&threads[t], NULL, insert_worker, &args[t]);
+    } else {
+      args[t].elts = elts + (t - nwriters) * per_reader;
+      args[t].n = per_reader;
+      pthread_create(&threads[t], NULL, lookup_worker, &args[t]);
+    }
+  }
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+    assert_eq(args[t].misses, 0);
+  }
+  assert_eq(filter->nelts, nelts);
+  for (size_t i=0; i<nelts; i++) {
+    assert(rsqf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  rsqf_destroy(filter);
+  printf("passed.\n");
+}
+
 void test_template() {
   printf("Testing %s...", __FUNCTION__);
   RSQF *filter = new_rsqf(64 * 3);
@@ -1280,18 +2689,32 @@ int main() {
   test_lookup_empty();
   test_lookup_singleton();
   test_lookup_multi_singletons();
+  test_bit_util_dispatch();
   test_shift_rems_and_runends();
+  test_shift_rems_and_runends_multi_block();
+  test_run_start();
+  test_probe_run();
   test_inc_nonneg_offsets_full();
   test_inc_nonneg_offsets_untargeted();
   test_inc_nonneg_offsets_targeted();
   test_inc_offsets_negative_target();
   test_inc_offsets_zero_offset();
   test_add_block();
+  test_add_block_geometric();
   test_raw_insert_new_run();
   test_raw_insert_overlapping_run();
   test_raw_insert_extend();
   test_raw_insert_zero_offset();
   test_insert_repeated();
   test_insert_and_query();
+  test_lookup_batch();
+  test_lookup_parallel();
+  test_build_bulk();
+  test_remove_single();
+  test_remove();
+  test_expand();
+  test_save_and_load_mmap();
+  test_insert_concurrent();
+  test_lookup_concurrent_with_inserts();
 }
 #endif // TEST_RSQFv
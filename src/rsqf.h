@@ -8,6 +8,7 @@ extern "C" {
 #include <stdint.h>
 #include "constants.h"
 #include "remainder.h"
+#include "pool.h"
 
 typedef struct rsqf_block_t {
   rem_t remainders[64];
@@ -22,17 +23,38 @@ typedef struct rsqf_t {
   size_t r;                     /* length of remainder */
   size_t nslots;                /* number of slots available (2^q) */
   size_t nblocks;               /* nslots/64 */
+  size_t nblocks_alloc;         /* blocks allocated, including room for overflow blocks */
   size_t nelts;                 /* number of elements stored  */
   int seed;                     /* seed for Murmurhash */
   RSQFBlock* blocks;            /* blocks of 64 remainders with metadata  */
+  int blocks_mapped;            /* blocks are in `mapping`, so aren't freed or realloced */
+  void *mapping;                /* file mapped by rsqf_load_mmap, or NULL */
+  size_t mapping_size;
+  struct region_locks_t *locks; /* locks for concurrent operations, or NULL */
 } RSQF;
 
 void rsqf_init(RSQF *filter, size_t n, int seed);
 void rsqf_destroy(RSQF* filter);
 int rsqf_lookup(const RSQF *filter, uint64_t elt);
+void rsqf_lookup_batch(const RSQF *filter, const uint64_t *elts, size_t n, uint8_t *out);
+void rsqf_lookup_parallel(const RSQF *filter, Pool *pool, const uint64_t *elts,
+                          size_t n, uint64_t *bits);
 void rsqf_insert(RSQF *filter, uint64_t elt);
+int rsqf_remove(RSQF *filter, uint64_t elt);
+void rsqf_build_bulk(RSQF *filter, const uint64_t *elts, size_t n);
+int rsqf_expand(RSQF *filter);
 void rsqf_clear(RSQF* filter);
 
+// Saving and loading (see serial.h for the format)
+int rsqf_save(const RSQF *filter, const char *path);
+int rsqf_load_mmap(RSQF *filter, const char *path);
+
+// Concurrent operations: safe to call from multiple threads on a filter
+// created with rsqf_init_concurrent, but not alongside the operations above
+void rsqf_init_concurrent(RSQF *filter, size_t n, int seed);
+int rsqf_lookup_concurrent(const RSQF *filter, uint64_t elt);
+void rsqf_insert_concurrent(RSQF *filter, uint64_t elt);
+
 // Printing
 double rsqf_load(RSQF* filter);
 void print_rsqf(RSQF* filter);
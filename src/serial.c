@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "serial.h"
+
+FILE *serial_create(const char *path, SerialHeader *header) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return NULL;
+  }
+  header->magic = SERIAL_MAGIC;
+  header->version = SERIAL_VERSION;
+  char page[SERIAL_DATA_OFFSET];
+  memset(page, 0, sizeof(page));
+  memcpy(page, header, sizeof(SerialHeader));
+  if (fwrite(page, sizeof(page), 1, file) != 1) {
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+int serial_close(FILE *file) {
+  int failed = ferror(file);
+  if (fclose(file) != 0 || failed) {
+    return -1;
+  }
+  return 0;
+}
+
+int serial_map(const char *path, uint32_t kind, size_t block_size, SerialMap *map) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < SERIAL_DATA_OFFSET) {
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  // Private mapping: the filter may write to its blocks (adapting, inserting)
+  // without changing the file
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+  const SerialHeader *header = base;
+  if (header->magic != SERIAL_MAGIC || header->version != SERIAL_VERSION ||
+      header->kind != kind || header->block_size != block_size ||
+      header->nblocks == 0 || header->nblocks > size / block_size ||
+      header->nslots != header->nblocks * 64 || header->remote_slot_size > 16 ||
+      // Quotients must index the saved slots
+      header->q >= 64 || (1ULL << header->q) > header->nslots ||
+      header->p != header->q + header->r) {
+    munmap(base, size);
+    return -1;
+  }
+  size_t blocks_size = header->nblocks * block_size;
+  size_t remote_size = header->nslots * header->remote_slot_size;
+  if (size - SERIAL_DATA_OFFSET < blocks_size ||
+      size - SERIAL_DATA_OFFSET - blocks_size < remote_size) {
+    munmap(base, size);
+    return -1;
+  }
+  map->base = base;
+  map->size = size;
+  map->header = header;
+  map->blocks = (char *)base + SERIAL_DATA_OFFSET;
+  map->remote = header->remote_slot_size ? (char *)map->blocks + blocks_size : NULL;
+  return 0;
+}
+
+void serial_unmap(void *base, size_t size) {
+  munmap(base, size);
+}
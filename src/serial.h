@@ -0,0 +1,97 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** "TAFS" */
+#define SERIAL_MAGIC 0x53464154
+/** Bump whenever the header or the layout of any block changes */
+#define SERIAL_VERSION 2
+/** Offset of the blocks in a saved filter: one page, so mapped blocks are page-aligned */
+#define SERIAL_DATA_OFFSET 4096
+
+enum serial_kind {
+  SERIAL_RSQF = 1,
+  SERIAL_TAF = 2,
+  SERIAL_UTAF = 3,
+  SERIAL_EXAF = 4,
+};
+
+/**
+ * Header of a saved filter.
+ *
+ * A saved filter is this header, padded to SERIAL_DATA_OFFSET bytes, then its
+ * `nblocks` blocks exactly as they sit in memory, then (if
+ * `remote_slot_size` isn't 0) its remote as an array of `nslots` slots of
+ * `remote_slot_size` bytes each.  Files are in the saving machine's byte
+ * order and are only loaded by builds with the same block layout.
+ */
+typedef struct serial_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t kind;                /* serial_kind of the saved filter */
+  uint32_t block_size;          /* size of each saved block */
+  uint64_t p;
+  uint64_t q;
+  uint64_t r;
+  uint64_t nslots;
+  uint64_t nblocks;
+  uint64_t nelts;
+  int64_t seed;
+  int64_t mode;                 /* TAF mode, 0 for other filters */
+  int64_t codec;                /* id of the TAF's selector codec or the exAF's extension
+                                   codec (see codec.h), 0 for other filters */
+  uint64_t remote_slot_size;    /* bytes per remote slot, or 0 if the remote wasn't saved */
+} SerialHeader;
+
+/**
+ * A saved filter mapped copy-on-write into memory: writes to the blocks
+ * and remote never reach the file.
+ */
+typedef struct serial_map_t {
+  void *base;                   /* start of the mapping */
+  size_t size;                  /* length of the mapping */
+  const SerialHeader *header;
+  void *blocks;                 /* the filter's blocks */
+  void *remote;                 /* the filter's remote slots, or NULL if not saved */
+} SerialMap;
+
+/**
+ * Create `path` and write `header` to it, padded to SERIAL_DATA_OFFSET.
+ * Fills in the header's magic and version.
+ * @return the file, to which the caller appends the blocks and remote, or
+ * NULL if it couldn't be written.
+ */
+FILE *serial_create(const char *path, SerialHeader *header);
+
+/**
+ * Close a file returned by serial_create.
+ * @return 0 on success, -1 if any write to it failed.
+ */
+int serial_close(FILE *file);
+
+/**
+ * Map the filter saved at `path`, checking that it is a filter of `kind`
+ * with blocks of `block_size` bytes, saved by this version, that its
+ * quotients fit in its slots, and that the file holds all the blocks and
+ * remote slots its header describes.
+ * @return 0 on success, -1 if the file couldn't be mapped or failed a check.
+ */
+int serial_map(const char *path, uint32_t kind, size_t block_size, SerialMap *map);
+
+/**
+ * Unmap a mapping made by serial_map.
+ */
+void serial_unmap(void *base, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SERIAL_H
@@ -0,0 +1,333 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "murmur3.h"
+#include "macros.h"
+#include "sharded_taf.h"
+
+/**
+ * Generate a hash for routing the input word to a shard.
+ *
+ * Shards hash keys with their own seeds, so the top bits used here don't
+ * bias the bits a shard uses for quotients and remainders.
+ */
+static uint64_t sharded_taf_hash(const ShardedTAF *filter, elt_t elt) {
+  uint64_t buf[2];
+  MurmurHash3_x64_128(&elt, 8, filter->seed, buf);
+  return buf[0];
+}
+
+/**
+ * Returns the index of the shard that `elt` is routed to: the top k bits of
+ * its hash.
+ */
+static size_t shard_of(const ShardedTAF *filter, elt_t elt) {
+  if (filter->k == 0) {
+    return 0;
+  }
+  return sharded_taf_hash(filter, elt) >> (64 - filter->k);
+}
+
+/* Sharded TAF */
+
+/**
+ * Initialize a filter with `n` slots in total, split evenly across 2^k
+ * shards, whose batch operations run on `nthreads` threads.
+ */
+void sharded_taf_init(ShardedTAF *filter, size_t n, size_t k, int nthreads, int seed) {
+  if (k >= 32) {
+    printf("sharded_taf_init: k=%lu is too large\n", k);
+    exit(1);
+  }
+  filter->k = k;
+  filter->nshards = ONE(k);
+  filter->seed = seed;
+  filter->shards = malloc(filter->nshards * sizeof(TAF *));
+  if (filter->shards == NULL) {
+    printf("sharded_taf_init failed to allocate %lu shards\n", filter->nshards);
+    exit(1);
+  }
+  size_t shard_n = max(64, nearest_pow_of_2(n) >> k);
+  for (size_t i=0; i<filter->nshards; i++) {
+    filter->shards[i] = malloc(sizeof(TAF));
+    if (filter->shards[i] == NULL) {
+      printf("sharded_taf_init failed to allocate shard %lu\n", i);
+      exit(1);
+    }
+    taf_init(filter->shards[i], shard_n, seed + 1 + (int)i);
+  }
+  filter->pool = new_pool(nthreads);
+}
+
+void sharded_taf_destroy(ShardedTAF *filter) {
+  for (size_t i=0; i<filter->nshards; i++) {
+    taf_destroy(filter->shards[i]);
+  }
+  free(filter->shards);
+  pool_destroy(filter->pool);
+  free(filter);
+}
+
+void sharded_taf_clear(ShardedTAF *filter) {
+  for (size_t i=0; i<filter->nshards; i++) {
+    taf_clear(filter->shards[i]);
+  }
+}
+
+TAF *sharded_taf_shard(const ShardedTAF *filter, elt_t elt) {
+  return filter->shards[shard_of(filter, elt)];
+}
+
+int sharded_taf_lookup(ShardedTAF *filter, elt_t elt) {
+  return taf_lookup(sharded_taf_shard(filter, elt), elt);
+}
+
+void sharded_taf_insert(ShardedTAF *filter, elt_t elt) {
+  taf_insert(sharded_taf_shard(filter, elt), elt);
+}
+
+/* Batch operations */
+
+/**
+ * A batch of keys grouped by shard, so that each shard's keys can be
+ * handed to one task.
+ */
+typedef struct shard_batch_t {
+  ShardedTAF *filter;
+  elt_t *elts;                  /* keys, grouped by shard in their original order */
+  size_t *idxs;                 /* index of each key in the caller's array */
+  size_t *starts;               /* shard i's keys are [starts[i], starts[i+1]) */
+  uint8_t *found;               /* lookup results, grouped like elts */
+} ShardBatch;
+
+/**
+ * Group `elts` by shard with a counting sort, which keeps each shard's keys
+ * in their original order.
+ */
+static void group_by_shard(ShardedTAF *filter, const elt_t *elts, size_t n, ShardBatch *batch) {
+  batch->filter = filter;
+  batch->elts = malloc(max(n, 1) * sizeof(elt_t));
+  batch->idxs = malloc(max(n, 1) * sizeof(size_t));
+  batch->starts = calloc(filter->nshards + 1, sizeof(size_t));
+  size_t *shards = malloc(max(n, 1) * sizeof(size_t));
+  size_t *next = malloc(filter->nshards * sizeof(size_t));
+  if (batch->elts == NULL || batch->idxs == NULL || batch->starts == NULL ||
+      shards == NULL || next == NULL) {
+    printf("group_by_shard failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  batch->found = NULL;
+  for (size_t i=0; i<n; i++) {
+    shards[i] = shard_of(filter, elts[i]);
+    batch->starts[shards[i] + 1]++;
+  }
+  for (size_t i=0; i<filter->nshards; i++) {
+    batch->starts[i+1] += batch->starts[i];
+    next[i] = batch->starts[i];
+  }
+  for (size_t i=0; i<n; i++) {
+    size_t j = next[shards[i]]++;
+    batch->elts[j] = elts[i];
+    batch->idxs[j] = i;
+  }
+  free(shards);
+  free(next);
+}
+
+static void free_shard_batch(ShardBatch *batch) {
+  free(batch->elts);
+  free(batch->idxs);
+  free(batch->starts);
+  free(batch->found);
+}
+
+static void insert_shard_task(void *arg, size_t shard) {
+  ShardBatch *batch = arg;
+  TAF *taf = batch->filter->shards[shard];
+  for (size_t i=batch->starts[shard]; i<batch->starts[shard+1]; i++) {
+    taf_insert(taf, batch->elts[i]);
+  }
+}
+
+static void lookup_shard_task(void *arg, size_t shard) {
+  ShardBatch *batch = arg;
+  size_t start = batch->starts[shard];
+  taf_lookup_batch(batch->filter->shards[shard], batch->elts + start,
+                   batch->starts[shard+1] - start, batch->found + start);
+}
+
+/**
+ * Insert `n` elements, inserting into different shards in parallel.
+ * Each shard receives its elements in the order they appear in `elts`, so
+ * the result is the same as inserting them one at a time.
+ */
+void sharded_taf_insert_batch(ShardedTAF *filter, const elt_t *elts, size_t n) {
+  ShardBatch batch;
+  group_by_shard(filter, elts, n, &batch);
+  pool_run(filter->pool, insert_shard_task, &batch, filter->nshards);
+  free_shard_batch(&batch);
+}
+
+/**
+ * Look up `n` elements, writing 1 to `out[i]` if `elts[i]` is in the filter
+ * and 0 otherwise.  Shards are looked up in parallel, each with
+ * `taf_lookup_batch`, and adapt on false positives like `taf_lookup`.
+ */
+void sharded_taf_lookup_batch(ShardedTAF *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  ShardBatch batch;
+  group_by_shard(filter, elts, n, &batch);
+  batch.found = malloc(max(n, 1));
+  if (batch.found == NULL) {
+    printf("sharded_taf_lookup_batch failed to allocate results for %lu elements\n", n);
+    exit(1);
+  }
+  pool_run(filter->pool, lookup_shard_task, &batch, filter->nshards);
+  for (size_t i=0; i<n; i++) {
+    out[batch.idxs[i]] = batch.found[i];
+  }
+  free_shard_batch(&batch);
+}
+
+double sharded_taf_load(ShardedTAF *filter) {
+  size_t nelts = 0;
+  size_t nslots = 0;
+  for (size_t i=0; i<filter->nshards; i++) {
+    nelts += filter->shards[i]->nelts;
+    nslots += filter->shards[i]->nslots;
+  }
+  return (double)nelts/(double)nslots;
+}
+
+// Tests
+#ifdef TEST_SHARDED_TAF
+
+#define assert_eq(a, b) assert((a) == (b))
+
+#define SHARDED_TAF_SEED 32776517
+
+ShardedTAF *new_sharded_taf(size_t n, size_t k, int nthreads) {
+  ShardedTAF *filter = malloc(sizeof(ShardedTAF));
+  sharded_taf_init(filter, n, k, nthreads, SHARDED_TAF_SEED);
+  return filter;
+}
+
+/**
+ * Returns 1 if the two TAFs' remotes hold the same elements.
+ */
+static int same_remote(const TAF *a, const TAF *b) {
+  for (size_t i=0; i<a->nslots; i++) {
+    if (remote_fetch(&a->remote, i) != remote_fetch(&b->remote, i) ||
+        remote_fetch_hash(&a->remote, i) != remote_fetch_hash(&b->remote, i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Returns 1 if the two TAFs have identical contents.
+ */
+static int same_taf(const TAF *a, const TAF *b) {
+  return a->nblocks == b->nblocks && a->nelts == b->nelts &&
+    memcmp(a->blocks, b->blocks, a->nblocks * sizeof(TAFBlock)) == 0 &&
+    same_remote(a, b);
+}
+
+void test_init() {
+  printf("Testing %s...", __FUNCTION__);
+  ShardedTAF *filter = new_sharded_taf(1 << 12, 3, 1);
+  assert_eq(filter->nshards, 8);
+  for (size_t i=0; i<filter->nshards; i++) {
+    assert_eq(filter->shards[i]->nslots, (1 << 12)/8);
+    assert_eq(filter->shards[i]->nelts, 0);
+  }
+  sharded_taf_destroy(filter);
+  // One shard holds everything
+  filter = new_sharded_taf(1 << 12, 0, 1);
+  assert_eq(filter->nshards, 1);
+  assert_eq(filter->shards[0]->nslots, 1 << 12);
+  sharded_taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_insert_and_lookup() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 14;
+  size_t nelts = n * 9/10;
+  ShardedTAF *filter = new_sharded_taf(n, 4, 1);
+  srandom(SHARDED_TAF_SEED);
+  elt_t *elts = malloc(nelts * sizeof(elt_t));
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = random();
+    sharded_taf_insert(filter, elts[i]);
+  }
+  size_t total = 0;
+  for (size_t i=0; i<filter->nshards; i++) {
+    // Keys are spread across all shards
+    assert(filter->shards[i]->nelts > 0);
+    total += filter->shards[i]->nelts;
+  }
+  assert_eq(total, nelts);
+  for (size_t i=0; i<nelts; i++) {
+    assert(sharded_taf_lookup(filter, elts[i]));
+    assert(taf_lookup(sharded_taf_shard(filter, elts[i]), elts[i]));
+  }
+  sharded_taf_clear(filter);
+  assert_eq(sharded_taf_load(filter), 0);
+  free(elts);
+  sharded_taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_batch_ops() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 14;
+  size_t nelts = n * 9/10;
+  ShardedTAF *filter = new_sharded_taf(n, 4, 4);
+  ShardedTAF *expected = new_sharded_taf(n, 4, 1);
+  srandom(SHARDED_TAF_SEED);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = random();
+  }
+  // Batch inserts match one-at-a-time inserts exactly
+  sharded_taf_insert_batch(filter, elts, nelts);
+  for (size_t i=0; i<nelts; i++) {
+    sharded_taf_insert(expected, elts[i]);
+  }
+  for (size_t i=0; i<filter->nshards; i++) {
+    assert(same_taf(filter->shards[i], expected->shards[i]));
+  }
+  // Batch lookups give the same results and adaptations as one-at-a-time
+  // lookups, for members and nonmembers alike
+  uint8_t *out = malloc(2 * nelts);
+  sharded_taf_lookup_batch(filter, elts, 2 * nelts, out);
+  size_t fps = 0;
+  for (size_t i=0; i<2*nelts; i++) {
+    assert_eq(out[i], sharded_taf_lookup(expected, elts[i]));
+    if (i < nelts) {
+      assert(out[i]);
+    } else {
+      fps += out[i];
+    }
+  }
+  assert(fps < nelts);
+  for (size_t i=0; i<filter->nshards; i++) {
+    assert(same_taf(filter->shards[i], expected->shards[i]));
+  }
+  free(out);
+  free(elts);
+  sharded_taf_destroy(filter);
+  sharded_taf_destroy(expected);
+  printf("passed.\n");
+}
+
+int main() {
+  test_init();
+  test_insert_and_lookup();
+  test_batch_ops();
+}
+#endif // TEST_SHARDED_TAF
@@ -0,0 +1,46 @@
+#ifndef SHARDED_TAF_H
+#define SHARDED_TAF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "taf.h"
+#include "pool.h"
+
+/**
+ * 2^k independent TAFs, each holding the keys whose hash has a given top k
+ * bits.  Shards are small, so their clusters stay short, and different
+ * shards can be updated in parallel: batch operations run one task per
+ * shard on a worker pool.
+ */
+typedef struct sharded_taf_t {
+  size_t k;                     /* log2 of the number of shards */
+  size_t nshards;               /* 2^k */
+  int seed;                     /* seed for routing keys to shards */
+  TAF **shards;                 /* shards[i] holds the keys routed to i */
+  Pool *pool;                   /* workers for batch operations */
+} ShardedTAF;
+
+void sharded_taf_init(ShardedTAF *filter, size_t n, size_t k, int nthreads, int seed);
+void sharded_taf_destroy(ShardedTAF *filter);
+int sharded_taf_lookup(ShardedTAF *filter, elt_t elt);
+void sharded_taf_lookup_batch(ShardedTAF *filter, const elt_t *elts, size_t n, uint8_t *out);
+void sharded_taf_insert(ShardedTAF *filter, elt_t elt);
+void sharded_taf_insert_batch(ShardedTAF *filter, const elt_t *elts, size_t n);
+void sharded_taf_clear(ShardedTAF *filter);
+
+/**
+ * @return the shard that `elt` is routed to.
+ */
+TAF *sharded_taf_shard(const ShardedTAF *filter, elt_t elt);
+
+// Printing
+double sharded_taf_load(ShardedTAF *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHARDED_TAF_H
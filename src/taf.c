@@ -5,12 +5,16 @@
 #include <assert.h>
 #include <string.h>
 #include <execinfo.h>
+#include <pthread.h>
 
 #include "murmur3.h"
 #include "macros.h"
 #include "arcd.h"
 #include "taf.h"
 #include "bit_util.h"
+#include "block_ops.h"
+#include "region_lock.h"
+#include "serial.h"
 #include "set.h"
 
 /**
@@ -35,11 +39,22 @@ static size_t calc_quot(const TAF* filter, uint64_t hash) {
  * Returns the k-th remainder for h
  */
 static rem_t calc_rem(const TAF* filter, uint64_t hash, int k) {
-  int n_rems = (64 - (int)filter->q)/(int)filter->r;
+  int n_rems = min(64 - (int)filter->q, filter->remote.hash_bits)/(int)filter->r;
   if (k >= n_rems) k %= n_rems;
   return (hash >> (filter->q + k * filter->r)) & ONES(filter->r);
 }
 
+/**
+ * Returns the hash of the element stored at `slot`, rehashing the element if
+ * the remote doesn't keep hashes.
+ */
+static uint64_t stored_hash(const TAF* filter, size_t slot) {
+  if (filter->remote.ops->fetch_hash == NULL) {
+    return taf_hash(filter, remote_fetch(&filter->remote, slot));
+  }
+  return remote_fetch_hash(&filter->remote, slot);
+}
+
 /* TAF Helpers */
 
 /**
@@ -78,46 +93,50 @@ static void print_sels(const int sels[64]) {
 }
 
 /**
- * Returns the absolute index of the `rank`-th 1 bit in Q.runends past the start of
- * the block at `block_index`. `rank` indexes from 0.
- *
- * Returns -1 if result is invalid (out of bounds).
+ * Looks for the `*rank`-th 1 bit (from 0) in the runends of the block at
+ * `block_index`.  Returns its absolute index, or -1 if the block has too few
+ * runends, in which case they are subtracted from `*rank`.
  */
-static int select_runend(const TAF* filter, size_t block_index, size_t rank) {
-  assert(block_index < filter->nblocks && "block_index out of bounds");
-
-  size_t step;
-  size_t loc = block_index * 64;
-  while (1) {
-    TAFBlock* b = &filter->blocks[loc / 64];
-    step = bitselect(b->runends, rank >= 64 ? 63 : (int)rank);
-    loc += step;
-    if (step != 64 || loc >= filter->nslots) {
-      break;
-    }
-    rank -= popcnt(b->runends);
-  }
-  if (loc >= filter->nslots) {
+static inline int select_runend_in_block(const TAF* filter, size_t block_index,
+                                         size_t *rank) {
+  uint64_t runends = filter->blocks[block_index].runends;
+  size_t step = bitselect(runends, *rank >= 64 ? 63 : (int)*rank);
+  if (step == 64) {
+    *rank -= popcnt(runends);
     return -1;
-  } else {
-    return (int)loc;
   }
+  return (int)(block_index * 64 + step);
 }
 
 #define RANK_SELECT_EMPTY (-1)
 #define RANK_SELECT_OVERFLOW (-2)
-/** Performs the blocked equivalent of the unblocked operation
- *    y = select(Q.runends, rank(Q.occupieds, x)).
- *  Note: x indexes from 0.
+/** rank_select_start and rank_select_resume: the next block must be read */
+#define RANK_SELECT_PENDING (-3)
+
+/**
+ * A `rank_select` in progress.  It is split at each block it reads, so that
+ * batched lookups can prefetch `block_i` and switch to other lookups before
+ * resuming it.
+ */
+typedef struct rank_select_state_t {
+  size_t x;                     /* slot being located */
+  size_t block_i;               /* block to read next */
+  size_t rank;                  /* occupieds counted so far, or the rank of the
+                                   runend to select once `selecting` */
+  size_t offset;                /* count the runends of block_i in [0, offset] */
+  int selecting;
+} RankSelectState;
+
+/**
+ * Starts a `rank_select_upto(filter, x, end_block)` by reading x's block.
  *
- *  Return behavior:
- *  - If y <= x, returns Empty
- * - If y > x, returns Full(y)
- * - If y runs off the edge, returns Overflow
+ * Returns its result if that block is enough, or RANK_SELECT_PENDING with
+ * `state` set up to read `state->block_i` next.
  */
-static int rank_select(const TAF* filter, size_t x) {
+static inline int rank_select_start(const TAF* filter, size_t x, size_t end_block,
+                                    RankSelectState *state) {
   // Exit early if x obviously out of range
-  if (x >= filter->nslots) {
+  if (x >= end_block * 64) {
     return RANK_SELECT_OVERFLOW;
   }
   size_t block_i = x/64;
@@ -141,43 +160,83 @@ static int rank_select(const TAF* filter, size_t x) {
   }
 
   // Handle case where offset runs off the edge
-  if (block_i >= filter->nblocks) {
+  if (block_i >= end_block) {
     return RANK_SELECT_OVERFLOW;
   }
 
+  state->x = x;
+  state->block_i = block_i;
   // Count the number of occupied quotients between i+1 (b.start + i) and j (x)
-  uint64_t d = bitrank(b->occupieds, slot_i) - GET(b->occupieds, 0);
-
+  state->rank = bitrank(b->occupieds, slot_i) - GET(b->occupieds, 0);
   // Advance offset to relevant value for the block that b.offset points to
-  size_t offset = b->offset % 64;
-  b = &filter->blocks[block_i];
-
-  // Account for the runends in [0, offset] of the new block
-  d += bitrank(b->runends, offset);
+  state->offset = b->offset % 64;
+  state->selecting = 0;
+  return RANK_SELECT_PENDING;
+}
 
-  // If rank(Q.occupieds, x) == 0, then there's nothing to see here
-  if (d == 0) {
-    return RANK_SELECT_EMPTY;
-  } else {
+/**
+ * Continues a `rank_select_upto` by reading `state->block_i`.
+ *
+ * Returns its result, or RANK_SELECT_PENDING if the next block must be read.
+ */
+static inline int rank_select_resume(const TAF* filter, RankSelectState *state,
+                                     size_t end_block) {
+  if (!state->selecting) {
+    // Account for the runends in [0, offset] of the new block
+    size_t d = state->rank + bitrank(filter->blocks[state->block_i].runends, state->offset);
+    // If rank(Q.occupieds, x) == 0, then there's nothing to see here
+    if (d == 0) {
+      return RANK_SELECT_EMPTY;
+    }
     // (rank-1) accounts for select's indexing from 0
-    int loc = select_runend(filter, block_i, d-1);
-    if (loc == -1) {
+    state->rank = d - 1;
+    state->selecting = 1;
+  }
+  int loc = select_runend_in_block(filter, state->block_i, &state->rank);
+  if (loc == -1) {
+    if (++state->block_i >= end_block) {
       return RANK_SELECT_OVERFLOW;
-    } else if (loc < x) {
-      return RANK_SELECT_EMPTY;
-    } else {
-      return loc;
     }
+    return RANK_SELECT_PENDING;
+  } else if (loc < state->x) {
+    return RANK_SELECT_EMPTY;
+  } else {
+    return loc;
   }
 }
 
+/** Performs the blocked equivalent of the unblocked operation
+ *    y = select(Q.runends, rank(Q.occupieds, x)).
+ *  Note: x indexes from 0.
+ *
+ *  Return behavior:
+ *  - If y <= x, returns Empty
+ * - If y > x, returns Full(y)
+ * - If y runs off the edge, returns Overflow
+ *
+ *  Blocks at or after `end_block` are never read, and count as off the edge.
+ */
+static int rank_select_upto(const TAF* filter, size_t x, size_t end_block) {
+  RankSelectState state;
+  int loc = rank_select_start(filter, x, end_block, &state);
+  while (loc == RANK_SELECT_PENDING) {
+    loc = rank_select_resume(filter, &state, end_block);
+  }
+  return loc;
+}
+
+static int rank_select(const TAF* filter, size_t x) {
+  return rank_select_upto(filter, x, filter->nblocks);
+}
+
 #define NO_UNUSED (-1)
 /**
- * Finds the first unused slot at or after absolute location x.
+ * Finds the first unused slot at or after absolute location x, reading no
+ * blocks at or after `end_block`.
  */
-static int first_unused(const TAF* filter, size_t x) {
+static int first_unused_upto(const TAF* filter, size_t x, size_t end_block) {
   while (1) {
-    int loc = rank_select(filter, x);
+    int loc = rank_select_upto(filter, x, end_block);
     switch (loc) {
       case RANK_SELECT_EMPTY: return x;
       case RANK_SELECT_OVERFLOW: return NO_UNUSED;
@@ -191,16 +250,22 @@ static int first_unused(const TAF* filter, size_t x) {
   }
 }
 
+static int first_unused(const TAF* filter, size_t x) {
+  return first_unused_upto(filter, x, filter->nblocks);
+}
+
+/**
+ * Returns the first slot of the run for `quot` ending at `loc`.
+ */
+static int run_start(const TAF* filter, size_t quot, int loc) {
+  return block_find_run_start(block_layout(filter), quot, loc);
+}
+
 /**
  * Shift the remainders and runends in [a, b] forward by 1 into [a+1, b+1]
  */
 static void shift_rems_and_runends(TAF* filter, int a, int b) {
-  if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    remainder(filter, i+1) = remainder(filter, i);
-    set_runend_to(filter, i+1, get_runend(filter, i));
-  }
-  set_runend_to(filter, a, 0);
+  block_shift_slots(block_layout(filter), a, b);
 }
 
 /**
@@ -208,94 +273,80 @@ static void shift_rems_and_runends(TAF* filter, int a, int b) {
  */
 static void shift_remote_elts(TAF* filter, int a, int b) {
   if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    filter->remote[i+1] = filter->remote[i];
-  }
-  filter->remote[a].elt = 0;
-  filter->remote[a].hash = 0;
-}
-
-static void inline swap_ptrs(int **a, int **b) {
-  int *tmp = *a;
-  *a = *b;
-  *b = tmp;
+  remote_shift(&filter->remote, a, b);
 }
 
 /**
- * Helper for `shift_sels`.  Shifts sels in `[0, b]` a single block.
- */
-static void shift_block_sels(TAF *filter, int block_i, int sels[64], const int prev_sels[64], int b) {
-  uint64_t code;
-  for (int i=b; i > 0; i--) {
-    sels[i] = sels[i-1];
-  }
-  sels[0] = prev_sels[63];
-  if (encode_sel(sels, &code) == -1) {
-    code = 0;
-  }
-  set_sel_code(filter, block_i, code);
-}
-
-/**
- * Shift the hash selectors in [a,b] forward by 1
+ * Shift the hash selectors in [a,b] forward by 1, setting the selector at a
+ * to 0.
+ *
+ * Works through the blocks from a's to b+1's, carrying each block's last
+ * selector into the next.  All-zero blocks (code 0) are skipped unless a
+ * nonzero selector is carried into them, and blocks whose selectors don't
+ * change aren't re-encoded.
+ *
+ * If a block's shifted selectors can't be encoded, the block is rebuilt with
+ * all selectors set to 0.  Call after shifting the remote elements.
  */
 static void shift_sels(TAF* filter, int a, int b) {
   if (a > b) return;
-  uint64_t code;
-  if (a/64 == (b+1)/64) {
-    // a and b+1 in the same block
-    int sels[64];
-    decode_sel(get_sel_code(filter, a/64), sels);
-    for (int i = (b+1)%64; i > a%64; i--) {
-      sels[i] = sels[i-1];
-    }
-    sels[a%64] = 0;
-    if (encode_sel(sels, &code) == -1) {
-      code = 0;
+  int sels[64];
+  int carry = 0;
+  int last = (b+1)/64;
+  for (int block_i = a/64; block_i <= last; block_i++) {
+    int lo = (block_i == a/64) ? a%64 : 0;
+    int hi = (block_i == last) ? (b+1)%64 : 63;
+    uint64_t code = get_sel_code(filter, block_i);
+    if (code == 0) {
+      if (carry == 0) {
+        continue;
+      }
+      memset(sels, 0, sizeof(sels));
+      sels[lo] = carry;
+      carry = 0;
+    } else {
+      filter->codec->decode(code, sels);
+      // The selector at b+1 belongs to an empty slot, so only earlier
+      // blocks carry out their last selector
+      int next_carry = block_i < last ? sels[63] : 0;
+      int changed = sels[lo] != carry;
+      for (int i=hi; i > lo; i--) {
+        changed |= sels[i] != sels[i-1];
+        sels[i] = sels[i-1];
+      }
+      sels[lo] = carry;
+      carry = next_carry;
+      if (!changed) {
+        continue;
+      }
     }
-    set_sel_code(filter, a/64, code);
-  } else {
-    // a and b+1 in different blocks
-    int* sels = malloc(64 * sizeof(int));
-    int* prev_sels = malloc(64 * sizeof(int));
-    // (1) last block
-    int block_i = (b+1)/64;
-    decode_sel(get_sel_code(filter, block_i), sels);
-    decode_sel(get_sel_code(filter, block_i - 1), prev_sels);
-    shift_block_sels(filter, block_i, sels, prev_sels, (b + 1) % 64);
-    swap_ptrs(&sels, &prev_sels);
-    // (2) middle blocks
-    for (block_i--; block_i > a/64; block_i--) {
-      decode_sel(get_sel_code(filter, block_i - 1), prev_sels);
-      shift_block_sels(filter, block_i, sels, prev_sels, 63);
-      swap_ptrs(&sels, &prev_sels);
-    }
-    // (3) first block
-    for (int i=63; i>a%64; i--) {
-      sels[i] = sels[i-1];
-    }
-    sels[a%64] = 0;
-    if (encode_sel(sels, &code) == -1) {
+    if (filter->codec->encode(sels, &code) == -1) {
+      // Encoding failed: rebuild block with all selectors at 0
+      TAFBlock *block = &filter->blocks[block_i];
+      for (int i=0; i<64; i++) {
+        block->remainders[i] = calc_rem(filter, stored_hash(filter, block_i*64 + i), 0);
+      }
       code = 0;
     }
-    set_sel_code(filter, a/64, code);
-    free(sels);
-    free(prev_sels);
+    set_sel_code(filter, block_i, code);
   }
 }
 
 /**
- * Increment all non-negative offsets with targets in [a,b]
+ * Increment all non-negative offsets with targets in [a,b], in blocks at or
+ * after `first_block`.  Callers pass the first block that could have a
+ * target in [a,b], so that blocks before it aren't read.
  */
-static void inc_offsets(TAF* filter, size_t a, size_t b) {
+static void inc_offsets(TAF* filter, size_t a, size_t b, size_t first_block) {
   assert(a < filter->nslots && b < filter->nslots);
   // Exit early if invalid range
   if (a > b) {
     return;
   }
-  // Start i at the first block after b, clamping it so it doesn't go off the end, and work backwards
-  size_t start = min(b/64 + 1, filter->nblocks - 1);
-  for (int i = start; i>=0; i--) {
+  // Start i at the block containing b (offsets of later blocks target
+  // slots after b) and work backwards
+  size_t start = min(b/64, filter->nblocks - 1);
+  for (int i = start; i>=(int)first_block; i--) {
     TAFBlock *block = &filter->blocks[i];
     size_t block_start = i * 64;
     // Skip this block if it has a negative offset
@@ -324,10 +375,10 @@ static void inc_offsets(TAF* filter, size_t a, size_t b) {
  */
 static void inc_offsets_for_new_run(TAF* filter, size_t quot, size_t loc) {
   assert(loc < filter->nslots);
-  // Start i at the first block after loc,
-  // clamping it so it doesn't go off the end
-  size_t start = min(loc/64 + 1, filter->nblocks - 1);
-  for (int i=start; i>=0; i--) {
+  // Start i at the block containing loc (offsets of later blocks target
+  // slots after loc) and stop at the block containing quot
+  size_t start = min(loc/64, filter->nblocks - 1);
+  for (int i=start; i>=(int)(quot/64); i--) {
     TAFBlock *b = &filter->blocks[i];
     size_t b_start = i*64;
     // Skip this block if it has a negative offset
@@ -345,28 +396,205 @@ static void inc_offsets_for_new_run(TAF* filter, size_t quot, size_t loc) {
   }
 }
 
-static void add_block(TAF *filter) {
-  // Add block to new_blocks
-  TAFBlock *new_blocks = realloc(filter->blocks, (filter->nblocks + 1) * sizeof(TAFBlock));
-  if (new_blocks == NULL) {
-    printf("add_block failed to realloc new blocks\n");
-    exit(1);
+/**
+ * Shift the remainders and runends in [a+1, b] back by 1 into [a, b-1],
+ * clearing slot b.  Inverse of `shift_rems_and_runends`.
+ */
+static void unshift_rems_and_runends(TAF* filter, int a, int b) {
+  block_unshift_slots(block_layout(filter), a, b);
+}
+
+/**
+ * Shift the remote elements in [a+1, b] back by 1, clearing slot b
+ */
+static void unshift_remote_elts(TAF* filter, int a, int b) {
+  if (a > b) return;
+  remote_unshift(&filter->remote, a, b);
+}
+
+/**
+ * Shift the hash selectors in [a+1, b] back by 1 into [a, b-1], setting the
+ * selector at b to 0.  Inverse of `shift_sels`.
+ *
+ * If a block's shifted selectors can't be encoded, the block is rebuilt with
+ * all selectors set to 0.  Call after shifting the remote elements.
+ */
+static void unshift_sels(TAF* filter, int a, int b) {
+  if (a > b) return;
+  int sels[64];
+  int next_sels[64];
+  uint64_t code = get_sel_code(filter, a/64);
+  filter->codec->decode(code, sels);
+  for (int block_i = a/64; block_i <= b/64; block_i++) {
+    int lo = (block_i == a/64) ? a%64 : 0;
+    int hi = (block_i == b/64) ? b%64 : 63;
+    // Carry in the first selector of the next block
+    uint64_t next_code = 0;
+    int carry = 0;
+    if (block_i < b/64) {
+      next_code = get_sel_code(filter, block_i + 1);
+      filter->codec->decode(next_code, next_sels);
+      carry = next_sels[0];
+    }
+    // All-zero blocks stay all-zero unless a nonzero selector is carried in
+    if (code != 0 || carry != 0) {
+      int changed = sels[hi] != carry;
+      for (int i=lo; i<hi; i++) {
+        changed |= sels[i] != sels[i+1];
+        sels[i] = sels[i+1];
+      }
+      sels[hi] = carry;
+      if (changed) {
+        if (filter->codec->encode(sels, &code) == -1) {
+          // Encoding failed: rebuild block with all selectors at 0
+          TAFBlock *block = &filter->blocks[block_i];
+          for (int i=0; i<64; i++) {
+            block->remainders[i] = calc_rem(filter, stored_hash(filter, block_i*64 + i), 0);
+          }
+          code = 0;
+        }
+        set_sel_code(filter, block_i, code);
+      }
+    }
+    if (block_i < b/64) {
+      memcpy(sels, next_sels, sizeof(sels));
+    }
+    code = next_code;
   }
-  filter->blocks = new_blocks;
-  memset(filter->blocks + filter->nblocks, 0, sizeof(TAFBlock));
+}
 
-  // Reallocate remote rep
-  Remote_elt *new_remote = realloc(filter->remote,(filter->nslots + 64) * sizeof(Remote_elt));
-  if (new_remote == NULL) {
-    printf("add_block failed to realloc new remote rep\n");
+/**
+ * Decrement all positive offsets with targets in [a,b].
+ *
+ * A zero offset whose target moves before its block becomes negative on its
+ * own, since its block's first slot is then neither occupied nor a runend.
+ */
+static void dec_offsets(TAF* filter, size_t a, size_t b) {
+  assert(a < filter->nslots && b < filter->nslots);
+  if (a > b) {
+    return;
+  }
+  for (int i = b/64; i>=0; i--) {
+    TAFBlock *block = &filter->blocks[i];
+    // Skip this block if it has a negative offset
+    if (!GET(block->occupieds, 0) &&
+        block->offset == 0 &&
+        !GET(block->runends, 0)) {
+      continue;
+    }
+    size_t target = i * 64 + block->offset;
+    if (target < a) {
+      break;
+    } else if (target <= b && block->offset > 0) {
+      block->offset--;
+    }
+  }
+}
+
+/**
+ * Returns the first occupied quotient in [a, b], or -1 if there is none.
+ */
+static int64_t next_occupied(const TAF* filter, size_t a, size_t b) {
+  b = min(b, filter->nslots - 1);
+  while (a <= b) {
+    uint64_t word = filter->blocks[a/64].occupieds >> (a%64);
+    if (word) {
+      size_t x = a + tzcnt(word);
+      return x <= b ? (int64_t)x : -1;
+    }
+    a = (a/64 + 1) * 64;
+  }
+  return -1;
+}
+
+/**
+ * Returns the last slot that moves back when an element is removed from the
+ * run for `quot`: the runend of the last run in the chain of runs after
+ * `quot`'s that start after their quotients.
+ */
+static int removal_shift_end(const TAF* filter, size_t quot) {
+  int end = rank_select(filter, quot);
+  for (int64_t next = next_occupied(filter, quot + 1, end);
+       next >= 0;
+       next = next_occupied(filter, next + 1, end)) {
+    end = rank_select(filter, next);
+  }
+  return end;
+}
+
+/**
+ * Reallocate `ptr` to `new_size` bytes.  In a concurrent filter, optimistic
+ * readers may still be reading `ptr`, so it's copied and retired instead.
+ */
+static void *grow_array(TAF *filter, void *ptr, size_t old_size, size_t new_size) {
+  if (filter->locks == NULL) {
+    return realloc(ptr, new_size);
+  }
+  void *new_ptr = malloc(new_size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    retire(filter->locks, ptr);
+  }
+  return new_ptr;
+}
+
+/**
+ * Move blocks loaded by taf_load_mmap out of the file into an array with
+ * room for `nblocks_alloc` blocks, so that they can be grown.
+ */
+static void copy_mapped_blocks(TAF *filter, size_t nblocks_alloc) {
+  TAFBlock *blocks = malloc(nblocks_alloc * sizeof(TAFBlock));
+  if (blocks == NULL) {
+    printf("copy_mapped_blocks failed to allocate %lu blocks\n", nblocks_alloc);
     exit(1);
   }
-  filter->remote = new_remote;
-  memset(filter->remote + filter->nslots, 0, 64 * sizeof(Remote_elt));
+  memcpy(blocks, filter->blocks, filter->nblocks * sizeof(TAFBlock));
+  filter->blocks = blocks;
+  filter->nblocks_alloc = nblocks_alloc;
+  filter->blocks_mapped = 0;
+}
+
+/**
+ * Free the filter's blocks, unless they're in a mapped file.
+ */
+static void free_blocks(TAF *filter) {
+  if (filter->blocks_mapped) {
+    filter->blocks_mapped = 0;
+  } else {
+    free(filter->blocks);
+  }
+}
+
+/**
+ * Append an empty block (and its remote slots) to the end of the filter.
+ *
+ * Blocks are allocated in geometrically growing chunks, so that appending
+ * costs amortized O(1) instead of copying the whole filter each time.
+ * The new block count is published only after the arrays that hold it, for
+ * optimistic readers.
+ */
+static void add_block(TAF *filter) {
+  if (filter->blocks_mapped) {
+    copy_mapped_blocks(filter, grown_nblocks(filter->nblocks));
+  } else if (filter->nblocks == filter->nblocks_alloc) {
+    size_t nblocks_alloc = grown_nblocks(filter->nblocks_alloc);
+    // Reallocate blocks
+    TAFBlock *new_blocks = grow_array(filter, filter->blocks,
+                                      filter->nblocks * sizeof(TAFBlock),
+                                      nblocks_alloc * sizeof(TAFBlock));
+    if (new_blocks == NULL) {
+      printf("add_block failed to realloc new blocks\n");
+      exit(1);
+    }
+    filter->blocks = new_blocks;
+    filter->nblocks_alloc = nblocks_alloc;
+  }
+  memset(filter->blocks + filter->nblocks, 0, sizeof(TAFBlock));
+  remote_resize(&filter->remote, filter->nslots + 64);
 
   // Update counters
-  filter->nblocks += 1;
   filter->nslots += 64;
+  __atomic_store_n(&filter->nblocks, filter->nblocks + 1, __ATOMIC_RELEASE);
 }
 
 /**
@@ -380,18 +608,18 @@ static void adapt_loc(TAF *filter, size_t loc, int sels[64]) {
   sels[loc%64] = new_sel;
   // Write encoding to block
   uint64_t code;
-  if (encode_sel(sels, &code) == -1) {
+  if (filter->codec->encode(sels, &code) == -1) {
     // Encoding failed: rebuild
     // Reset all remainders and selectors in block
     memset(sels, 0, 64 * sizeof(sels[0]));
     TAFBlock *b = &filter->blocks[loc/64];
     uint64_t b_start = loc - (loc % 64);
     for (int i=0; i<64; i++) {
-      b->remainders[i] = calc_rem(filter, filter->remote[b_start + i].hash, 0);
+      b->remainders[i] = calc_rem(filter, stored_hash(filter, b_start + i), 0);
     }
     // Set sel to new_sel and attempt encode
     sels[loc % 64] = new_sel;
-    if (encode_sel(sels, &code) == -1) {
+    if (filter->codec->encode(sels, &code) == -1) {
       fprintf(stderr, "Encoding (sel=%d) failed after rebuild!\n", new_sel);
       sels[loc % 64] = 0;
       new_sel = 0;
@@ -399,7 +627,7 @@ static void adapt_loc(TAF *filter, size_t loc, int sels[64]) {
     }
   }
   // Encoding succeeded: update sel_code and remainder
-  rem_t new_rem = calc_rem(filter, filter->remote[loc].hash, new_sel);
+  rem_t new_rem = calc_rem(filter, stored_hash(filter, loc), new_sel);
   switch (filter->mode) {
     case TAF_MODE_NORMAL:
       remainder(filter, loc) = new_rem;
@@ -417,19 +645,23 @@ static void adapt_loc(TAF *filter, size_t loc, int sels[64]) {
  *
  * Go through the rest of the run and fix any other remaining collisions.
  */
-static void adapt(TAF *filter, elt_t query, int loc, size_t quot, uint64_t hash, int sels[64]) {
+static void adapt(TAF *filter, elt_t query, int loc, size_t quot, uint64_t hash) {
   assert(quot <= loc && loc < filter->nslots);
+  int start = run_start(filter, quot, loc);
   // Make sure the query elt isn't mapped to an earlier index in the sequence
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
-    if (filter->remote[i].elt == query) {
+  for (int i=loc; i>=start; i--) {
+    if (remote_matches(&filter->remote, i, query, hash)) {
       return;
     }
   }
+  // Lookups only decode selectors up to the match; adapting re-encodes whole blocks
+  int sels[64];
+  filter->codec->decode(get_sel_code(filter, loc/64), sels);
   // Adapt on all collisions in the run
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
+  for (int i=loc; i>=start; i--) {
     // Re-decode if at a new block
     if (i != loc && i % 64 == 63) {
-      decode_sel(get_sel_code(filter, i/64), sels);
+      filter->codec->decode(get_sel_code(filter, i/64), sels);
     }
     // Check collision
     int sel = sels[i % 64];
@@ -442,6 +674,16 @@ static void adapt(TAF *filter, elt_t query, int loc, size_t quot, uint64_t hash,
 /* TAF */
 
 void taf_init(TAF *filter, size_t n, int seed) {
+  taf_init_remote(filter, n, seed, new_array_remote(0, REMOTE_KEYS_ONLY ? 0 : ARRAY_REMOTE_HASHES));
+}
+
+/**
+ * Initialize a filter that keeps its elements in `remote`.  The filter takes
+ * ownership of `remote`, resizes it to the filter's slots, and destroys it in
+ * `taf_destroy`.  If the remote keeps fewer than 64 hash bits, remainders
+ * are drawn from those bits only.
+ */
+void taf_init_remote(TAF *filter, size_t n, int seed, Remote remote) {
   filter->seed = seed;
   filter->nelts = 0;
   filter->nblocks = max(1, nearest_pow_of_2(n)/64);
@@ -450,28 +692,166 @@ void taf_init(TAF *filter, size_t n, int seed) {
   filter->r = REM_SIZE;
   filter->p = filter->q + filter->r;
   filter->blocks = calloc(filter->nblocks, sizeof(TAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(Remote_elt));
+  filter->nblocks_alloc = filter->nblocks;
+  filter->blocks_mapped = 0;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  filter->codec = &arcd_sel_codec;
+  filter->remote = remote;
+  if (filter->remote.hash_bits < 64) {
+    filter->remote.hash_shift = (int)filter->q;
+  }
+  remote_resize(&filter->remote, filter->nslots);
   filter->mode = TAF_MODE_NORMAL;
+  filter->locks = NULL;
+  filter->defer_adapt = 0;
+  filter->pending = NULL;
+  filter->npending = 0;
+  filter->pending_alloc = 0;
 }
 
 void taf_destroy(TAF* filter) {
-  free(filter->blocks);
-  free(filter->remote);
+  if (filter->locks != NULL) {
+    region_locks_destroy(filter->locks);
+  }
+  free_blocks(filter);
+  remote_destroy(&filter->remote);
+  if (filter->mapping != NULL) {
+    serial_unmap(filter->mapping, filter->mapping_size);
+  }
+  free(filter->pending);
   free(filter);
 }
 
 void taf_clear(TAF* filter) {
   filter->nelts = 0;
-  free(filter->blocks);
-  free(filter->remote);
+  filter->npending = 0;
+  free_blocks(filter);
   filter->blocks = calloc(filter->nblocks, sizeof(TAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(Remote_elt));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+}
+
+/**
+ * Re-encode the filter's selectors with `codec`, and use it from now on.
+ * @return 0 on success, or -1 if some block's selectors don't fit in
+ * `codec`'s codes, in which case the filter is unchanged.
+ */
+int taf_set_codec(TAF *filter, const SelCodec *codec) {
+  uint64_t *codes = malloc(filter->nblocks * sizeof(uint64_t));
+  if (codes == NULL) {
+    printf("taf_set_codec failed to allocate codes for %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  int sels[64];
+  for (size_t i=0; i < filter->nblocks; i++) {
+    filter->codec->decode(get_sel_code(filter, i), sels);
+    if (codec->encode(sels, &codes[i]) == -1) {
+      free(codes);
+      return -1;
+    }
+  }
+  for (size_t i=0; i < filter->nblocks; i++) {
+    set_sel_code(filter, i, codes[i]);
+  }
+  filter->codec = codec;
+  free(codes);
+  return 0;
+}
+
+/**
+ * Save the filter to `path`: its blocks, then its remote's elements and
+ * hashes (only elements if the remote has no fetch_hash).  Adaptations
+ * still queued by taf_defer_adaptations aren't saved.
+ * @return 0 on success, -1 if the file couldn't be written or the remote
+ * can't fetch its elements.
+ */
+int taf_save(const TAF *filter, const char *path) {
+  if (filter->remote.ops->fetch == NULL) {
+    return -1;
+  }
+  int with_hashes = filter->remote.ops->fetch_hash != NULL;
+  SerialHeader header;
+  memset(&header, 0, sizeof(header));
+  header.kind = SERIAL_TAF;
+  header.block_size = sizeof(TAFBlock);
+  header.p = filter->p;
+  header.q = filter->q;
+  header.r = filter->r;
+  header.nslots = filter->nslots;
+  header.nblocks = filter->nblocks;
+  header.nelts = filter->nelts;
+  header.seed = filter->seed;
+  header.mode = filter->mode;
+  header.codec = filter->codec->id;
+  header.remote_slot_size = with_hashes ? sizeof(Remote_elt) : sizeof(elt_t);
+  FILE *file = serial_create(path, &header);
+  if (file == NULL) {
+    return -1;
+  }
+  fwrite(filter->blocks, sizeof(TAFBlock), filter->nblocks, file);
+  for (size_t i=0; i < filter->nslots; i++) {
+    Remote_elt slot;
+    slot.elt = remote_fetch(&filter->remote, i);
+    slot.hash = with_hashes ? remote_fetch_hash(&filter->remote, i) : 0;
+    fwrite(&slot, header.remote_slot_size, 1, file);
+  }
+  return serial_close(file);
+}
+
+/**
+ * Initialize a filter from one saved by taf_save, using the file itself as
+ * the filter's blocks and remote slots instead of reading them in.  The file
+ * is mapped copy-on-write: pages are read as the filter touches them, and
+ * changes to the filter never reach the file.  The blocks are copied out of
+ * the file when the filter first grows.  The filter keeps its remote in an
+ * array and isn't concurrent.
+ * @return 0 on success, -1 if the file couldn't be mapped or isn't a TAF
+ * saved by this build.
+ */
+int taf_load_mmap(TAF *filter, const char *path) {
+  SerialMap map;
+  if (serial_map(path, SERIAL_TAF, sizeof(TAFBlock), &map) != 0) {
+    return -1;
+  }
+  const SerialHeader *header = map.header;
+  const SelCodec *codec = sel_codec_by_id((int)header->codec);
+  if (header->r != REM_SIZE || codec == NULL ||
+      (header->remote_slot_size != sizeof(Remote_elt) &&
+       header->remote_slot_size != sizeof(elt_t))) {
+    serial_unmap(map.base, map.size);
+    return -1;
+  }
+  filter->p = header->p;
+  filter->q = header->q;
+  filter->r = header->r;
+  filter->nslots = header->nslots;
+  filter->nblocks = header->nblocks;
+  filter->nblocks_alloc = header->nblocks;
+  filter->nelts = header->nelts;
+  filter->seed = (int)header->seed;
+  filter->mode = (int)header->mode;
+  filter->codec = codec;
+  filter->blocks = map.blocks;
+  filter->blocks_mapped = 1;
+  filter->mapping = map.base;
+  filter->mapping_size = map.size;
+  filter->remote = new_array_remote_over(map.remote, filter->nslots,
+                                         header->remote_slot_size == sizeof(Remote_elt) ?
+                                         ARRAY_REMOTE_HASHES : 0);
+  filter->locks = NULL;
+  filter->defer_adapt = 0;
+  filter->pending = NULL;
+  filter->npending = 0;
+  filter->pending_alloc = 0;
+  return 0;
 }
 
 static void raw_insert(TAF* filter, elt_t elt, uint64_t hash) {
   size_t quot = calc_quot(filter, hash);
   rem_t rem = calc_rem(filter, hash, 0);
-  filter->nelts++;
+  // Concurrent inserts may run raw_insert in parallel on different regions
+  __atomic_add_fetch(&filter->nelts, 1, __ATOMIC_RELAXED);
 
   // Find the appropriate runend
   int r = rank_select(filter, quot);
@@ -480,8 +860,7 @@ static void raw_insert(TAF* filter, elt_t elt, uint64_t hash) {
       set_occupied(filter, quot);
       set_runend(filter, quot);
       remainder(filter, quot) = rem;
-      filter->remote[quot].elt = elt;
-      filter->remote[quot].hash = hash;
+      remote_store(&filter->remote, quot, elt, hash);
       break;
     }
     case RANK_SELECT_OVERFLOW: {
@@ -499,7 +878,8 @@ static void raw_insert(TAF* filter, elt_t elt, uint64_t hash) {
         add_block(filter);
         u = filter->nslots - 64;
       }
-      inc_offsets(filter, r+1, u-1);
+      // Offsets of blocks before quot's block target slots before r
+      inc_offsets(filter, r+1, u-1, quot/64);
       shift_rems_and_runends(filter, r + 1, (int)u - 1);
       shift_remote_elts(filter, r + 1, (int)u - 1);
       shift_sels(filter, r + 1, (int)u - 1);
@@ -507,69 +887,968 @@ static void raw_insert(TAF* filter, elt_t elt, uint64_t hash) {
       // Start a new run or extend an existing one
       if (get_occupied(filter, quot)) {
         // quot occupied: extend an existing run
-        inc_offsets(filter, r, r);
+        inc_offsets(filter, r, r, quot/64);
         unset_runend(filter, r);
       } else {
         // quot unoccupied: start a new run
         inc_offsets_for_new_run(filter, quot, r);
         set_occupied(filter, quot);
       }
-      set_runend(filter, r+1);
-      remainder(filter, r+1) = rem;
-      filter->remote[r+1].elt = elt;
-      filter->remote[r+1].hash = hash;
+      set_runend(filter, r+1);
+      remainder(filter, r+1) = rem;
+      remote_store(&filter->remote, r+1, elt, hash);
+    }
+  }
+}
+
+/**
+ * Remove the element at `loc` from the run for `quot`, shifting the rest of
+ * the cluster back by 1.  Inverse of `raw_insert`.
+ */
+static void raw_remove(TAF* filter, size_t quot, int loc) {
+  assert(quot <= loc && loc < filter->nslots);
+  filter->nelts--;
+
+  int end = removal_shift_end(filter, quot);
+  dec_offsets(filter, loc, end);
+  if (get_runend(filter, loc)) {
+    if (loc == quot || get_runend(filter, loc - 1)) {
+      // Removing the only element in the run
+      unset_occupied(filter, quot);
+    } else {
+      // Removing the last element: the run now ends one slot earlier
+      set_runend(filter, loc - 1);
+    }
+  }
+  unshift_rems_and_runends(filter, loc, end);
+  unshift_remote_elts(filter, loc, end);
+  unshift_sels(filter, loc, end);
+}
+
+/**
+ * Returns the location of the last fingerprint matching `hash` in the run for
+ * `quot` ending at `loc`, or -1 if there is none.  `loc` is the result of
+ * `rank_select(filter, quot)`.
+ *
+ * The run is scanned right to left, so each block's selectors are decoded
+ * only up to the first slot scanned in it.
+ */
+static int match_in_run(const TAF* filter, uint64_t hash, size_t quot, int loc) {
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return -1;
+  }
+  int decoded[64];
+  filter->codec->decode_upto(get_sel_code(filter, loc/64), loc%64, decoded);
+  // Check the runend before finding the run's start, as most runs are short
+  if (remainder(filter, loc) == calc_rem(filter, hash, decoded[loc%64])) {
+    return loc;
+  }
+  int start = run_start(filter, quot, loc);
+  for (loc--; loc >= start; loc--) {
+    // Decode the previous block's selectors on crossing into it
+    if (loc%64 == 63) {
+      filter->codec->decode(get_sel_code(filter, loc/64), decoded);
+    }
+    int sel = decoded[loc%64];
+    rem_t rem = calc_rem(filter, hash, sel);
+    if (remainder(filter, loc) == rem) {
+      return loc;
+    }
+  }
+  return -1;
+}
+
+static void defer_adaptation(TAF *filter, elt_t elt, uint64_t hash);
+
+/**
+ * Returns 1 if the run for `quot` ending at `loc` contains a fingerprint
+ * matching `hash`, adapting if the match is a false positive.
+ * `loc` is the result of `rank_select(filter, quot)`.
+ */
+static int probe_run(TAF* filter, elt_t elt, uint64_t hash, size_t quot, int loc) {
+  int match = match_in_run(filter, hash, quot, loc);
+  if (match < 0) {
+    return 0;
+  }
+  // Check remote
+  if (!remote_matches(&filter->remote, match, elt, hash)) {
+    if (filter->defer_adapt) {
+      defer_adaptation(filter, elt, hash);
+    } else {
+      adapt(filter, elt, match, quot, hash);
+    }
+  }
+  return 1;
+}
+
+static int raw_lookup(TAF* filter, elt_t elt, uint64_t hash) {
+  size_t quot = calc_quot(filter, hash);
+
+  if (get_occupied(filter, quot)) {
+    return probe_run(filter, elt, hash, quot, rank_select(filter, quot));
+  }
+  return 0;
+}
+
+/**
+ * Return 1 if word may be in the filter, without consulting the remote
+ * representation or adapting.  Callers that verify positives against their
+ * own store can report false positives with `taf_report_false_positive`.
+ */
+int taf_contains(const TAF *filter, elt_t elt) {
+  uint64_t hash = taf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  return match_in_run(filter, hash, quot, rank_select(filter, quot)) >= 0;
+}
+
+/**
+ * Adapt on `elt`, which the caller found to be a false positive.
+ * Adapting reads the remote elements in `elt`'s run, and does nothing if
+ * `elt` is stored there, so a mistaken report can't cause a false negative.
+ * In deferred mode, the report is queued like a lookup's false positive.
+ *
+ * Returns 1 if `elt` matched a fingerprint, 0 if it was a negative.
+ */
+int taf_report_false_positive(TAF *filter, elt_t elt) {
+  uint64_t hash = taf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  int match = match_in_run(filter, hash, quot, rank_select(filter, quot));
+  if (match < 0) {
+    return 0;
+  }
+  if (filter->defer_adapt) {
+    defer_adaptation(filter, elt, hash);
+  } else {
+    adapt(filter, elt, match, quot, hash);
+  }
+  return 1;
+}
+
+/**
+ * Return 1 if word is in the filter.
+ *
+ * Exits with 0 immediately if quot(word) is unoccupied.
+ * Otherwise, linear probes through the run to see if the
+ * run contains rem(word).
+ */
+int taf_lookup(TAF *filter, elt_t elt) {
+  uint64_t hash = taf_hash(filter, elt);
+  return raw_lookup(filter, elt, hash);
+}
+
+/** Stages of a batched lookup: each starts by reading memory that the
+    previous stage prefetched */
+enum lookup_stage {
+  LOOKUP_HOME,                  /* read the home block */
+  LOOKUP_RANK_SELECT,           /* read the next block of rank_select */
+  LOOKUP_PROBE,                 /* read the run */
+  LOOKUP_REMOTE,                /* read the remote element of the match */
+};
+
+/**
+ * One of the lookups that `taf_lookup_batch` or `taf_contains_batch` has in
+ * flight.
+ */
+typedef struct lookup_lane_t {
+  size_t i;                     /* index of the key in the batch */
+  elt_t elt;
+  uint64_t hash;
+  size_t quot;
+  int loc;                      /* end of the run, once found */
+  int match;                    /* matching slot, once found */
+  enum lookup_stage stage;
+  RankSelectState rank_select;
+} LookupLane;
+
+static void start_lookup(const TAF *filter, LookupLane *lane, size_t i, elt_t elt) {
+  lane->i = i;
+  lane->elt = elt;
+  lane->hash = taf_hash(filter, elt);
+  lane->quot = calc_quot(filter, lane->hash);
+  lane->stage = LOOKUP_HOME;
+  prefetch(&block_containing(filter, lane->quot));
+}
+
+/**
+ * Runs `lane`'s current stage, and the next ones while they only read the
+ * block it read, then prefetches what the next stage reads.
+ * Returns 0 or 1 if the lookup finished, or -1 if it has more stages.
+ *
+ * `adapting` is `filter` for lookups that check matches against the remote
+ * and adapt like `taf_lookup`, or NULL for lookups that stop at a matching
+ * fingerprint like `taf_contains`.
+ */
+static int step_lookup(const TAF *filter, TAF *adapting, LookupLane *lane) {
+  int loc;
+  size_t read;                  /* the block this stage read */
+  switch (lane->stage) {
+    case LOOKUP_HOME:
+      if (!get_occupied(filter, lane->quot)) {
+        return 0;
+      }
+      loc = rank_select_start(filter, lane->quot, filter->nblocks, &lane->rank_select);
+      read = lane->quot/64;
+      if (loc == RANK_SELECT_PENDING && lane->rank_select.block_i == read) {
+        // The runend is usually in the home block, which is now cached
+        loc = rank_select_resume(filter, &lane->rank_select, filter->nblocks);
+      }
+      break;
+    case LOOKUP_RANK_SELECT:
+      read = lane->rank_select.block_i;
+      loc = rank_select_resume(filter, &lane->rank_select, filter->nblocks);
+      break;
+    case LOOKUP_PROBE: {
+      lane->match = match_in_run(filter, lane->hash, lane->quot, lane->loc);
+      if (lane->match < 0 || !adapting) {
+        return lane->match >= 0;
+      }
+      lane->stage = LOOKUP_REMOTE;
+      remote_prefetch(&filter->remote, lane->match);
+      return -1;
+    }
+    case LOOKUP_REMOTE:
+      if (remote_matches(&filter->remote, lane->match, lane->elt, lane->hash)) {
+        return 1;
+      }
+      // A false positive: match again to adapt, as another lookup in the
+      // batch may have adapted the run since (its blocks are still cached)
+      return probe_run(adapting, lane->elt, lane->hash, lane->quot, lane->loc);
+  }
+  if (loc == RANK_SELECT_PENDING) {
+    lane->stage = LOOKUP_RANK_SELECT;
+    prefetch(&filter->blocks[lane->rank_select.block_i]);
+    return -1;
+  }
+  if (loc < 0) {
+    return 0;
+  }
+  lane->loc = loc;
+  lane->stage = LOOKUP_PROBE;
+  if ((size_t)loc/64 == read) {
+    return step_lookup(filter, adapting, lane);
+  }
+  prefetch(&block_containing(filter, loc));
+  return -1;
+}
+
+/**
+ * Runs the lookups of `elts`, writing their results to `out`, with `adapting`
+ * as in `step_lookup`.
+ *
+ * Keeps `LOOKUP_BATCH` lookups in flight, each a small state machine that
+ * stops at every cache miss it may take (the home block, each block
+ * `rank_select` reads past it, the block holding the runend, and the remote
+ * element of the match), prefetches it, and yields to the next lookup.  By
+ * the time a lookup is resumed its memory has usually arrived, so the misses
+ * of up to `LOOKUP_BATCH` lookups overlap.  A finished lookup's lane is
+ * refilled with the next key.  Adapting doesn't move runends, so lookups in
+ * flight stay valid when another one adapts.
+ */
+static void run_lookups(const TAF *filter, TAF *adapting, const elt_t *elts, size_t n,
+                        uint8_t *out) {
+  LookupLane lanes[LOOKUP_BATCH];
+  size_t nlanes = min(LOOKUP_BATCH, n);
+  size_t next = 0;
+  for (; next < nlanes; next++) {
+    start_lookup(filter, &lanes[next], next, elts[next]);
+  }
+  size_t active = nlanes;
+  while (active > 0) {
+    for (size_t j=0; j < nlanes; j++) {
+      LookupLane *lane = &lanes[j];
+      if (lane->i == SIZE_MAX) {
+        continue;
+      }
+      int result = step_lookup(filter, adapting, lane);
+      if (result < 0) {
+        continue;
+      }
+      out[lane->i] = result;
+      if (next < n) {
+        start_lookup(filter, lane, next, elts[next]);
+        next++;
+      } else {
+        lane->i = SIZE_MAX;
+        active--;
+      }
+    }
+  }
+}
+
+/**
+ * Look up `n` elements, writing 1 to `out[i]` if `elts[i]` is in the filter
+ * and 0 otherwise.  Adapts on false positives like `taf_lookup`, overlapping
+ * the cache misses of different elements (see `run_lookups`).
+ */
+void taf_lookup_batch(TAF *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  run_lookups(filter, filter, elts, n, out);
+}
+
+/**
+ * Like `taf_lookup_batch`, but with the results of `taf_contains`: never
+ * reads the remote or adapts, so it doesn't modify the filter.
+ */
+void taf_contains_batch(const TAF *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  run_lookups(filter, NULL, elts, n, out);
+}
+
+/** Arguments of `contains_chunk_task` */
+typedef struct parallel_lookup_t {
+  const TAF *filter;
+  const elt_t *elts;
+  size_t n;
+  uint64_t *bits;
+} ParallelLookup;
+
+/** Packs `n` results, 1 per byte, into bits, 64 per word */
+static void pack_results(const uint8_t *out, size_t n, uint64_t *bits) {
+  for (size_t w=0; w < (n + 63)/64; w++) {
+    uint64_t word = 0;
+    for (size_t j=0; j < 64 && w*64 + j < n; j++) {
+      word |= (uint64_t)out[w*64 + j] << j;
+    }
+    bits[w] = word;
+  }
+}
+
+/** Look up the `task`th chunk of `LOOKUP_PARALLEL_CHUNK` keys */
+static void contains_chunk_task(void *arg, size_t task) {
+  ParallelLookup *lookup = arg;
+  size_t start = task * LOOKUP_PARALLEL_CHUNK;
+  size_t n = min(LOOKUP_PARALLEL_CHUNK, lookup->n - start);
+  uint8_t out[LOOKUP_PARALLEL_CHUNK];
+  taf_contains_batch(lookup->filter, lookup->elts + start, n, out);
+  pack_results(out, n, lookup->bits + start/64);
+}
+
+/**
+ * Like `taf_contains_batch`, but splits the elements across the threads of
+ * `pool`, and sets bit i%64 of `bits[i/64]` to whether `elts[i]` may be in the
+ * filter.  `bits` holds (n+63)/64 words.
+ *
+ * Each task looks up `LOOKUP_PARALLEL_CHUNK` elements, a multiple of 64, so
+ * tasks write separate words of `bits`.  Lookups only read the filter, so
+ * they need no locks, but the filter must not change during the call.
+ */
+void taf_contains_parallel(const TAF *filter, Pool *pool, const elt_t *elts,
+                           size_t n, uint64_t *bits) {
+  ParallelLookup lookup = {filter, elts, n, bits};
+  pool_run(pool, contains_chunk_task, &lookup,
+           (n + LOOKUP_PARALLEL_CHUNK - 1)/LOOKUP_PARALLEL_CHUNK);
+}
+
+void taf_insert(TAF *filter, elt_t elt) {
+  uint64_t hash = taf_hash(filter, elt);
+  raw_insert(filter, elt, hash);
+}
+
+/* Deferred adaptation */
+
+/**
+ * Queue a false positive on `elt` to be fixed by `taf_flush_adaptations`.
+ *
+ * Events hold the query rather than the slot it matched, since inserts and
+ * removes may move the slot before the queue is flushed.  If the queue is
+ * full, the event is dropped: the false positive will be queued again the
+ * next time it occurs.
+ */
+static void defer_adaptation(TAF *filter, elt_t elt, uint64_t hash) {
+  if (filter->npending == ADAPT_QUEUE_MAX) {
+    return;
+  }
+  if (filter->npending == filter->pending_alloc) {
+    size_t pending_alloc = max(64, filter->pending_alloc * 2);
+    AdaptEvent *pending = realloc(filter->pending, pending_alloc * sizeof(AdaptEvent));
+    if (pending == NULL) {
+      printf("defer_adaptation failed to grow the queue to %lu events\n", pending_alloc);
+      exit(1);
+    }
+    filter->pending = pending;
+    filter->pending_alloc = pending_alloc;
+  }
+  AdaptEvent *event = &filter->pending[filter->npending++];
+  event->elt = elt;
+  event->hash = hash;
+}
+
+/**
+ * The decoded selectors of one block, which are re-encoded only once all
+ * the adaptations to the block are applied.
+ */
+typedef struct sel_cache_t {
+  int64_t block;                /* block whose selectors are cached, or -1 */
+  int sels[64];
+  uint64_t bumped;              /* slots whose selectors were changed */
+} SelCache;
+
+/**
+ * Encode the cached selectors into their block.  If they can't be encoded,
+ * rebuild the block as `adapt_loc` does, but keep as many of the cached
+ * changes as can still be encoded.  One flush can bump more selectors in a
+ * block than the codec fits; the changes that don't fit are dropped, and
+ * their false positives are queued again when they recur.
+ */
+static void commit_sels(TAF *filter, SelCache *cache) {
+  if (cache->block < 0 || cache->bumped == 0) {
+    cache->block = -1;
+    return;
+  }
+  uint64_t code;
+  if (filter->codec->encode(cache->sels, &code) == -1) {
+    // Reset all remainders and selectors in block
+    TAFBlock *b = &filter->blocks[cache->block];
+    size_t b_start = cache->block * 64;
+    int kept[64] = {0};
+    for (int i=0; i<64; i++) {
+      b->remainders[i] = calc_rem(filter, stored_hash(filter, b_start + i), 0);
+    }
+    // Reapply changed selectors one at a time while they still encode
+    code = 0;
+    for (int i=0; i<64; i++) {
+      if (!(cache->bumped & ONE(i))) {
+        continue;
+      }
+      kept[i] = cache->sels[i];
+      uint64_t kept_code;
+      if (filter->codec->encode(kept, &kept_code) == -1) {
+        kept[i] = 0;
+      } else {
+        code = kept_code;
+        b->remainders[i] = calc_rem(filter, stored_hash(filter, b_start + i), kept[i]);
+      }
+    }
+  }
+  set_sel_code(filter, cache->block, code);
+  cache->block = -1;
+}
+
+/**
+ * Returns the cached selectors of `block`, committing those of the
+ * previously cached block first.
+ */
+static int *cached_sels(TAF *filter, SelCache *cache, size_t block) {
+  if (cache->block != (int64_t)block) {
+    commit_sels(filter, cache);
+    filter->codec->decode(get_sel_code(filter, block), cache->sels);
+    cache->block = (int64_t)block;
+    cache->bumped = 0;
+  }
+  return cache->sels;
+}
+
+/**
+ * Apply a queued false positive: the same fix as `adapt`, but with
+ * selector changes left in `cache` instead of encoded right away.
+ */
+static void apply_adaptation(TAF *filter, const AdaptEvent *event, SelCache *cache) {
+  size_t quot = calc_quot(filter, event->hash);
+  if (!get_occupied(filter, quot)) {
+    return;
+  }
+  int loc = rank_select(filter, quot);
+  if (loc < 0) {
+    return;
+  }
+  // Find the last fingerprint in the run that still matches the query
+  int start = run_start(filter, quot, loc);
+  int match = -1;
+  for (int i=loc; i>=start; i--) {
+    int *sels = cached_sels(filter, cache, i/64);
+    if (remainder(filter, i) == calc_rem(filter, event->hash, sels[i%64])) {
+      match = i;
+      break;
+    }
+  }
+  if (match < 0) {
+    return;
+  }
+  // Make sure the query elt isn't mapped to an earlier index in the sequence
+  for (int i=match; i>=start; i--) {
+    if (remote_matches(&filter->remote, i, event->elt, event->hash)) {
+      return;
+    }
+  }
+  // Adapt on all collisions in the run
+  for (int i=match; i>=start; i--) {
+    int *sels = cached_sels(filter, cache, i/64);
+    if (remainder(filter, i) == calc_rem(filter, event->hash, sels[i%64])) {
+      int new_sel = (sels[i%64] + 1) % MAX_SELECTOR;
+      sels[i%64] = new_sel;
+      cache->bumped |= ONE(i%64);
+      remainder(filter, i) = calc_rem(filter, stored_hash(filter, i), new_sel);
+    }
+  }
+}
+
+static int cmp_events(const void *a, const void *b) {
+  const AdaptEvent *x = a;
+  const AdaptEvent *y = b;
+  if (x->quot != y->quot) {
+    return x->quot < y->quot ? -1 : 1;
+  }
+  return x->elt < y->elt ? -1 : x->elt > y->elt;
+}
+
+/**
+ * Fix the false positives queued by lookups since the last flush.
+ *
+ * Events are sorted by quotient, so the events for a block are applied
+ * together and the block's selectors are decoded and encoded once per
+ * flush instead of once per false positive.
+ */
+void taf_flush_adaptations(TAF *filter) {
+  size_t n = filter->npending;
+  AdaptEvent *events = filter->pending;
+  for (size_t i=0; i<n; i++) {
+    events[i].quot = calc_quot(filter, events[i].hash);
+  }
+  qsort(events, n, sizeof(AdaptEvent), cmp_events);
+  if (filter->mode == TAF_MODE_NORMAL) {
+    SelCache cache;
+    cache.block = -1;
+    for (size_t i=0; i<n; i++) {
+      apply_adaptation(filter, &events[i], &cache);
+    }
+    commit_sels(filter, &cache);
+  } else {
+    for (size_t i=0; i<n; i++) {
+      size_t quot = events[i].quot;
+      if (!get_occupied(filter, quot)) {
+        continue;
+      }
+      int loc = rank_select(filter, quot);
+      int match = match_in_run(filter, events[i].hash, quot, loc);
+      if (match >= 0 && !remote_matches(&filter->remote, match, events[i].elt, events[i].hash)) {
+        adapt(filter, events[i].elt, match, quot, events[i].hash);
+      }
+    }
+  }
+  filter->npending = 0;
+}
+
+/**
+ * Turn deferred adaptation on or off.  While it's on, lookups that hit a
+ * false positive queue it instead of adapting, so a lookup never re-encodes
+ * a block; `taf_flush_adaptations` applies the queued fixes.  Turning it off
+ * flushes the queue.  Not supported on concurrent filters.
+ */
+void taf_defer_adaptations(TAF *filter, int defer) {
+  if (filter->locks != NULL) {
+    printf("taf_defer_adaptations: not supported on concurrent filters\n");
+    exit(1);
+  }
+  if (!defer) {
+    taf_flush_adaptations(filter);
+  }
+  filter->defer_adapt = defer;
+}
+
+/**
+ * Remove one copy of `elt` from the filter.
+ *
+ * The slot to remove is found using the remote representation, so only
+ * `elt`'s own fingerprint is removed, never a colliding one.
+ *
+ * Returns 1 if `elt` was found and removed, 0 otherwise.
+ */
+int taf_remove(TAF *filter, elt_t elt) {
+  uint64_t hash = taf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  int loc = rank_select(filter, quot);
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return 0;
+  }
+  int start = run_start(filter, quot, loc);
+  for (; loc >= start; loc--) {
+    if (remote_matches(&filter->remote, loc, elt, hash)) {
+      raw_remove(filter, quot, loc);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Concurrent operations */
+
+/**
+ * Stores `rank_select(filter, quot)` in `loc`, reading only blocks in
+ * [quot/64, last_block].
+ *
+ * Returns 0 if the result lies past `last_block` (so more blocks need to be
+ * locked), and 1 otherwise.
+ */
+static int runend_within(const TAF* filter, size_t quot, size_t last_block, int *loc) {
+  *loc = rank_select_upto(filter, quot, last_block + 1);
+  return *loc != RANK_SELECT_OVERFLOW || last_block == filter->nblocks - 1;
+}
+
+/**
+ * Checks whether `raw_insert` for `quot` only touches blocks in
+ * [quot/64, last_block], reading only those blocks.
+ *
+ * Returns 1 if so, 0 if it reaches past `last_block`, and -1 if it may need
+ * to add a block.
+ */
+static int insert_within(const TAF* filter, size_t quot, size_t last_block) {
+  int at_end = last_block == filter->nblocks - 1;
+  int r = rank_select_upto(filter, quot, last_block + 1);
+  if (r == RANK_SELECT_OVERFLOW) {
+    return at_end ? -1 : 0;
+  } else if (r == RANK_SELECT_EMPTY) {
+    return 1;
+  }
+  int u = first_unused_upto(filter, r+1, last_block + 1);
+  if (u == NO_UNUSED) {
+    return at_end ? -1 : 0;
+  }
+  return 1;
+}
+
+/**
+ * Initialize a filter that supports `taf_insert_concurrent` and
+ * `taf_lookup_concurrent`.
+ */
+void taf_init_concurrent(TAF *filter, size_t n, int seed) {
+  taf_init_remote(filter, n, seed,
+                  new_array_remote(0, (REMOTE_KEYS_ONLY ? 0 : ARRAY_REMOTE_HASHES) |
+                                   ARRAY_REMOTE_CONCURRENT));
+  filter->locks = new_region_locks(filter->nblocks);
+  // Leave room for overflow blocks up front, so that add_block rarely has
+  // to retire the blocks
+  filter->nblocks_alloc = grown_nblocks(filter->nblocks);
+  filter->blocks = realloc(filter->blocks, filter->nblocks_alloc * sizeof(TAFBlock));
+  if (filter->blocks == NULL) {
+    printf("taf_init_concurrent failed to allocate %lu blocks\n", filter->nblocks_alloc);
+    exit(1);
+  }
+}
+
+/**
+ * Look up `elt` without taking any locks or adapting, storing whether it
+ * matched in `found` and whether the match was a false positive in
+ * `adapt_needed`.
+ *
+ * Reads from a snapshot of the filter's header, taken after the block count
+ * so that the snapshot's arrays are at least that long even if add_block
+ * replaces them.  Returns 0 if a writer may have changed what was read, in
+ * which case the outputs are meaningless.
+ */
+static int lookup_optimistic(const TAF *filter, elt_t elt, uint64_t hash,
+                             int *found, int *adapt_needed) {
+  RegionLocks *locks = filter->locks;
+  size_t quot = calc_quot(filter, hash);
+  uint64_t versions[OPTIMISTIC_READ_REGIONS + 1];
+  size_t lo = region_of(locks, quot/64);
+  for (size_t hi = min(lo + 1, locks->nregions - 1);
+       hi < locks->nregions && hi - lo < OPTIMISTIC_READ_REGIONS; hi++) {
+    if (!read_regions_begin(locks, lo, hi, versions)) {
+      return 0;
+    }
+    TAF snapshot = *filter;
+    snapshot.nblocks = __atomic_load_n(&filter->nblocks, __ATOMIC_ACQUIRE);
+    snapshot.nslots = snapshot.nblocks * 64;
+    snapshot.blocks = __atomic_load_n(&filter->blocks, __ATOMIC_RELAXED);
+
+    int loc;
+    int ok = runend_within(&snapshot, quot, region_last_block(locks, hi, snapshot.nblocks), &loc);
+    int match = -1;
+    int fp = 0;
+    if (ok && get_occupied(&snapshot, quot)) {
+      match = match_in_run(&snapshot, hash, quot, loc);
+      fp = match >= 0 && !remote_matches(&filter->remote, match, elt, hash);
+    }
+    if (!read_regions_validate(locks, lo, hi, versions)) {
+      return 0;
+    }
+    if (ok) {
+      *found = match >= 0;
+      *adapt_needed = fp;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Thread-safe `taf_lookup`.
+ *
+ * Reads optimistically first, retrying if an insert changed the regions
+ * being read, so lookups usually neither wait on inserts nor write to any
+ * shared lock.  Under heavy contention, falls back to shared locks on the
+ * regions from quot's block to its runend.  A false positive has to adapt,
+ * which writes to the run, so in that case the lookup is repeated under
+ * exclusive locks.  Optimistic reads need a remote whose fetch is safe
+ * without locks; other remotes always take the locks.
+ */
+int taf_lookup_concurrent(TAF *filter, elt_t elt) {
+  RegionLocks *locks = filter->locks;
+  uint64_t hash = taf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+
+  int found = 0;
+  int exclusive = 0;
+  int retries = filter->remote.concurrent_fetch ? OPTIMISTIC_READ_RETRIES : 0;
+  for (int i=0; i<retries; i++) {
+    if (lookup_optimistic(filter, elt, hash, &found, &exclusive)) {
+      if (!exclusive) {
+        return found;
+      }
+      break;
+    }
+  }
+  lock_resize(locks, 0);
+  size_t lo = region_of(locks, quot/64);
+  size_t hi = min(lo + 1, locks->nregions - 1);
+  // The last region always suffices, so this terminates
+  while (1) {
+    lock_regions(locks, lo, hi, exclusive);
+    int loc;
+    int ok = runend_within(filter, quot, region_last_block(locks, hi, filter->nblocks), &loc);
+    int adapt_needed = 0;
+    found = 0;
+    if (ok && get_occupied(filter, quot)) {
+      if (exclusive) {
+        found = probe_run(filter, elt, hash, quot, loc);
+      } else {
+        int match = match_in_run(filter, hash, quot, loc);
+        found = match >= 0;
+        adapt_needed = found && !remote_matches(&filter->remote, match, elt, hash);
+      }
+    }
+    unlock_regions(locks, lo, hi, exclusive);
+    if (!ok) {
+      hi++;
+    } else if (adapt_needed) {
+      exclusive = 1;
+    } else {
+      break;
     }
   }
+  unlock_resize(locks, 0);
+  return found;
 }
 
-static int raw_lookup(TAF* filter, elt_t elt, uint64_t hash) {
+/**
+ * Thread-safe `taf_insert`.
+ *
+ * Takes exclusive locks on the regions from quot's block through the first
+ * unused slot after its run, starting with two regions and retrying with
+ * more if the insert's shift reaches past them.  Inserts that need to add a
+ * block take the whole filter.
+ */
+void taf_insert_concurrent(TAF *filter, elt_t elt) {
+  RegionLocks *locks = filter->locks;
+  uint64_t hash = taf_hash(filter, elt);
   size_t quot = calc_quot(filter, hash);
 
-  if (get_occupied(filter, quot)) {
-    int loc = rank_select(filter, quot);
-    if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
-      return 0;
+  lock_resize(locks, 0);
+  size_t lo = region_of(locks, quot/64);
+  for (size_t hi = min(lo + 1, locks->nregions - 1); hi < locks->nregions; hi++) {
+    lock_regions(locks, lo, hi, 1);
+    int within = insert_within(filter, quot, region_last_block(locks, hi, filter->nblocks));
+    if (within == 1) {
+      raw_insert(filter, elt, hash);
     }
-    // Cache decoded selectors
-    int decoded[64];
-    int decoded_i = -1;
-    do {
-      // Refresh cached code
-      if (decoded_i != loc/64) {
-        decoded_i = loc/64;
-        uint64_t code = get_sel_code(filter, loc/64);
-        decode_sel(code, decoded);
-      }
-      int sel = decoded[loc%64];
-      rem_t rem = calc_rem(filter, hash, sel);
-      if (remainder(filter, loc) == rem) {
-        // Check remote
-        if (elt != filter->remote[loc].elt) {
-          adapt(filter, elt, loc, quot, hash, decoded);
-        }
-        return 1;
+    unlock_regions(locks, lo, hi, 1);
+    if (within == 1) {
+      unlock_resize(locks, 0);
+      return;
+    } else if (within == -1) {
+      break;
+    }
+  }
+  // The insert may add a block: take the whole filter
+  unlock_resize(locks, 0);
+  lock_resize(locks, 1);
+  raw_insert(filter, elt, hash);
+  unlock_resize(locks, 1);
+}
+
+/* Bulk construction */
+
+/**
+ * Set the offsets of blocks in [*next_block, end) during a bulk build.
+ * `runend` is the runend of the last run whose quotient is at or before the
+ * start of each of these blocks, or -1 if there is no such run.
+ */
+static void set_bulk_offsets(TAF *filter, size_t *next_block, size_t end, int64_t runend) {
+  for (; *next_block < end; (*next_block)++) {
+    int64_t b_start = (int64_t)(*next_block * 64);
+    // A run ending before the block start leaves the offset negative
+    filter->blocks[*next_block].offset = runend >= b_start ? (size_t)(runend - b_start) : 0;
+  }
+}
+
+/**
+ * Write elements sorted by quotient into a cleared filter in a single
+ * left-to-right pass: each run starts at its quotient or right after the
+ * previous run, whichever is later.  `run_ends[quot]` is one past the index
+ * of the last element of run `quot` in `sorted`.  All selectors are 0.
+ */
+static void bulk_write(TAF *filter, const Remote_elt *sorted, const size_t *run_ends, size_t n) {
+  size_t nquots = ONE(filter->q);
+  filter->nelts = n;
+  size_t next_block = 0;   // first block whose offset hasn't been set
+  size_t loc = 0;          // first slot not used by a run
+  int64_t runend = -1;     // runend of the last run written
+  size_t i = 0;            // next element to write
+  for (size_t quot=0; quot<nquots; quot++) {
+    if (i == run_ends[quot]) {
+      continue;
+    }
+    // Blocks starting before quot follow the previous run
+    set_bulk_offsets(filter, &next_block, (quot + 63)/64, runend);
+    loc = max(loc, quot);
+    set_occupied(filter, quot);
+    for (; i < run_ends[quot]; i++, loc++) {
+      if (loc >= filter->nslots) {
+        add_block(filter);
       }
-      loc--;
-    } while (loc >= (int)quot && !get_runend(filter, loc));
+      remainder(filter, loc) = calc_rem(filter, sorted[i].hash, 0);
+      remote_store(&filter->remote, loc, sorted[i].elt, sorted[i].hash);
+    }
+    runend = (int64_t)loc - 1;
+    set_runend(filter, runend);
   }
-  return 0;
+  set_bulk_offsets(filter, &next_block, filter->nblocks, runend);
 }
 
 /**
- * Return 1 if word is in the filter.
+ * Stably counting-sort `n` elements by quotient.  Fills `run_ends[0..2^q]` as
+ * expected by `bulk_write`.
+ */
+static void sort_by_quot(const TAF *filter, const Remote_elt *elts, size_t n,
+                         Remote_elt *sorted, size_t *run_ends) {
+  size_t nquots = ONE(filter->q);
+  memset(run_ends, 0, (nquots + 1) * sizeof(size_t));
+  // Count run lengths, then turn counts into the index of each run in `sorted`
+  for (size_t i=0; i<n; i++) {
+    run_ends[calc_quot(filter, elts[i].hash) + 1]++;
+  }
+  for (size_t quot=0; quot<nquots; quot++) {
+    run_ends[quot + 1] += run_ends[quot];
+  }
+  // Placing each element advances run_ends[quot] from the start to the end of run quot
+  for (size_t i=0; i<n; i++) {
+    size_t j = run_ends[calc_quot(filter, elts[i].hash)]++;
+    sorted[j] = elts[i];
+  }
+}
+
+/**
+ * Replace the contents of the filter with the `n` elements in `elts`.
  *
- * Exits with 0 immediately if quot(word) is unoccupied.
- * Otherwise, linear probes through the run to see if the
- * run contains rem(word).
+ * Elements are hashed and counting-sorted by quotient, then written out in
+ * one linear pass.  This avoids the per-element rank/select and shifting done
+ * by `taf_insert`.  Elements with the same quotient keep their relative order,
+ * so the result is identical to inserting `elts` in order into an empty
+ * filter.
  */
-int taf_lookup(TAF *filter, elt_t elt) {
-  uint64_t hash = taf_hash(filter, elt);
-  return raw_lookup(filter, elt, hash);
+void taf_build_bulk(TAF *filter, const elt_t *elts, size_t n) {
+  size_t nquots = ONE(filter->q);
+  Remote_elt *hashed = malloc(max(n, 1) * sizeof(Remote_elt));
+  Remote_elt *sorted = malloc(max(n, 1) * sizeof(Remote_elt));
+  size_t *run_ends = malloc((nquots + 1) * sizeof(size_t));
+  if (hashed == NULL || sorted == NULL || run_ends == NULL) {
+    printf("taf_build_bulk failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  for (size_t i=0; i<n; i++) {
+    hashed[i].elt = elts[i];
+    hashed[i].hash = taf_hash(filter, elts[i]);
+  }
+  sort_by_quot(filter, hashed, n, sorted, run_ends);
+  free(hashed);
+
+  taf_clear(filter);
+  bulk_write(filter, sorted, run_ends, n);
+  free(sorted);
+  free(run_ends);
 }
 
-void taf_insert(TAF *filter, elt_t elt) {
-  uint64_t hash = taf_hash(filter, elt);
-  raw_insert(filter, elt, hash);
+/**
+ * Double the number of slots in the filter, rehashing every element into a
+ * filter with one more quotient bit using the hashes in the remote
+ * representation.
+ *
+ * Selectors are not carried over: remainders come from the hash bits after
+ * the quotient, which shift when the quotient grows, so an old selector no
+ * longer picks the remainder that fixed its false positive.  The expanded
+ * filter starts out with no adaptations.
+ *
+ * Returns 0 on success, or -1 (leaving the filter unchanged) if the hash is
+ * too short to supply a remainder after growing the quotient.
+ */
+int taf_expand(TAF *filter) {
+  if ((64 - (int)filter->q - 1)/(int)filter->r < 1) {
+    return -1;
+  }
+  // Remotes that don't keep whole elements can't rehash them
+  if (filter->remote.ops->fetch == NULL || filter->remote.hash_bits < 64) {
+    return -1;
+  }
+  size_t n = filter->nelts;
+  size_t nquots = 2 * ONE(filter->q);
+  Remote_elt *elts = malloc(max(n, 1) * sizeof(Remote_elt));
+  Remote_elt *sorted = malloc(max(n, 1) * sizeof(Remote_elt));
+  size_t *run_ends = malloc((nquots + 1) * sizeof(size_t));
+  if (elts == NULL || sorted == NULL || run_ends == NULL) {
+    printf("taf_expand failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  // Walk runs in quotient order, collecting elements
+  size_t i = 0;
+  size_t loc = 0;
+  for (size_t quot=0; quot < ONE(filter->q); quot++) {
+    if (!get_occupied(filter, quot)) {
+      continue;
+    }
+    loc = max(loc, quot);
+    int at_runend;
+    do {
+      elts[i].elt = remote_fetch(&filter->remote, loc);
+      elts[i].hash = stored_hash(filter, loc);
+      at_runend = get_runend(filter, loc) != 0;
+      i++;
+      loc++;
+    } while (!at_runend);
+  }
+  assert(i == n);
+
+  filter->q += 1;
+  sort_by_quot(filter, elts, n, sorted, run_ends);
+  free(elts);
+
+  free_blocks(filter);
+  filter->p = filter->q + filter->r;
+  filter->nslots = nquots;
+  filter->nblocks = nquots/64;
+  filter->blocks = calloc(filter->nblocks, sizeof(TAFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+  remote_resize(&filter->remote, filter->nslots);
+  if (filter->blocks == NULL) {
+    printf("taf_expand failed to allocate %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  bulk_write(filter, sorted, run_ends, n);
+  free(sorted);
+  free(run_ends);
+  // Regions are sized for the filter's original blocks
+  if (filter->locks != NULL) {
+    region_locks_destroy(filter->locks);
+    filter->locks = new_region_locks(filter->nblocks);
+  }
+  return 0;
 }
 
 double taf_load(TAF *filter) {
@@ -609,13 +1888,16 @@ void print_taf_block(TAF* filter, size_t block_index) {
   printf("  selector code=0x%lx\n", get_sel_code(filter, block_index));
   printf("  selectors=\n");
   int sels [64];
-  decode_sel(get_sel_code(filter, block_index), sels);
+  filter->codec->decode(get_sel_code(filter, block_index), sels);
   print_sels(sels);
+  if (filter->remote.ops->fetch == NULL) {
+    return;
+  }
   printf("  remote elts=\n");
   for (int i=0; i<8; i++) {
     printf("   ");
     for (int j=0; j<8; j++) {
-      printf(" 0x%-*lx", 8, filter->remote[block_index * 64 + i*8 + j].elt);
+      printf(" 0x%-*lx", 8, remote_fetch(&filter->remote, block_index * 64 + i*8 + j));
     }
     printf("\n");
   }
@@ -638,7 +1920,7 @@ void print_taf_stats(TAF* filter) {
   int sels[64];
   for (int i=0; i<filter->nslots; i++) {
     if (i%64 == 0) {
-      decode_sel(get_sel_code(filter, i/64), sels);
+      filter->codec->decode(get_sel_code(filter, i/64), sels);
     }
     sel_counts[sels[i%64]]++;
   }
@@ -653,6 +1935,8 @@ void print_taf_stats(TAF* filter) {
 //#define TEST_TAF 1
 #ifdef TEST_TAF
 
+#include <unistd.h>
+
 void print_backtrace() {
   void* callstack[128];
   int i, frames = backtrace(callstack, 128);
@@ -675,6 +1959,20 @@ void print_backtrace() {
     } while (0);                    \
   }
 
+/**
+ * Returns 1 if the remotes of `a` and `b` hold the same elements and hashes
+ * in slots [start, end).
+ */
+static int same_remote(const TAF *a, const TAF *b, size_t start, size_t end) {
+  for (size_t i=start; i<end; i++) {
+    if (remote_fetch(&a->remote, i) != remote_fetch(&b->remote, i) ||
+        remote_fetch_hash(&a->remote, i) != remote_fetch_hash(&b->remote, i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 #define TAF_SEED 32776517
 
 TAF *new_taf(size_t n) {
@@ -727,8 +2025,8 @@ void test_add_block() {
   }
   // Check remote rep
   for (int i=0; i<64; i++) {
-    assert_eq(filter->remote[128 + i].elt, 0);
-    assert_eq(filter->remote[128 + i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, 128 + i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, 128 + i), 0);
   }
   taf_destroy(filter);
   printf("passed.\n");
@@ -744,8 +2042,7 @@ void test_add_block_no_clobber() {
     set_occupied(filter, i);
     set_runend(filter, i);
     remainder(filter, i) = i%16;
-    filter->remote[i].elt = i;
-    filter->remote[i].hash = i;
+    remote_store(&filter->remote, i, i, i);
   }
   add_block(filter);
   // Check that data in first 2 blocks is preserved
@@ -753,16 +2050,16 @@ void test_add_block_no_clobber() {
     assert(get_occupied(filter, i));
     assert(get_runend(filter, i));
     assert_eq(remainder(filter, i), i%16);
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
   // Check that 3rd block is empty
   for (int i=128; i<filter->nslots; i++) {
     assert(!get_occupied(filter, i));
     assert(!get_runend(filter, i));
     assert_eq(remainder(filter, i), 0);
-    assert_eq(filter->remote[i].elt, 0);
-    assert_eq(filter->remote[i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, i), 0);
   }
   // Check filter metadata
   assert_eq(filter->nslots, 192);
@@ -889,28 +2186,27 @@ void test_shift_remote_elts() {
   printf("Testing %s...", __FUNCTION__);
   TAF *filter = new_taf(128);
   for (int i=0; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i].elt, 0);
-    assert_eq(filter->remote[i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, i), 0);
   }
   for (int i=0; i<filter->nslots; i++) {
-    filter->remote[i].elt = i;
-    filter->remote[i].hash = i;
+    remote_store(&filter->remote, i, i, i);
   }
   // Shift elts in [32, 64+32] to [33, 64+33]
   shift_remote_elts(filter, 32, 64+32);
   for (int i=0; i<=31; i++) {
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
-  assert_eq(filter->remote[32].elt, 0);
-  assert_eq(filter->remote[32].hash, 0);
+  assert_eq(remote_fetch(&filter->remote, 32), 0);
+  assert_eq(remote_fetch_hash(&filter->remote, 32), 0);
   for (int i=33; i<=64+33; i++) {
-    assert_eq(filter->remote[i].elt, i-1);
-    assert_eq(filter->remote[i].hash, i-1);
+    assert_eq(remote_fetch(&filter->remote, i), i-1);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i-1);
   }
   for (int i=64+34; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
   taf_destroy(filter);
   printf("passed.\n");
@@ -1083,6 +2379,696 @@ void test_insert_and_query_w_repeats() {
   printf("Done testing %s.\n", __FUNCTION__);
 }
 
+void test_lookup_batch() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 8;
+  // Build two identical filters: one queried in batches, one key at a time
+  TAF *batched = new_taf(n);
+  TAF *single = new_taf(n);
+  elt_t elts[2 * 64 * 8];
+  uint8_t out[2 * 64 * 8];
+  srandom(TAF_SEED);
+  for (size_t i=0; i<2*n; i++) {
+    elts[i] = random();
+    if (i < n * 9/10) {
+      taf_insert(batched, elts[i]);
+      taf_insert(single, elts[i]);
+    }
+  }
+  // Batch results (and adaptations) match single lookups
+  taf_lookup_batch(batched, elts, 2*n - 5, out);
+  for (size_t i=0; i<2*n - 5; i++) {
+    assert_eq(out[i], taf_lookup(single, elts[i]));
+    if (i < n * 9/10) {
+      assert_eq(out[i], 1);
+    }
+  }
+  for (size_t i=0; i<batched->nblocks; i++) {
+    assert_eq(memcmp(batched->blocks[i].sel_code, single->blocks[i].sel_code,
+                     SEL_CODE_BYTES), 0);
+  }
+  taf_destroy(batched);
+  taf_destroy(single);
+  printf("passed.\n");
+}
+
+void test_contains_parallel() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 128;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 2*n - 5;    // several chunks, ending with a partial word
+  TAF *filter = new_taf(n);
+  Pool *pool = new_pool(4);
+  elt_t *elts = malloc(nqueries * sizeof(elt_t));
+  uint64_t *bits = malloc((nqueries + 63)/64 * sizeof(uint64_t));
+  srandom(TAF_SEED);
+  for (size_t i=0; i<nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      taf_insert(filter, elts[i]);
+    }
+  }
+  TAFBlock *before = malloc(filter->nblocks_alloc * sizeof(TAFBlock));
+  memcpy(before, filter->blocks, filter->nblocks_alloc * sizeof(TAFBlock));
+  taf_contains_parallel(filter, pool, elts, nqueries, bits);
+  for (size_t i=0; i<nqueries; i++) {
+    assert_eq(GET(bits[i/64], i%64) != 0, taf_contains(filter, elts[i]));
+    if (i < nelts) {
+      assert_eq(GET(bits[i/64], i%64) != 0, 1);
+    }
+  }
+  // Bits past the last key are cleared
+  assert_eq(bits[nqueries/64] >> (nqueries%64), 0);
+  // Nothing adapted, even on false positives
+  assert_eq(memcmp(before, filter->blocks, filter->nblocks_alloc * sizeof(TAFBlock)), 0);
+  free(before);
+  free(bits);
+  free(elts);
+  pool_destroy(pool);
+  taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_deferred_adaptations() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 16 * n;
+  TAF *filter = new_taf(n);
+  srandom(TAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      taf_insert(filter, elts[i]);
+    }
+  }
+  elt_t *queries = elts + nelts;
+  // Lookups queue false positives without touching the blocks
+  TAFBlock *before = malloc(filter->nblocks * sizeof(TAFBlock));
+  memcpy(before, filter->blocks, filter->nblocks * sizeof(TAFBlock));
+  taf_defer_adaptations(filter, 1);
+  size_t fps = 0;
+  for (size_t i=0; i<nqueries; i++) {
+    fps += taf_lookup(filter, queries[i]);
+  }
+  assert(fps > 0);
+  assert_eq(filter->npending, fps);
+  assert_eq(memcmp(before, filter->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  // Flushing fixes the queued false positives without causing false negatives
+  taf_flush_adaptations(filter);
+  assert_eq(filter->npending, 0);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(filter, elts[i]));
+  }
+  size_t fps_after = 0;
+  for (size_t i=0; i<nqueries; i++) {
+    fps_after += taf_lookup(filter, queries[i]);
+  }
+  assert(fps_after < fps/10);
+  // Turning deferral off flushes the queue
+  taf_defer_adaptations(filter, 0);
+  assert_eq(filter->npending, 0);
+  assert(!filter->defer_adapt);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(filter, elts[i]));
+  }
+  // One flush can bump more selectors in a block than its code fits: the
+  // bumps that don't fit are dropped without losing members
+  TAF *small = new_taf(64 * 4);
+  size_t nsmall = small->nslots * 9/10;
+  for (size_t i=0; i<nsmall; i++) {
+    taf_insert(small, elts[i]);
+  }
+  taf_defer_adaptations(small, 1);
+  while (small->npending < 4 * 64) {
+    elt_t query = random();
+    if (calc_quot(small, taf_hash(small, query)) < 64) {
+      taf_lookup(small, query);
+    }
+  }
+  taf_flush_adaptations(small);
+  for (size_t i=0; i<nsmall; i++) {
+    assert(taf_lookup(small, elts[i]));
+  }
+  taf_destroy(small);
+  free(before);
+  free(elts);
+  taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_contains_and_report() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  TAF *filter = new_taf(n);
+  TAF *expected = new_taf(n);
+  srandom(TAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      taf_insert(filter, elts[i]);
+      taf_insert(expected, elts[i]);
+    }
+  }
+  // Contains finds every member without changing the filter
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_contains(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  // Reporting each positive adapts exactly as lookups do
+  size_t fps = 0;
+  for (size_t i=nelts; i<nelts + nqueries; i++) {
+    int found = taf_contains(filter, elts[i]);
+    if (found) {
+      assert(taf_report_false_positive(filter, elts[i]));
+      fps++;
+    } else {
+      assert(!taf_report_false_positive(filter, elts[i]));
+    }
+    assert_eq(found, taf_lookup(expected, elts[i]));
+  }
+  assert(fps > 0);
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  // Reporting a member is harmless
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_report_false_positive(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  free(elts);
+  taf_destroy(filter);
+  taf_destroy(expected);
+  printf("passed.\n");
+}
+
+/**
+ * The caller's store for hash32 remotes in tests: a set of decimal strings.
+ */
+typedef struct test_store_t {
+  Setnode *set;
+  int nset;
+} TestStore;
+
+static void test_store_insert(TestStore *store, elt_t elt) {
+  char str[64];
+  sprintf(str, "%lu", elt);
+  set_insert(str, (int)strlen(str), 0, store->set, store->nset);
+}
+
+static int test_store_contains(void *ctx, elt_t elt) {
+  TestStore *store = ctx;
+  char str[64];
+  sprintf(str, "%lu", elt);
+  return set_lookup(str, (int)strlen(str), store->set, store->nset);
+}
+
+void test_remote_backends() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  TestStore store;
+  store.nset = (int)n * 2;
+  store.set = calloc(store.nset, sizeof(Setnode));
+  TAF *full = new_taf(n);
+  TAF *keys = malloc(sizeof(TAF));
+  taf_init_remote(keys, n, TAF_SEED, new_array_remote(0, 0));
+  TAF *hashes = malloc(sizeof(TAF));
+  taf_init_remote(hashes, n, TAF_SEED, new_hash32_remote(0, test_store_contains, &store));
+  srandom(TAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      taf_insert(full, elts[i]);
+      taf_insert(keys, elts[i]);
+      taf_insert(hashes, elts[i]);
+      test_store_insert(&store, elts[i]);
+    }
+  }
+  // Keys-only remotes rehash keys, so they adapt exactly like full remotes
+  size_t fps = 0;
+  for (size_t i=nelts; i<nelts + nqueries; i++) {
+    int found = taf_lookup(full, elts[i]);
+    assert_eq(taf_lookup(keys, elts[i]), found);
+    fps += found;
+    taf_lookup(hashes, elts[i]);
+  }
+  assert(fps > 0);
+  assert_eq(memcmp(full->blocks, keys->blocks, full->nblocks * sizeof(TAFBlock)), 0);
+  // Hash32 remotes have no false negatives and still fix false positives
+  size_t fps_after = 0;
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(hashes, elts[i]));
+  }
+  for (size_t i=nelts; i<nelts + nqueries; i++) {
+    fps_after += taf_lookup(hashes, elts[i]);
+  }
+  assert(fps_after < fps/10);
+  for (size_t i=0; i<nelts/10; i++) {
+    assert(taf_remove(hashes, elts[i]));
+  }
+  assert_eq(hashes->nelts, nelts - nelts/10);
+  // Log remotes hold the same elements as arrays, through removes and reinserts
+  TAF *logged = malloc(sizeof(TAF));
+  taf_init_remote(logged, n, TAF_SEED, new_log_remote(0));
+  TAF *arrayed = new_taf(n);
+  for (size_t i=0; i<nelts; i++) {
+    taf_insert(logged, elts[i]);
+    taf_insert(arrayed, elts[i]);
+  }
+  for (size_t i=0; i<nelts/2; i++) {
+    assert(taf_remove(logged, elts[i]));
+    assert(taf_remove(arrayed, elts[i]));
+  }
+  for (size_t i=0; i<nelts/4; i++) {
+    taf_insert(logged, elts[i]);
+    taf_insert(arrayed, elts[i]);
+  }
+  assert(same_remote(logged, arrayed, 0, logged->nslots));
+  assert_eq(taf_expand(logged), 0);
+  assert_eq(taf_expand(arrayed), 0);
+  assert(same_remote(logged, arrayed, 0, logged->nslots));
+  assert_eq(memcmp(logged->blocks, arrayed->blocks, logged->nblocks * sizeof(TAFBlock)), 0);
+  taf_destroy(logged);
+  taf_destroy(arrayed);
+  // Only remotes with whole keys can expand
+  assert_eq(taf_expand(hashes), -1);
+  assert_eq(taf_expand(keys), 0);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(keys, elts[i]));
+  }
+  set_deallocate(store.set, store.nset);
+  free(elts);
+  taf_destroy(full);
+  taf_destroy(keys);
+  taf_destroy(hashes);
+  printf("passed.\n");
+}
+
+void test_save_and_load_mmap() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  TAF *filter = new_taf(n);
+  srandom(TAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      taf_insert(filter, elts[i]);
+    } else {
+      taf_lookup(filter, elts[i]);
+    }
+  }
+  char path[] = "/tmp/taf_save_XXXXXX";
+  close(mkstemp(path));
+  assert_eq(taf_save(filter, path), 0);
+  TAFBlock *saved = malloc(filter->nblocks * sizeof(TAFBlock));
+  memcpy(saved, filter->blocks, filter->nblocks * sizeof(TAFBlock));
+
+  // The loaded filter uses the file's blocks as they were saved
+  TAF *loaded = malloc(sizeof(TAF));
+  assert_eq(taf_load_mmap(loaded, path), 0);
+  assert(loaded->blocks_mapped);
+  assert_eq(loaded->q, filter->q);
+  assert_eq(loaded->nblocks, filter->nblocks);
+  assert_eq(loaded->nelts, filter->nelts);
+  assert_eq(loaded->seed, filter->seed);
+  assert_eq(memcmp(loaded->blocks, saved, filter->nblocks * sizeof(TAFBlock)), 0);
+  assert(same_remote(loaded, filter, 0, filter->nslots));
+
+  // Lookups and adaptations behave as in the original, and don't reach the file
+  srandom(TAF_SEED + 1);
+  for (size_t i=0; i<nqueries; i++) {
+    elt_t elt = random();
+    assert_eq(taf_lookup(loaded, elt), taf_lookup(filter, elt));
+  }
+  assert_eq(memcmp(loaded->blocks, filter->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  TAF *reloaded = malloc(sizeof(TAF));
+  assert_eq(taf_load_mmap(reloaded, path), 0);
+  assert_eq(memcmp(reloaded->blocks, saved, filter->nblocks * sizeof(TAFBlock)), 0);
+  taf_destroy(reloaded);
+
+  // Growing and expanding move the blocks out of the file
+  add_block(loaded);
+  add_block(filter);
+  assert(!loaded->blocks_mapped);
+  assert_eq(memcmp(loaded->blocks, filter->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  assert(same_remote(loaded, filter, 0, filter->nslots));
+  assert_eq(taf_expand(loaded), 0);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(loaded, elts[i]));
+  }
+
+  // Headers whose quotients index past the saved slots are rejected
+  TAF *bad = malloc(sizeof(TAF));
+  SerialHeader header;
+  FILE *file = fopen(path, "r+b");
+  assert_eq(fread(&header, sizeof(header), 1, file), 1);
+  SerialHeader corrupt = header;
+  corrupt.q += 8;
+  corrupt.p = corrupt.q + corrupt.r;
+  rewind(file);
+  assert_eq(fwrite(&corrupt, sizeof(corrupt), 1, file), 1);
+  fflush(file);
+  assert_eq(taf_load_mmap(bad, path), -1);
+  corrupt = header;
+  corrupt.p += 1;
+  rewind(file);
+  assert_eq(fwrite(&corrupt, sizeof(corrupt), 1, file), 1);
+  fflush(file);
+  assert_eq(taf_load_mmap(bad, path), -1);
+  rewind(file);
+  assert_eq(fwrite(&header, sizeof(header), 1, file), 1);
+  fclose(file);
+  assert_eq(taf_load_mmap(bad, path), 0);
+  taf_destroy(bad);
+
+  // Truncated and missing files are rejected
+  assert_eq(truncate(path, SERIAL_DATA_OFFSET + sizeof(TAFBlock)), 0);
+  bad = malloc(sizeof(TAF));
+  assert_eq(taf_load_mmap(bad, path), -1);
+  unlink(path);
+  assert_eq(taf_load_mmap(bad, path), -1);
+  free(bad);
+  free(saved);
+  free(elts);
+  taf_destroy(loaded);
+  taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_codecs() {
+  printf("Testing %s...", __FUNCTION__);
+  // Sparse codes round-trip and decode prefixes
+  int sels[64];
+  int decoded[64];
+  uint64_t code;
+  srandom(TAF_SEED);
+  for (int trial=0; trial < 1000; trial++) {
+    memset(sels, 0, sizeof(sels));
+    for (int i=0; i < trial % 4; i++) {
+      sels[random() % 64] = (int)(random() % MAX_SELECTOR);
+    }
+    assert_eq(sparse_sel_codec.encode(sels, &code), 0);
+    sparse_sel_codec.decode(code, decoded);
+    assert_eq(memcmp(sels, decoded, sizeof(sels)), 0);
+    int k = (int)(random() % 64);
+    sparse_sel_codec.decode_upto(code, k, decoded);
+    assert_eq(memcmp(sels, decoded, (k + 1) * sizeof(int)), 0);
+  }
+  memset(sels, 0, sizeof(sels));
+  assert_eq(sparse_sel_codec.encode(sels, &code), 0);
+  assert_eq(code, 0);
+  for (int i=0; i < SEL_CODE_BYTES + 1; i++) {
+    sels[i] = 1;
+  }
+  assert_eq(sparse_sel_codec.encode(sels, &code), -1);
+
+  // A TAF using the sparse codec adapts without false negatives
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  TAF *filter = new_taf(n);
+  assert_eq(taf_set_codec(filter, &sparse_sel_codec), 0);
+  elt_t *elts = malloc(nelts * sizeof(elt_t));
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = random();
+    taf_insert(filter, elts[i]);
+  }
+  size_t fps = 0;
+  size_t repeat_fps = 0;
+  for (size_t i=0; i<nqueries; i++) {
+    elt_t elt = random();
+    if (taf_lookup(filter, elt)) {
+      fps++;
+      repeat_fps += taf_lookup(filter, elt);
+    }
+  }
+  assert(fps > 0);
+  assert(repeat_fps < fps);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(filter, elts[i]));
+  }
+  // Switching codecs keeps every block's selectors, or changes nothing
+  int (*before)[64] = malloc(filter->nblocks * sizeof(*before));
+  for (size_t i=0; i<filter->nblocks; i++) {
+    sparse_sel_codec.decode(get_sel_code(filter, i), before[i]);
+  }
+  if (taf_set_codec(filter, &arcd_sel_codec) == 0) {
+    assert(filter->codec == &arcd_sel_codec);
+    assert_eq(taf_set_codec(filter, &sparse_sel_codec), 0);
+  } else {
+    assert(filter->codec == &sparse_sel_codec);
+  }
+  for (size_t i=0; i<filter->nblocks; i++) {
+    sparse_sel_codec.decode(get_sel_code(filter, i), decoded);
+    assert_eq(memcmp(before[i], decoded, sizeof(decoded)), 0);
+  }
+  free(before);
+  // Saved filters keep their codec
+  char path[] = "/tmp/taf_codec_XXXXXX";
+  close(mkstemp(path));
+  assert_eq(taf_save(filter, path), 0);
+  TAF *loaded = malloc(sizeof(TAF));
+  assert_eq(taf_load_mmap(loaded, path), 0);
+  assert(loaded->codec == &sparse_sel_codec);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(loaded, elts[i]));
+  }
+  unlink(path);
+  free(elts);
+  taf_destroy(loaded);
+  taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_build_bulk() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  TAF *bulk = new_taf(n);
+  TAF *incremental = new_taf(n);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  srandom(TAF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = random();
+  }
+  // Build over a non-empty filter to check that it is cleared first
+  taf_insert(bulk, 1);
+  taf_build_bulk(bulk, elts, nelts);
+  for (size_t i=0; i<nelts; i++) {
+    taf_insert(incremental, elts[i]);
+  }
+  // Blocks and remote match incremental construction exactly
+  assert_eq(bulk->nelts, incremental->nelts);
+  assert_eq(bulk->nblocks, incremental->nblocks);
+  for (size_t i=0; i<bulk->nblocks; i++) {
+    assert_eq(memcmp(&bulk->blocks[i], &incremental->blocks[i], sizeof(TAFBlock)), 0);
+  }
+  assert(same_remote(bulk, incremental, 0, bulk->nslots));
+  // No false negatives, and false positives are fixed
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(bulk, elts[i]));
+  }
+  for (size_t i=nelts; i<2*nelts; i++) {
+    if (taf_lookup(bulk, elts[i])) {
+      assert(!taf_lookup(bulk, elts[i]));
+    }
+  }
+  free(elts);
+  taf_destroy(bulk);
+  taf_destroy(incremental);
+  printf("passed.\n");
+}
+
+void test_remove() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  TAF *filter = new_taf(n);
+  TAF *expected = new_taf(n);
+  elt_t *elts = malloc(nelts * sizeof(elt_t));
+  srandom(TAF_SEED);
+  for (size_t i=0; i<nelts; i++) {
+    elts[i] = random();
+    taf_insert(filter, elts[i]);
+  }
+  assert_eq(taf_remove(filter, (elt_t)-1), 0);
+  // Remove every other element
+  for (size_t i=0; i<nelts; i += 2) {
+    assert_eq(taf_remove(filter, elts[i]), 1);
+  }
+  for (size_t i=1; i<nelts; i += 2) {
+    taf_insert(expected, elts[i]);
+  }
+  // Without adaptation, the result is the filter we'd get from inserting
+  // the remaining elements
+  assert_eq(filter->nelts, expected->nelts);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    if (i < expected->nblocks) {
+      assert_eq(memcmp(&filter->blocks[i], &expected->blocks[i], sizeof(TAFBlock)), 0);
+      assert(same_remote(filter, expected, i*64, (i+1)*64));
+    } else {
+      assert_eq(filter->blocks[i].runends, 0);
+    }
+  }
+  // Adapt on the removed elements, then remove the rest: remaining elements
+  // are never lost along the way
+  for (size_t i=0; i<nelts; i += 2) {
+    taf_lookup(filter, elts[i]);
+  }
+  for (size_t i=1; i<nelts; i += 2) {
+    assert_eq(taf_remove(filter, elts[i]), 1);
+    assert_eq(taf_remove(filter, elts[i]), 0);
+    for (size_t j=i+2; j<nelts; j += 2*64) {
+      assert(taf_lookup(filter, elts[j]));
+    }
+  }
+  assert_eq(filter->nelts, 0);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    TAFBlock *b = &filter->blocks[i];
+    assert_eq(b->occupieds | b->runends | b->offset, 0);
+  }
+  free(elts);
+  taf_destroy(filter);
+  taf_destroy(expected);
+  printf("passed.\n");
+}
+
+/**
+ * Sum of all selectors in the filter.
+ */
+static int sel_sum(TAF *filter) {
+  int sum = 0;
+  int sels[64];
+  for (size_t i=0; i<filter->nblocks; i++) {
+    decode_sel(get_sel_code(filter, i), sels);
+    for (int j=0; j<64; j++) {
+      sum += sels[j];
+    }
+  }
+  return sum;
+}
+
+void test_expand() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 9/10;
+  TAF *filter = new_taf(n);
+  TAF *expected = new_taf(2*n);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  srandom(TAF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = random();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    taf_insert(filter, elts[i]);
+    taf_insert(expected, elts[i]);
+  }
+  // Adapt on some false positives
+  for (size_t i=nelts; i<2*nelts; i++) {
+    taf_lookup(filter, elts[i]);
+  }
+  assert(sel_sum(filter) > 0);
+  assert_eq(taf_expand(filter), 0);
+  assert_eq(filter->nslots, 2*n);
+  assert_eq(filter->q, expected->q);
+  assert_eq(filter->nelts, nelts);
+  // The filter matches one that started out twice as large, with no
+  // adaptations: selectors are reset, as the remainders they chose have moved
+  assert_eq(filter->nblocks, expected->nblocks);
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(TAFBlock)), 0);
+  assert(same_remote(filter, expected, 0, filter->nslots));
+  assert_eq(sel_sum(filter), 0);
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  taf_destroy(filter);
+  taf_destroy(expected);
+  printf("passed.\n");
+}
+
+#define CONCURRENT_THREADS 8
+
+typedef struct concurrent_test_arg_t {
+  TAF *filter;
+  const elt_t *elts;
+  const elt_t *nonmembers;
+  size_t n;
+  size_t misses;
+} ConcurrentTestArg;
+
+static void *insert_and_lookup_worker(void *p) {
+  ConcurrentTestArg *arg = p;
+  for (size_t i=0; i<arg->n; i++) {
+    taf_insert_concurrent(arg->filter, arg->elts[i]);
+    // Every element inserted by this thread so far must be visible
+    if (!taf_lookup_concurrent(arg->filter, arg->elts[i/2])) {
+      arg->misses++;
+    }
+    // Adapt on any false positives
+    taf_lookup_concurrent(arg->filter, arg->nonmembers[i]);
+  }
+  return NULL;
+}
+
+void test_insert_concurrent() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 16;
+  size_t nelts = n * 95/100;
+  TAF *filter = malloc(sizeof(TAF));
+  taf_init_concurrent(filter, n, TAF_SEED);
+  TAF *expected = new_taf(n);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  srandom(TAF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = ((elt_t)random() << 32) | random();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    taf_insert(expected, elts[i]);
+  }
+  // Each thread inserts its own slice of elts, and looks up its own slice
+  // of nonmembers
+  pthread_t threads[CONCURRENT_THREADS];
+  ConcurrentTestArg args[CONCURRENT_THREADS];
+  size_t per_thread = nelts / CONCURRENT_THREADS;
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    args[t].filter = filter;
+    args[t].elts = elts + t * per_thread;
+    args[t].nonmembers = elts + nelts + t * per_thread;
+    args[t].n = (t == CONCURRENT_THREADS - 1) ? nelts - t * per_thread : per_thread;
+    args[t].misses = 0;
+    pthread_create(&threads[t], NULL, insert_and_lookup_worker, &args[t]);
+  }
+  for (int t=0; t<CONCURRENT_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+    assert_eq(args[t].misses, 0);
+  }
+  // Adapting only changes remainders and selectors, so metadata must match
+  // a filter built sequentially
+  assert_eq(filter->nelts, nelts);
+  assert_eq(filter->nblocks, expected->nblocks);
+  for (size_t i=0; i<filter->nblocks; i++) {
+    test_assert_eq(filter->blocks[i].occupieds, expected->blocks[i].occupieds, "block_i=%lu", i);
+    test_assert_eq(filter->blocks[i].runends, expected->blocks[i].runends, "block_i=%lu", i);
+    test_assert_eq(filter->blocks[i].offset, expected->blocks[i].offset, "block_i=%lu", i);
+  }
+  for (size_t i=0; i<nelts; i++) {
+    assert(taf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  taf_destroy(filter);
+  taf_destroy(expected);
+  printf("passed.\n");
+}
+
 void test_mixed_insert_and_query_w_repeats() {
   printf("Testing %s...\n", __FUNCTION__);
   int nslots = 1 << 14;
@@ -1218,22 +3204,6 @@ void test_shift_sels_single_block() {
   printf("passed.\n");
 }
 
-void test_swap_sels() {
-  printf("Testing %s...", __FUNCTION__);
-  int* xs = malloc(64 * sizeof(int));
-  int* ys = malloc(64 * sizeof(int));
-  for (int i=0; i<64; i++) {
-    xs[i] = i;
-    ys[i] = 64 + i;
-  }
-  swap_ptrs(&xs, &ys);
-  for (int i=0; i<64; i++) {
-    assert_eq(ys[i], i);
-    assert_eq(xs[i], 64+i);
-  }
-  printf("passed.\n");
-}
-
 TAF* sel_setup() {
   TAF* filter = new_taf(64 * 4);
   int sels[64];
@@ -1281,6 +3251,65 @@ void test_shift_sels_multi_block() {
   printf("passed.\n");
 }
 
+void test_shift_sels_zero_blocks() {
+  printf("Testing %s...", __FUNCTION__);
+  TAF *filter = new_taf(64 * 4);
+  int sels[64];
+  uint64_t code;
+  memset(sels, 0, sizeof(sels));
+  sels[63] = 2;
+  encode_sel(sels, &code);
+  set_sel_code(filter, 0, code);
+  // The selector at 63 is carried into block 1; blocks 2 and 3 stay empty
+  shift_sels(filter, 32, 64*3 + 10);
+  assert_eq(get_sel_code(filter, 0), 0);
+  assert_eq(get_sel_code(filter, 2), 0);
+  assert_eq(get_sel_code(filter, 3), 0);
+  decode_sel(get_sel_code(filter, 1), sels);
+  for (int i=0; i<64; i++) {
+    assert_eq(sels[i], i == 0 ? 2 : 0);
+  }
+  // Unshifting carries it back
+  unshift_sels(filter, 32, 64*3 + 10);
+  decode_sel(get_sel_code(filter, 0), sels);
+  for (int i=0; i<64; i++) {
+    assert_eq(sels[i], i == 63 ? 2 : 0);
+  }
+  for (int i=1; i<4; i++) {
+    assert_eq(get_sel_code(filter, i), 0);
+  }
+  taf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_adapt_while_inserting() {
+  printf("Testing %s...", __FUNCTION__);
+  // Inserts shift adapted selectors into blocks whose codes may not fit
+  // them; the rebuilt blocks must still match their members
+  const SelCodec *codecs[] = {&arcd_sel_codec, &sparse_sel_codec};
+  size_t n = 1 << 12;
+  size_t nelts = n * 95/100;
+  for (int c=0; c<2; c++) {
+    TAF *filter = new_taf(n);
+    assert_eq(taf_set_codec(filter, codecs[c]), 0);
+    elt_t *elts = malloc(nelts * sizeof(elt_t));
+    srandom(TAF_SEED);
+    for (size_t i=0; i<nelts; i++) {
+      elts[i] = random();
+      taf_insert(filter, elts[i]);
+      for (int j=0; j<50; j++) {
+        taf_lookup(filter, random());
+      }
+    }
+    for (size_t i=0; i<nelts; i++) {
+      assert(taf_lookup(filter, elts[i]));
+    }
+    free(elts);
+    taf_destroy(filter);
+  }
+  printf("passed.\n");
+}
+
 void test_template() {
   printf("Testing %s...", __FUNCTION__);
   TAF *filter = new_taf(64 * 3);
@@ -1302,11 +3331,23 @@ int main() {
   test_raw_lookup_1();
   test_raw_insert_1();
   test_shift_remote_elts();
-  test_swap_sels();
   test_shift_sels_single_block();
   test_shift_sels_multi_block();
+  test_shift_sels_zero_blocks();
+  test_adapt_while_inserting();
 //  test_insert_and_query();
 //  test_insert_and_query_w_repeats();
+  test_lookup_batch();
+  test_contains_parallel();
+  test_deferred_adaptations();
+  test_contains_and_report();
+  test_remote_backends();
+  test_save_and_load_mmap();
+  test_codecs();
+  test_build_bulk();
+  test_remove();
+  test_expand();
+  test_insert_concurrent();
   test_mixed_insert_and_query_w_repeats();
 }
 #endif // TEST_TAF
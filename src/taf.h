@@ -8,6 +8,9 @@ extern "C" {
 #include <stdint.h>
 #include "constants.h"
 #include "remainder.h"
+#include "remote.h"
+#include "codec.h"
+#include "pool.h"
 
 #define SEL_CODE_LEN (56)
 #define SEL_CODE_BYTES (SEL_CODE_LEN >> 3)
@@ -24,12 +27,11 @@ typedef struct taf_block_t {
   uint8_t sel_code[SEL_CODE_BYTES];
 } TAFBlock;
 
-typedef uint64_t elt_t;
-
-typedef struct remote_elt_t {
-  uint64_t elt;
-  uint64_t hash;
-} Remote_elt ;
+typedef struct adapt_event_t {
+  elt_t elt;                    /* query that hit a false positive */
+  uint64_t hash;                /* its hash */
+  size_t quot;                  /* its quotient, set when flushing */
+} AdaptEvent;
 
 typedef struct taf_t {
   size_t p;                     /* fingerprint prefix size = log2(n/E) to get false-pos rate E */
@@ -37,20 +39,56 @@ typedef struct taf_t {
   size_t r;                     /* length of remainder */
   size_t nslots;                /* number of slots available (2^q) */
   size_t nblocks;               /* nslots/64 */
+  size_t nblocks_alloc;         /* blocks allocated, including room for overflow blocks */
   size_t nelts;                 /* number of elements stored  */
   int seed;                     /* seed for Murmurhash */
   TAFBlock* blocks;           /* blocks of 64 remainders with metadata  */
-  Remote_elt* remote;           /* array of inserted elements (up to 64 bits) */
+  const SelCodec *codec;        /* encodes each block's selectors into its sel_code */
+  int blocks_mapped;            /* blocks are in `mapping`, so aren't freed or realloced */
+  void *mapping;                /* file mapped by taf_load_mmap, or NULL */
+  size_t mapping_size;
+  Remote remote;                /* inserted elements (up to 64 bits), by slot */
+  struct region_locks_t *locks; /* locks for concurrent operations, or NULL */
+  int defer_adapt;              /* queue false positives instead of adapting */
+  AdaptEvent *pending;          /* false positives queued since the last flush */
+  size_t npending;
+  size_t pending_alloc;
 
   // Extra modes
   int mode;            // mode flag: handle non-adaptive case
 } TAF;
 
 void taf_init(TAF *filter, size_t n, int seed);
+void taf_init_remote(TAF *filter, size_t n, int seed, Remote remote);
 void taf_destroy(TAF* filter);
 int taf_lookup(TAF *filter, elt_t elt);
+int taf_contains(const TAF *filter, elt_t elt);
+int taf_report_false_positive(TAF *filter, elt_t elt);
+void taf_lookup_batch(TAF *filter, const elt_t *elts, size_t n, uint8_t *out);
+void taf_contains_batch(const TAF *filter, const elt_t *elts, size_t n, uint8_t *out);
+void taf_contains_parallel(const TAF *filter, Pool *pool, const elt_t *elts,
+                           size_t n, uint64_t *bits);
 void taf_insert(TAF *filter, elt_t elt);
+int taf_remove(TAF *filter, elt_t elt);
+void taf_build_bulk(TAF *filter, const elt_t *elts, size_t n);
+int taf_expand(TAF *filter);
 void taf_clear(TAF* filter);
+int taf_set_codec(TAF *filter, const SelCodec *codec);
+
+// Saving and loading (see serial.h for the format)
+int taf_save(const TAF *filter, const char *path);
+int taf_load_mmap(TAF *filter, const char *path);
+
+// Deferred adaptation: lookups queue false positives, which are fixed in
+// batches by taf_flush_adaptations
+void taf_defer_adaptations(TAF *filter, int defer);
+void taf_flush_adaptations(TAF *filter);
+
+// Concurrent operations: safe to call from multiple threads on a filter
+// created with taf_init_concurrent, but not alongside the operations above
+void taf_init_concurrent(TAF *filter, size_t n, int seed);
+int taf_lookup_concurrent(TAF *filter, elt_t elt);
+void taf_insert_concurrent(TAF *filter, elt_t elt);
 
 // Printing
 double taf_load(TAF *filter);
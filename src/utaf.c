@@ -15,6 +15,8 @@
 #include "arcd.h"
 #include "utaf.h"
 #include "bit_util.h"
+#include "block_ops.h"
+#include "serial.h"
 #include "set.h"
 
 /**
@@ -39,11 +41,22 @@ static size_t calc_quot(const FullTAF* filter, uint64_t hash) {
  * Returns the k-th remainder for h
  */
 static rem_t calc_rem(const FullTAF* filter, uint64_t hash, int k) {
-  int n_rems = (64 - (int)filter->q)/(int)filter->r;
+  int n_rems = min(64 - (int)filter->q, filter->remote.hash_bits)/(int)filter->r;
   if (k >= n_rems) k %= n_rems;
   return (hash >> (filter->q + k * filter->r)) & ONES(filter->r);
 }
 
+/**
+ * Returns the hash of the element stored at `slot`, rehashing the element if
+ * the remote doesn't keep hashes.
+ */
+static uint64_t stored_hash(const FullTAF* filter, size_t slot) {
+  if (filter->remote.ops->fetch_hash == NULL) {
+    return utaf_hash(filter, remote_fetch(&filter->remote, slot));
+  }
+  return remote_fetch_hash(&filter->remote, slot);
+}
+
 /* FullTAF Helpers */
 
 /**
@@ -178,16 +191,18 @@ static int first_unused(const FullTAF* filter, size_t x) {
   }
 }
 
+/**
+ * Returns the first slot of the run for `quot` ending at `loc`.
+ */
+static int run_start(const FullTAF* filter, size_t quot, int loc) {
+  return block_find_run_start(block_layout(filter), quot, loc);
+}
+
 /**
  * Shift the remainders and runends in [a, b] forward by 1 into [a+1, b+1]
  */
 static void shift_rems_and_runends(FullTAF* filter, int a, int b) {
-  if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    remainder(filter, i+1) = remainder(filter, i);
-    set_runend_to(filter, i+1, get_runend(filter, i));
-  }
-  set_runend_to(filter, a, 0);
+  block_shift_slots(block_layout(filter), a, b);
 }
 
 /**
@@ -195,11 +210,7 @@ static void shift_rems_and_runends(FullTAF* filter, int a, int b) {
  */
 static void shift_remote_elts(FullTAF* filter, int a, int b) {
   if (a > b) return;
-  for (int i=b; i>=a; i--) {
-    filter->remote[i+1] = filter->remote[i];
-  }
-  filter->remote[a].elt = 0;
-  filter->remote[a].hash = 0;
+  remote_shift(&filter->remote, a, b);
 }
 
 /**
@@ -274,24 +285,55 @@ static void inc_offsets_for_new_run(FullTAF* filter, size_t quot, size_t loc) {
   }
 }
 
-static void add_block(FullTAF *filter) {
-  // Add block to new_blocks
-  FullTAFBlock *new_blocks = realloc(filter->blocks, (filter->nblocks + 1) * sizeof(FullTAFBlock));
-  if (new_blocks == NULL) {
-    printf("add_block failed to realloc new blocks\n");
+/**
+ * Move blocks loaded by utaf_load_mmap out of the file into an array with
+ * room for `nblocks_alloc` blocks, so that they can be grown.
+ */
+static void copy_mapped_blocks(FullTAF *filter, size_t nblocks_alloc) {
+  FullTAFBlock *blocks = malloc(nblocks_alloc * sizeof(FullTAFBlock));
+  if (blocks == NULL) {
+    printf("copy_mapped_blocks failed to allocate %lu blocks\n", nblocks_alloc);
     exit(1);
   }
-  filter->blocks = new_blocks;
-  memset(filter->blocks + filter->nblocks, 0, sizeof(FullTAFBlock));
+  memcpy(blocks, filter->blocks, filter->nblocks * sizeof(FullTAFBlock));
+  filter->blocks = blocks;
+  filter->nblocks_alloc = nblocks_alloc;
+  filter->blocks_mapped = 0;
+}
 
-  // Reallocate remote rep
-  Remote_elt *new_remote = realloc(filter->remote,(filter->nslots + 64) * sizeof(Remote_elt));
-  if (new_remote == NULL) {
-    printf("add_block failed to realloc new remote rep\n");
-    exit(1);
+/**
+ * Free the filter's blocks, unless they're in a mapped file.
+ */
+static void free_blocks(FullTAF *filter) {
+  if (filter->blocks_mapped) {
+    filter->blocks_mapped = 0;
+  } else {
+    free(filter->blocks);
+  }
+}
+
+/**
+ * Append an empty block (and its remote slots) to the end of the filter.
+ *
+ * Blocks are allocated in geometrically growing chunks, so that appending
+ * costs amortized O(1) instead of copying the whole filter each time.
+ */
+static void add_block(FullTAF *filter) {
+  if (filter->blocks_mapped) {
+    copy_mapped_blocks(filter, grown_nblocks(filter->nblocks));
+  } else if (filter->nblocks == filter->nblocks_alloc) {
+    size_t nblocks_alloc = grown_nblocks(filter->nblocks_alloc);
+    // Reallocate blocks
+    FullTAFBlock *new_blocks = realloc(filter->blocks, nblocks_alloc * sizeof(FullTAFBlock));
+    if (new_blocks == NULL) {
+      printf("add_block failed to realloc new blocks\n");
+      exit(1);
+    }
+    filter->blocks = new_blocks;
+    filter->nblocks_alloc = nblocks_alloc;
   }
-  filter->remote = new_remote;
-  memset(filter->remote + filter->nslots, 0, 64 * sizeof(Remote_elt));
+  memset(filter->blocks + filter->nblocks, 0, sizeof(FullTAFBlock));
+  remote_resize(&filter->remote, filter->nslots + 64);
 
   // Update counters
   filter->nblocks += 1;
@@ -306,7 +348,7 @@ static void adapt_loc(FullTAF *filter, size_t loc) {
   int old_sel = selector(filter, loc);
   int new_sel = (old_sel + 1) % UTAF_MAX_SEL;
   selector(filter, loc) = new_sel;
-  remainder(filter, loc) = calc_rem(filter, filter->remote[loc].hash, new_sel);
+  remainder(filter, loc) = calc_rem(filter, stored_hash(filter, loc), new_sel);
 }
 
 /**
@@ -316,14 +358,15 @@ static void adapt_loc(FullTAF *filter, size_t loc) {
  */
 static void adapt(FullTAF *filter, elt_t query, int loc, size_t quot, uint64_t hash) {
   assert(quot <= loc && loc < filter->nslots);
+  int start = run_start(filter, quot, loc);
   // Make sure the query elt isn't mapped to an earlier index in the sequence
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
-    if (filter->remote[i].elt == query) {
+  for (int i=loc; i>=start; i--) {
+    if (remote_matches(&filter->remote, i, query, hash)) {
       return;
     }
   }
   // Adapt on all collisions in the run
-  for (int i=loc; i>=(int)quot && (i == loc || !get_runend(filter, i)); i--) {
+  for (int i=loc; i>=start; i--) {
     if (remainder(filter, i) == calc_rem(filter, hash, selector(filter, i))) {
       adapt_loc(filter, i);
     }
@@ -333,6 +376,14 @@ static void adapt(FullTAF *filter, elt_t query, int loc, size_t quot, uint64_t h
 /* FullTAF */
 
 void utaf_init(FullTAF *filter, size_t n, int seed) {
+  utaf_init_remote(filter, n, seed, new_array_remote(0, REMOTE_KEYS_ONLY ? 0 : ARRAY_REMOTE_HASHES));
+}
+
+/**
+ * Initialize a filter that keeps its elements in `remote`.  The filter takes
+ * ownership of `remote`.
+ */
+void utaf_init_remote(FullTAF *filter, size_t n, int seed, Remote remote) {
   filter->seed = seed;
   filter->nelts = 0;
   filter->nblocks = max(1, nearest_pow_of_2(n)/64);
@@ -341,21 +392,109 @@ void utaf_init(FullTAF *filter, size_t n, int seed) {
   filter->r = REM_SIZE;
   filter->p = filter->q + filter->r;
   filter->blocks = calloc(filter->nblocks, sizeof(FullTAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(Remote_elt));
+  filter->nblocks_alloc = filter->nblocks;
+  filter->blocks_mapped = 0;
+  filter->mapping = NULL;
+  filter->mapping_size = 0;
+  filter->remote = remote;
+  if (filter->remote.hash_bits < 64) {
+    filter->remote.hash_shift = (int)filter->q;
+  }
+  remote_resize(&filter->remote, filter->nslots);
 }
 
 void utaf_destroy(FullTAF* filter) {
-  free(filter->blocks);
-  free(filter->remote);
+  free_blocks(filter);
+  remote_destroy(&filter->remote);
+  if (filter->mapping != NULL) {
+    serial_unmap(filter->mapping, filter->mapping_size);
+  }
   free(filter);
 }
 
 void utaf_clear(FullTAF* filter) {
   filter->nelts = 0;
-  free(filter->blocks);
-  free(filter->remote);
+  free_blocks(filter);
   filter->blocks = calloc(filter->nblocks, sizeof(FullTAFBlock));
-  filter->remote = calloc(filter->nslots, sizeof(Remote_elt));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+}
+
+/**
+ * Save the filter to `path`: its blocks, then its remote's elements and
+ * hashes (only elements if the remote has no fetch_hash).
+ * @return 0 on success, -1 if the file couldn't be written or the remote
+ * can't fetch its elements.
+ */
+int utaf_save(const FullTAF *filter, const char *path) {
+  if (filter->remote.ops->fetch == NULL) {
+    return -1;
+  }
+  int with_hashes = filter->remote.ops->fetch_hash != NULL;
+  SerialHeader header;
+  memset(&header, 0, sizeof(header));
+  header.kind = SERIAL_UTAF;
+  header.block_size = sizeof(FullTAFBlock);
+  header.p = filter->p;
+  header.q = filter->q;
+  header.r = filter->r;
+  header.nslots = filter->nslots;
+  header.nblocks = filter->nblocks;
+  header.nelts = filter->nelts;
+  header.seed = filter->seed;
+  header.remote_slot_size = with_hashes ? sizeof(Remote_elt) : sizeof(elt_t);
+  FILE *file = serial_create(path, &header);
+  if (file == NULL) {
+    return -1;
+  }
+  fwrite(filter->blocks, sizeof(FullTAFBlock), filter->nblocks, file);
+  for (size_t i=0; i < filter->nslots; i++) {
+    Remote_elt slot;
+    slot.elt = remote_fetch(&filter->remote, i);
+    slot.hash = with_hashes ? remote_fetch_hash(&filter->remote, i) : 0;
+    fwrite(&slot, header.remote_slot_size, 1, file);
+  }
+  return serial_close(file);
+}
+
+/**
+ * Initialize a filter from one saved by utaf_save, using the file itself as
+ * the filter's blocks and remote slots instead of reading them in.  The file
+ * is mapped copy-on-write: pages are read as the filter touches them, and
+ * changes to the filter never reach the file.  The blocks are copied out of
+ * the file when the filter first grows.  The filter keeps its remote in an
+ * array.
+ * @return 0 on success, -1 if the file couldn't be mapped or isn't a uTAF
+ * saved by this build.
+ */
+int utaf_load_mmap(FullTAF *filter, const char *path) {
+  SerialMap map;
+  if (serial_map(path, SERIAL_UTAF, sizeof(FullTAFBlock), &map) != 0) {
+    return -1;
+  }
+  const SerialHeader *header = map.header;
+  if (header->r != REM_SIZE ||
+      (header->remote_slot_size != sizeof(Remote_elt) &&
+       header->remote_slot_size != sizeof(elt_t))) {
+    serial_unmap(map.base, map.size);
+    return -1;
+  }
+  filter->p = header->p;
+  filter->q = header->q;
+  filter->r = header->r;
+  filter->nslots = header->nslots;
+  filter->nblocks = header->nblocks;
+  filter->nblocks_alloc = header->nblocks;
+  filter->nelts = header->nelts;
+  filter->seed = (int)header->seed;
+  filter->blocks = map.blocks;
+  filter->blocks_mapped = 1;
+  filter->mapping = map.base;
+  filter->mapping_size = map.size;
+  filter->remote = new_array_remote_over(map.remote, filter->nslots,
+                                         header->remote_slot_size == sizeof(Remote_elt) ?
+                                         ARRAY_REMOTE_HASHES : 0);
+  return 0;
 }
 
 static void raw_insert(FullTAF* filter, elt_t elt, uint64_t hash) {
@@ -370,8 +509,7 @@ static void raw_insert(FullTAF* filter, elt_t elt, uint64_t hash) {
       set_occupied(filter, quot);
       set_runend(filter, quot);
       remainder(filter, quot) = rem;
-      filter->remote[quot].elt = elt;
-      filter->remote[quot].hash = hash;
+      remote_store(&filter->remote, quot, elt, hash);
       break;
     }
     case RANK_SELECT_OVERFLOW: {
@@ -406,32 +544,82 @@ static void raw_insert(FullTAF* filter, elt_t elt, uint64_t hash) {
       }
       set_runend(filter, r+1);
       remainder(filter, r+1) = rem;
-      filter->remote[r+1].elt = elt;
-      filter->remote[r+1].hash = hash;
+      remote_store(&filter->remote, r+1, elt, hash);
     }
   }
 }
 
+/**
+ * Returns the location of the last fingerprint matching `hash` in the run for
+ * `quot` ending at `loc`, or -1 if there is none.  `loc` is the result of
+ * `rank_select(filter, quot)`.
+ */
+static int match_in_run(const FullTAF* filter, uint64_t hash, size_t quot, int loc) {
+  if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
+    return -1;
+  }
+  // Check the runend first, as most runs are short, and a match there lets
+  // the CPU start fetching its remote slot before the remainders arrive
+  if (remainder(filter, loc) == calc_rem(filter, hash, selector(filter, loc))) {
+    return loc;
+  }
+  int start = run_start(filter, quot, loc);
+  int end = loc - 1;
+  if (end < start) {
+    return -1;
+  }
+  int n_rems = min(64 - (int)filter->q, filter->remote.hash_bits)/(int)filter->r;
+  if (n_rems > 16) {
+    // Too many distinct remainders for block_match_sel_rems: check each slot
+    for (loc = end; loc >= start; loc--) {
+      if (remainder(filter, loc) == calc_rem(filter, hash, selector(filter, loc))) {
+        return loc;
+      }
+    }
+    return -1;
+  }
+  // The query's remainder for each distinct selector
+  rem_t qrems[16] = {0};
+  uint64_t bits = hash >> filter->q;
+  for (int k=0; k<n_rems; k++) {
+    qrems[k] = (bits >> (k * filter->r)) & ONES(filter->r);
+  }
+  // Match the rest of the run a block at a time, back to the block it
+  // starts in
+  for (int block_i = end/64; block_i >= start/64; block_i--) {
+    const FullTAFBlock *b = &filter->blocks[block_i];
+    int lo = (block_i == start/64) ? start%64 : 0;
+    int hi = (block_i == end/64) ? end%64 : 63;
+    uint64_t matches = block_match_sel_rems(b->remainders, b->selectors, qrems, n_rems, lo, hi);
+    if (matches) {
+      return block_i*64 + 63 - lzcnt(matches);
+    }
+  }
+  return -1;
+}
+
+/**
+ * Returns 1 if the run for `quot` ending at `loc` contains a fingerprint
+ * matching `hash`, adapting if the match is a false positive.
+ * `loc` is the result of `rank_select(filter, quot)`.
+ */
+static int probe_run(FullTAF* filter, elt_t elt, uint64_t hash, size_t quot, int loc) {
+  int match = match_in_run(filter, hash, quot, loc);
+  if (match < 0) {
+    return 0;
+  }
+  // Check remote
+  if (!remote_matches(&filter->remote, match, elt, hash)) {
+    adapt(filter, elt, match, quot, hash);
+  }
+  return 1;
+}
+
 static int raw_lookup(FullTAF* filter, elt_t elt, uint64_t hash) {
   size_t quot = calc_quot(filter, hash);
 
   if (get_occupied(filter, quot)) {
-    int loc = rank_select(filter, quot);
-    if (loc == RANK_SELECT_EMPTY || loc == RANK_SELECT_OVERFLOW) {
-      return 0;
-    }
-    do {
-      int sel = selector(filter, loc);
-      rem_t rem = calc_rem(filter, hash, sel);
-      if (remainder(filter, loc) == rem) {
-        // Check remote
-        if (elt != filter->remote[loc].elt) {
-          adapt(filter, elt, loc, quot, hash);
-        }
-        return 1;
-      }
-      loc--;
-    } while (loc >= (int)quot && !get_runend(filter, loc));
+    return probe_run(filter, elt, hash, quot, rank_select(filter, quot));
   }
   return 0;
 }
@@ -448,11 +636,225 @@ int utaf_lookup(FullTAF *filter, elt_t elt) {
   return raw_lookup(filter, elt, hash);
 }
 
+/**
+ * Return 1 if word may be in the filter, without consulting the remote
+ * representation or adapting.
+ */
+int utaf_contains(const FullTAF *filter, elt_t elt) {
+  uint64_t hash = utaf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  return match_in_run(filter, hash, quot, rank_select(filter, quot)) >= 0;
+}
+
+/**
+ * Adapt on `elt`, which the caller found to be a false positive.  Does
+ * nothing if `elt` is stored in its run.
+ *
+ * Returns 1 if `elt` matched a fingerprint, 0 if it was a negative.
+ */
+int utaf_report_false_positive(FullTAF *filter, elt_t elt) {
+  uint64_t hash = utaf_hash(filter, elt);
+  size_t quot = calc_quot(filter, hash);
+  if (!get_occupied(filter, quot)) {
+    return 0;
+  }
+  int match = match_in_run(filter, hash, quot, rank_select(filter, quot));
+  if (match < 0) {
+    return 0;
+  }
+  adapt(filter, elt, match, quot, hash);
+  return 1;
+}
+
+/**
+ * Look up `n` elements, writing 1 to `out[i]` if `elts[i]` is in the filter
+ * and 0 otherwise.  Adapts on false positives like `utaf_lookup`.
+ *
+ * Keys are processed in groups of `LOOKUP_BATCH`, prefetching home blocks,
+ * then runend blocks and remote elements, before probing any run.
+ */
+void utaf_lookup_batch(FullTAF *filter, const elt_t *elts, size_t n, uint8_t *out) {
+  uint64_t hashes[LOOKUP_BATCH];
+  int locs[LOOKUP_BATCH];
+  for (size_t base=0; base < n; base += LOOKUP_BATCH) {
+    size_t m = min(LOOKUP_BATCH, n - base);
+    // Hash keys and prefetch home blocks
+    for (size_t i=0; i<m; i++) {
+      hashes[i] = utaf_hash(filter, elts[base + i]);
+      prefetch(&block_containing(filter, calc_quot(filter, hashes[i])));
+    }
+    // Find runends and prefetch the blocks and remote elements there
+    for (size_t i=0; i<m; i++) {
+      size_t quot = calc_quot(filter, hashes[i]);
+      if (get_occupied(filter, quot)) {
+        locs[i] = rank_select(filter, quot);
+        if (locs[i] >= 0) {
+          prefetch(&block_containing(filter, locs[i]));
+          remote_prefetch(&filter->remote, locs[i]);
+        }
+      } else {
+        locs[i] = RANK_SELECT_EMPTY;
+      }
+    }
+    // Probe runs; adapting doesn't move runends, so `locs` stays valid
+    for (size_t i=0; i<m; i++) {
+      out[base + i] = probe_run(filter, elts[base + i], hashes[i],
+                                calc_quot(filter, hashes[i]), locs[i]);
+    }
+  }
+}
+
 void utaf_insert(FullTAF *filter, elt_t elt) {
   uint64_t hash = utaf_hash(filter, elt);
   raw_insert(filter, elt, hash);
 }
 
+/* Expansion */
+
+/**
+ * Set the offsets of blocks in [*next_block, end) while writing out a filter.
+ * `runend` is the runend of the last run whose quotient is at or before the
+ * start of each of these blocks, or -1 if there is no such run.
+ */
+static void set_bulk_offsets(FullTAF *filter, size_t *next_block, size_t end, int64_t runend) {
+  for (; *next_block < end; (*next_block)++) {
+    int64_t b_start = (int64_t)(*next_block * 64);
+    // A run ending before the block start leaves the offset negative
+    filter->blocks[*next_block].offset = runend >= b_start ? (size_t)(runend - b_start) : 0;
+  }
+}
+
+/**
+ * Write elements sorted by quotient into a cleared filter in a single
+ * left-to-right pass: each run starts at its quotient or right after the
+ * previous run, whichever is later.  `run_ends[quot]` is one past the index
+ * of the last element of run `quot` in `sorted`.  All selectors are 0.
+ */
+static void bulk_write(FullTAF *filter, const Remote_elt *sorted, const size_t *run_ends,
+                       size_t n) {
+  size_t nquots = ONE(filter->q);
+  filter->nelts = n;
+  size_t next_block = 0;   // first block whose offset hasn't been set
+  size_t loc = 0;          // first slot not used by a run
+  int64_t runend = -1;     // runend of the last run written
+  size_t i = 0;            // next element to write
+  for (size_t quot=0; quot<nquots; quot++) {
+    if (i == run_ends[quot]) {
+      continue;
+    }
+    // Blocks starting before quot follow the previous run
+    set_bulk_offsets(filter, &next_block, (quot + 63)/64, runend);
+    loc = max(loc, quot);
+    set_occupied(filter, quot);
+    for (; i < run_ends[quot]; i++, loc++) {
+      if (loc >= filter->nslots) {
+        add_block(filter);
+      }
+      remainder(filter, loc) = calc_rem(filter, sorted[i].hash, 0);
+      remote_store(&filter->remote, loc, sorted[i].elt, sorted[i].hash);
+    }
+    runend = (int64_t)loc - 1;
+    set_runend(filter, runend);
+  }
+  set_bulk_offsets(filter, &next_block, filter->nblocks, runend);
+}
+
+/**
+ * Stably counting-sort `n` elements by quotient.
+ * Fills `run_ends[0..2^q]` as expected by `bulk_write`.
+ */
+static void sort_by_quot(const FullTAF *filter, const Remote_elt *elts, size_t n,
+                         Remote_elt *sorted, size_t *run_ends) {
+  size_t nquots = ONE(filter->q);
+  memset(run_ends, 0, (nquots + 1) * sizeof(size_t));
+  // Count run lengths, then turn counts into the index of each run in `sorted`
+  for (size_t i=0; i<n; i++) {
+    run_ends[calc_quot(filter, elts[i].hash) + 1]++;
+  }
+  for (size_t quot=0; quot<nquots; quot++) {
+    run_ends[quot + 1] += run_ends[quot];
+  }
+  // Placing each element advances run_ends[quot] from the start to the end of run quot
+  for (size_t i=0; i<n; i++) {
+    size_t j = run_ends[calc_quot(filter, elts[i].hash)]++;
+    sorted[j] = elts[i];
+  }
+}
+
+/**
+ * Double the number of slots in the filter, rehashing every element into a
+ * filter with one more quotient bit using the hashes in the remote
+ * representation.
+ *
+ * Selectors are not carried over: remainders come from the hash bits after
+ * the quotient, which shift when the quotient grows, so an old selector no
+ * longer picks the remainder that fixed its false positive.  The expanded
+ * filter starts out with no adaptations.
+ *
+ * Returns 0 on success, or -1 (leaving the filter unchanged) if the hash is
+ * too short to supply a remainder after growing the quotient.
+ */
+int utaf_expand(FullTAF *filter) {
+  if ((64 - (int)filter->q - 1)/(int)filter->r < 1) {
+    return -1;
+  }
+  // Remotes that don't keep whole elements can't rehash them
+  if (filter->remote.ops->fetch == NULL || filter->remote.hash_bits < 64) {
+    return -1;
+  }
+  size_t n = filter->nelts;
+  size_t nquots = 2 * ONE(filter->q);
+  Remote_elt *elts = malloc(max(n, 1) * sizeof(Remote_elt));
+  Remote_elt *sorted = malloc(max(n, 1) * sizeof(Remote_elt));
+  size_t *run_ends = malloc((nquots + 1) * sizeof(size_t));
+  if (elts == NULL || sorted == NULL || run_ends == NULL) {
+    printf("utaf_expand failed to allocate buffers for %lu elements\n", n);
+    exit(1);
+  }
+  // Walk runs in quotient order, collecting elements
+  size_t i = 0;
+  size_t loc = 0;
+  for (size_t quot=0; quot < ONE(filter->q); quot++) {
+    if (!get_occupied(filter, quot)) {
+      continue;
+    }
+    loc = max(loc, quot);
+    int at_runend;
+    do {
+      elts[i].elt = remote_fetch(&filter->remote, loc);
+      elts[i].hash = stored_hash(filter, loc);
+      at_runend = get_runend(filter, loc) != 0;
+      i++;
+      loc++;
+    } while (!at_runend);
+  }
+  assert(i == n);
+
+  filter->q += 1;
+  sort_by_quot(filter, elts, n, sorted, run_ends);
+  free(elts);
+
+  free_blocks(filter);
+  filter->p = filter->q + filter->r;
+  filter->nslots = nquots;
+  filter->nblocks = nquots/64;
+  filter->blocks = calloc(filter->nblocks, sizeof(FullTAFBlock));
+  filter->nblocks_alloc = filter->nblocks;
+  remote_clear(&filter->remote);
+  remote_resize(&filter->remote, filter->nslots);
+  if (filter->blocks == NULL) {
+    printf("utaf_expand failed to allocate %lu blocks\n", filter->nblocks);
+    exit(1);
+  }
+  bulk_write(filter, sorted, run_ends, n);
+  free(sorted);
+  free(run_ends);
+  return 0;
+}
+
 double utaf_load(FullTAF *filter) {
   return (double)filter->nelts/(double)filter->nslots;
 }
@@ -489,11 +891,14 @@ void print_utaf_block(FullTAF* filter, size_t block_index) {
   }
   printf("  selectors=\n");
   print_sels(filter->blocks[block_index].selectors);
+  if (filter->remote.ops->fetch == NULL) {
+    return;
+  }
   printf("  remote elts=\n");
   for (int i=0; i<8; i++) {
     printf("   ");
     for (int j=0; j<8; j++) {
-      printf(" 0x%-*lx", 8, filter->remote[block_index * 64 + i*8 + j].elt);
+      printf(" 0x%-*lx", 8, remote_fetch(&filter->remote, block_index * 64 + i*8 + j));
     }
     printf("\n");
   }
@@ -533,6 +938,8 @@ void print_utaf_stats(FullTAF* filter) {
 //#define TEST_UTAF 1
 #ifdef TEST_UTAF
 
+#include <unistd.h>
+
 void print_backtrace() {
   void* callstack[128];
   int i, frames = backtrace(callstack, 128);
@@ -582,8 +989,8 @@ void test_add_block() {
   }
   // Check remote rep
   for (int i=0; i<64; i++) {
-    assert_eq(filter->remote[128 + i].elt, 0);
-    assert_eq(filter->remote[128 + i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, 128 + i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, 128 + i), 0);
   }
   utaf_destroy(filter);
   printf("passed.\n");
@@ -599,8 +1006,7 @@ void test_add_block_no_clobber() {
     set_occupied(filter, i);
     set_runend(filter, i);
     remainder(filter, i) = i%16;
-    filter->remote[i].elt = i;
-    filter->remote[i].hash = i;
+    remote_store(&filter->remote, i, i, i);
   }
   add_block(filter);
   // Check that data in first 2 blocks is preserved
@@ -608,16 +1014,16 @@ void test_add_block_no_clobber() {
     assert(get_occupied(filter, i));
     assert(get_runend(filter, i));
     assert_eq(remainder(filter, i), i%16);
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
   // Check that 3rd block is empty
   for (int i=128; i<filter->nslots; i++) {
     assert(!get_occupied(filter, i));
     assert(!get_runend(filter, i));
     assert_eq(remainder(filter, i), 0);
-    assert_eq(filter->remote[i].elt, 0);
-    assert_eq(filter->remote[i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, i), 0);
   }
   // Check filter metadata
   assert_eq(filter->nslots, 192);
@@ -676,28 +1082,27 @@ void test_shift_remote_elts() {
   printf("Testing %s...", __FUNCTION__);
   FullTAF *filter = new_utaf(128);
   for (int i=0; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i].elt, 0);
-    assert_eq(filter->remote[i].hash, 0);
+    assert_eq(remote_fetch(&filter->remote, i), 0);
+    assert_eq(remote_fetch_hash(&filter->remote, i), 0);
   }
   for (int i=0; i<filter->nslots; i++) {
-    filter->remote[i].elt = i;
-    filter->remote[i].hash = i;
+    remote_store(&filter->remote, i, i, i);
   }
   // Shift elts in [32, 64+32] to [33, 64+33]
   shift_remote_elts(filter, 32, 64+32);
   for (int i=0; i<=31; i++) {
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
-  assert_eq(filter->remote[32].elt, 0);
-  assert_eq(filter->remote[32].hash, 0);
+  assert_eq(remote_fetch(&filter->remote, 32), 0);
+  assert_eq(remote_fetch_hash(&filter->remote, 32), 0);
   for (int i=33; i<=64+33; i++) {
-    assert_eq(filter->remote[i].elt, i-1);
-    assert_eq(filter->remote[i].hash, i-1);
+    assert_eq(remote_fetch(&filter->remote, i), i-1);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i-1);
   }
   for (int i=64+34; i<filter->nslots; i++) {
-    assert_eq(filter->remote[i].elt, i);
-    assert_eq(filter->remote[i].hash, i);
+    assert_eq(remote_fetch(&filter->remote, i), i);
+    assert_eq(remote_fetch_hash(&filter->remote, i), i);
   }
   utaf_destroy(filter);
   printf("passed.\n");
@@ -1031,6 +1436,201 @@ void test_shift_sels_multi_block() {
   printf("passed.\n");
 }
 
+/**
+ * Check match_in_run against matching one slot at a time in a nearly full
+ * filter with many adapted selectors, so that runs cross blocks and mix
+ * selectors.
+ */
+void test_match_in_run() {
+  printf("Testing %s...", __FUNCTION__);
+  FullTAF *filter = new_utaf(64 * 8);
+  srandom(FullTAF_SEED);
+  while (filter->nelts < filter->nslots * 95 / 100) {
+    utaf_insert(filter, random());
+  }
+  for (size_t i=0; i < filter->nslots; i++) {
+    if (random() % 3 == 0) {
+      selector(filter, i) = random() % UTAF_MAX_SEL;
+    }
+  }
+  for (size_t quot=0; quot < filter->nslots; quot++) {
+    if (!get_occupied(filter, quot)) continue;
+    int end = rank_select(filter, quot);
+    for (int trial=0; trial < 64; trial++) {
+      uint64_t hash = ((uint64_t)random() << 33 | (uint64_t)random() << 2) & ~ONES(filter->q);
+      hash |= quot;
+      if (trial % 2 == 0) {
+        // Make the query match a random slot of the run
+        int loc = max((int)quot, end - (int)(random() % 4));
+        hash &= ~(ONES(filter->r) << filter->q);
+        hash |= (uint64_t)remainder(filter, loc) << filter->q;
+      }
+      int expected = -1;
+      int loc = end;
+      do {
+        if (remainder(filter, loc) == calc_rem(filter, hash, selector(filter, loc))) {
+          expected = loc;
+          break;
+        }
+        loc--;
+      } while (loc >= (int)quot && !get_runend(filter, loc));
+      assert_eq(match_in_run(filter, hash, quot, end), expected);
+    }
+  }
+  utaf_destroy(filter);
+  printf("passed.\n");
+}
+
+void test_contains_and_report() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  FullTAF *filter = new_utaf(n);
+  FullTAF *expected = new_utaf(n);
+  srandom(FullTAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      utaf_insert(filter, elts[i]);
+      utaf_insert(expected, elts[i]);
+    }
+  }
+  // Contains finds every member without changing the filter
+  for (size_t i=0; i<nelts; i++) {
+    assert(utaf_contains(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  // Reporting each positive adapts exactly as lookups do
+  size_t fps = 0;
+  for (size_t i=nelts; i<nelts + nqueries; i++) {
+    int found = utaf_contains(filter, elts[i]);
+    if (found) {
+      assert(utaf_report_false_positive(filter, elts[i]));
+      fps++;
+    } else {
+      assert(!utaf_report_false_positive(filter, elts[i]));
+    }
+    assert_eq(found, utaf_lookup(expected, elts[i]));
+  }
+  assert(fps > 0);
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  // Reporting a member is harmless
+  for (size_t i=0; i<nelts; i++) {
+    assert(utaf_report_false_positive(filter, elts[i]));
+  }
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  free(elts);
+  utaf_destroy(filter);
+  utaf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_expand() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 1 << 12;
+  size_t nelts = n * 9/10;
+  FullTAF *filter = new_utaf(n);
+  FullTAF *expected = new_utaf(2*n);
+  elt_t *elts = malloc(2 * nelts * sizeof(elt_t));
+  srandom(FullTAF_SEED);
+  for (size_t i=0; i<2*nelts; i++) {
+    elts[i] = random();
+  }
+  for (size_t i=0; i<nelts; i++) {
+    utaf_insert(filter, elts[i]);
+    utaf_insert(expected, elts[i]);
+  }
+  // Adapt on some false positives
+  for (size_t i=nelts; i<2*nelts; i++) {
+    utaf_lookup(filter, elts[i]);
+  }
+  size_t sels_before = 0;
+  for (size_t i=0; i<filter->nslots; i++) {
+    sels_before += selector(filter, i);
+  }
+  assert(sels_before > 0);
+  assert_eq(utaf_expand(filter), 0);
+  assert_eq(filter->nslots, 2*n);
+  assert_eq(filter->q, expected->q);
+  assert_eq(filter->nelts, nelts);
+  // The filter matches one that started out twice as large, with no
+  // adaptations: selectors are reset, as the remainders they chose have moved
+  assert_eq(filter->nblocks, expected->nblocks);
+  assert_eq(memcmp(filter->blocks, expected->blocks, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  for (size_t i=0; i<filter->nslots; i++) {
+    assert_eq(remote_fetch(&filter->remote, i), remote_fetch(&expected->remote, i));
+    assert_eq(remote_fetch_hash(&filter->remote, i), remote_fetch_hash(&expected->remote, i));
+  }
+  for (size_t i=0; i<nelts; i++) {
+    assert(utaf_lookup(filter, elts[i]));
+  }
+  free(elts);
+  utaf_destroy(filter);
+  utaf_destroy(expected);
+  printf("passed.\n");
+}
+
+void test_save_and_load_mmap() {
+  printf("Testing %s...", __FUNCTION__);
+  size_t n = 64 * 64;
+  size_t nelts = n * 9/10;
+  size_t nqueries = 4 * n;
+  FullTAF *filter = new_utaf(n);
+  srandom(FullTAF_SEED);
+  elt_t *elts = malloc((nelts + nqueries) * sizeof(elt_t));
+  for (size_t i=0; i<nelts + nqueries; i++) {
+    elts[i] = random();
+    if (i < nelts) {
+      utaf_insert(filter, elts[i]);
+    } else {
+      utaf_lookup(filter, elts[i]);
+    }
+  }
+  char path[] = "/tmp/utaf_save_XXXXXX";
+  close(mkstemp(path));
+  assert_eq(utaf_save(filter, path), 0);
+  FullTAFBlock *saved = malloc(filter->nblocks * sizeof(FullTAFBlock));
+  memcpy(saved, filter->blocks, filter->nblocks * sizeof(FullTAFBlock));
+
+  // The loaded filter uses the file's blocks and remote as they were saved
+  FullTAF *loaded = malloc(sizeof(FullTAF));
+  assert_eq(utaf_load_mmap(loaded, path), 0);
+  assert(loaded->blocks_mapped);
+  assert_eq(loaded->q, filter->q);
+  assert_eq(loaded->nelts, filter->nelts);
+  assert_eq(memcmp(loaded->blocks, saved, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  for (size_t i=0; i<filter->nslots; i++) {
+    assert_eq(remote_fetch(&loaded->remote, i), remote_fetch(&filter->remote, i));
+  }
+
+  // Lookups and adaptations behave as in the original, and don't reach the file
+  srandom(FullTAF_SEED + 1);
+  for (size_t i=0; i<nqueries; i++) {
+    elt_t elt = random();
+    assert_eq(utaf_lookup(loaded, elt), utaf_lookup(filter, elt));
+  }
+  assert_eq(memcmp(loaded->blocks, filter->blocks, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  FullTAF *reloaded = malloc(sizeof(FullTAF));
+  assert_eq(utaf_load_mmap(reloaded, path), 0);
+  assert_eq(memcmp(reloaded->blocks, saved, filter->nblocks * sizeof(FullTAFBlock)), 0);
+  utaf_destroy(reloaded);
+
+  // Growing moves the blocks out of the file
+  add_block(loaded);
+  assert(!loaded->blocks_mapped);
+  for (size_t i=0; i<nelts; i++) {
+    assert(utaf_lookup(loaded, elts[i]));
+  }
+  unlink(path);
+  free(saved);
+  free(elts);
+  utaf_destroy(loaded);
+  utaf_destroy(filter);
+  printf("passed.\n");
+}
+
 int main() {
   test_add_block();
   test_add_block_no_clobber();
@@ -1042,5 +1642,9 @@ int main() {
   test_insert_and_query();
   test_insert_and_query_w_repeats();
   test_mixed_insert_and_query_w_repeats();
+  test_match_in_run();
+  test_contains_and_report();
+  test_expand();
+  test_save_and_load_mmap();
 }
 #endif // TEST_UTAF
@@ -12,6 +12,7 @@ extern "C" {
 #include <stdint.h>
 #include "constants.h"
 #include "remainder.h"
+#include "remote.h"
 
 #define UTAF_MAX_SEL (1 << 8)
 
@@ -23,35 +24,39 @@ typedef struct utaf_block_t {
   uint8_t selectors[64];
 } FullTAFBlock;
 
-typedef uint64_t elt_t;
-
-#ifndef TAF_H
-typedef struct remote_elt_t {
-  uint64_t elt;
-  uint64_t hash;
-} Remote_elt ;
-#endif
-
 typedef struct utaf_t {
   size_t p;                     /* fingerprint prefix size = log2(n/E) to get false-pos rate E */
   size_t q;                     /* length of quotient */
   size_t r;                     /* length of remainder */
   size_t nslots;                /* number of slots available (2^q) */
   size_t nblocks;               /* nslots/64 */
+  size_t nblocks_alloc;         /* blocks allocated, including room for overflow blocks */
   size_t nelts;                 /* number of elements stored  */
   int seed;                     /* seed for Murmurhash */
   FullTAFBlock* blocks;           /* blocks of 64 remainders with metadata  */
-  Remote_elt* remote;           /* array of inserted elements (up to 64 bits) */
+  int blocks_mapped;            /* blocks are in `mapping`, so aren't freed or realloced */
+  void *mapping;                /* file mapped by utaf_load_mmap, or NULL */
+  size_t mapping_size;
+  Remote remote;                /* inserted elements (up to 64 bits), by slot */
 } FullTAF;
 
 #define selector(filter, i) ((filter)->blocks[(i)/64].selectors[(i)%64])
 
 void utaf_init(FullTAF *filter, size_t n, int seed);
+void utaf_init_remote(FullTAF *filter, size_t n, int seed, Remote remote);
 void utaf_destroy(FullTAF* filter);
 int utaf_lookup(FullTAF *filter, elt_t elt);
+int utaf_contains(const FullTAF *filter, elt_t elt);
+int utaf_report_false_positive(FullTAF *filter, elt_t elt);
+void utaf_lookup_batch(FullTAF *filter, const elt_t *elts, size_t n, uint8_t *out);
 void utaf_insert(FullTAF *filter, elt_t elt);
+int utaf_expand(FullTAF *filter);
 void utaf_clear(FullTAF* filter);
 
+// Saving and loading (see serial.h for the format)
+int utaf_save(const FullTAF *filter, const char *path);
+int utaf_load_mmap(FullTAF *filter, const char *path);
+
 // Printing
 double utaf_load(FullTAF *filter);
 void print_utaf(FullTAF* filter);